@@ -0,0 +1,57 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "bench.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+std::atomic<size_t> allocation_count{ 0 };
+}
+
+size_t
+Obozrenie::Bench::allocations()
+{
+  return allocation_count.load(std::memory_order_relaxed);
+}
+
+void*
+operator new(size_t n)
+{
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = std::malloc(n ? n : 1))
+  {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void
+operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void
+operator delete(void* p, size_t) noexcept
+{
+  std::free(p);
+}
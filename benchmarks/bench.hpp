@@ -0,0 +1,64 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _BENCH_HPP_
+#define _BENCH_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+namespace Obozrenie
+{
+namespace Bench
+{
+// Calls of the global operator new so far. Counted by alloc_counter.cpp, which every benchmark links in.
+size_t allocations();
+
+struct Result
+{
+  double ms;
+  double allocations;
+};
+
+// Runs the function once to warm up, then the given number of times, and prints the average time and allocation count per run.
+template <typename F>
+Result
+run(const std::string& name, size_t iterations, F&& f)
+{
+  f();
+
+  auto allocs = allocations();
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++)
+  {
+    f();
+  }
+  auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  Result v{ elapsed / iterations, double(allocations() - allocs) / iterations };
+  std::cout << std::left << std::setw(48) << name << std::right << std::fixed << std::setprecision(3) << std::setw(12) << v.ms << " ms"
+            << std::setprecision(1) << std::setw(14) << v.allocations << " allocs" << std::endl;
+  return v;
+}
+}
+}
+
+#endif
@@ -0,0 +1,89 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _QSTAT_DOCUMENT_HPP_
+#define _QSTAT_DOCUMENT_HPP_
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace Obozrenie
+{
+namespace Bench
+{
+const char* const QSTAT_SERVER_TYPE = "Q3S";
+
+// Output of qstat -xml -R -P for a master listing the given number of Quake 3 servers, shaped like a recorded ioquake3 refresh.
+inline std::string
+qstat_document(size_t servers)
+{
+  std::ostringstream v;
+  v << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<qstat>\n";
+  v << "\t<server type=\"Q3M\" address=\"master.ioquake3.org:27950\" status=\"UP\" servers=\"" << servers << "\">\n\t</server>\n";
+  for (size_t i = 0; i < servers; i++)
+  {
+    auto host = "10." + std::to_string(i >> 16) + "." + std::to_string((i >> 8) & 255) + "." + std::to_string(i & 255) + ":27960";
+    v << "\t<server type=\"Q3S\" address=\"" << host << "\" status=\"UP\">\n"
+      << "\t\t<hostname>" << host << "</hostname>\n"
+      << "\t\t<name>^1Red ^7Server &amp; friends #" << i << "</name>\n"
+      << "\t\t<gametype>" << (i % 3 ? "baseq3" : "osp") << "</gametype>\n"
+      << "\t\t<map>q3dm" << i % 20 << "</map>\n"
+      << "\t\t<numplayers>" << i % 4 << "</numplayers>\n"
+      << "\t\t<maxplayers>16</maxplayers>\n"
+      << "\t\t<numspectators>0</numspectators>\n"
+      << "\t\t<maxspectators>0</maxspectators>\n"
+      << "\t\t<ping>" << 20 + i % 200 << "</ping>\n"
+      << "\t\t<retries>0</retries>\n"
+      << "\t\t<rules>\n"
+      << "\t\t\t<rule name=\"g_needpass\">" << (i % 10 == 0) << "</rule>\n"
+      << "\t\t\t<rule name=\"sv_punkbuster\">0</rule>\n"
+      << "\t\t\t<rule name=\"version\">ioq3 1.36_GIT_f2c61c14-2017-07-20 linux-x86_64 Jul 20 2017</rule>\n"
+      << "\t\t\t<rule name=\"fraglimit\">20</rule>\n"
+      << "\t\t\t<rule name=\"timelimit\">15</rule>\n"
+      << "\t\t\t<rule name=\"sv_maxRate\">25000</rule>\n"
+      << "\t\t</rules>\n"
+      << "\t\t<players>\n";
+    for (size_t p = 0; p < i % 4; p++)
+    {
+      v << "\t\t\t<player>\n\t\t\t\t<name>^3Player" << p << "</name>\n\t\t\t\t<score>" << p * 3 << "</score>\n\t\t\t\t<ping>" << 40 + p
+        << "</ping>\n\t\t\t</player>\n";
+    }
+    v << "\t\t</players>\n\t</server>\n";
+  }
+  v << "</qstat>\n";
+  return v.str();
+}
+
+// The recorded document at the path if one is given, otherwise a generated one.
+inline std::string
+qstat_document(size_t servers, const char* path)
+{
+  if (!path)
+  {
+    return qstat_document(servers);
+  }
+  std::ifstream f(path, std::ios::binary);
+  std::ostringstream v;
+  v << f.rdbuf();
+  return v.str();
+}
+}
+}
+
+#endif
@@ -0,0 +1,59 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+// Scaling of the sliced qstat parser with the number of threads.
+// Usage: bench_qstat_parallel [servers [recorded.xml]]. Defaults to a generated document of 100k servers.
+// Only the single thread figure has been measured so far, about 1.6 s for the default document. Whether slicing pays off on
+// more cores is what this program is for; during a refresh the parse mostly overlaps qstat's own probing either way.
+
+#include <cstdlib>
+#include <string>
+
+#include <libobozrenie/backend_qstat.hpp>
+#include <libobozrenie/parallel.hpp>
+
+#include "bench.hpp"
+#include "qstat_document.hpp"
+
+using namespace Obozrenie;
+
+int
+main(int argc, char** argv)
+{
+  size_t servers = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+  Glib::ustring doc = Bench::qstat_document(servers, argc > 2 ? argv[2] : nullptr);
+
+  size_t parsed = 0;
+  QuerySink sink;
+  sink.push = [&parsed](ServerData batch) { parsed += batch.size(); };
+  Backends::QStat::parse_xml(doc, Bench::QSTAT_SERVER_TYPE, sink, CancellationToken(), 1);
+  std::cout << doc.bytes() / 1024 << " KiB, " << parsed << " servers, " << default_parallelism() << " hardware threads" << std::endl;
+
+  double serial_ms = 0;
+  for (size_t threads = 1; threads <= default_parallelism(); threads *= 2)
+  {
+    auto v = Bench::run(std::to_string(threads) + " thread(s)", 3, [&]() {
+      Backends::QStat::parse_xml(doc, Bench::QSTAT_SERVER_TYPE, sink, CancellationToken(), threads);
+    });
+    if (threads == 1)
+    {
+      serial_ms = v.ms;
+    }
+    std::cout << "  speedup " << serial_ms / v.ms << std::endl;
+  }
+}
@@ -0,0 +1,169 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+// Parsing qstat -xml output: the streaming SAX parser against the DOM and XPath parser it replaced.
+// Usage: bench_qstat_parse [servers [recorded.xml]]. Without a server count, generated documents of 10k and 100k servers are used.
+
+#include <cstdlib>
+#include <set>
+#include <string>
+
+#include <libobozrenie/backend_qstat.hpp>
+#include <libobozrenie/xmlpp_util.hpp>
+
+#include "bench.hpp"
+#include "qstat_document.hpp"
+
+using namespace Obozrenie;
+
+namespace
+{
+// The parser as it was before the switch to SAX: the whole document is built as a tree and every field is looked up with XPath.
+namespace Dom
+{
+const auto COLOR_CODE_PATTERN = "[\\^](.)";
+
+Player
+parse_player_entry(const xmlpp::Node& data_node)
+{
+  Player e;
+
+  xmlpp::util::CallbackMap cb_data;
+  cb_data["name"] = [&e](const auto& v) { e.name = xmlpp::util::get_string(v); };
+  cb_data["score"] = [&e](const auto& v) { e.info["score"] = xmlpp::util::get_string(v); };
+  cb_data["ping"] = [&e](const auto& v) { e.info["ping"] = xmlpp::util::get_string(v); };
+  xmlpp::util::map_node(data_node, cb_data);
+
+  return e;
+}
+
+std::pair<Glib::ustring, Server>
+parse_server_entry(const xmlpp::Node& m, std::string server_type)
+{
+  auto parsed_type = xmlpp::util::get_string(m, "@type");
+  if (parsed_type != server_type)
+  {
+    throw Backends::QStat::InvalidServerType(parsed_type);
+  }
+
+  Glib::ustring host;
+  Server data;
+
+  xmlpp::util::CallbackMap cb_data;
+  cb_data["hostname"] = [&host](const auto& v) { host = xmlpp::util::get_string(v); };
+  cb_data["name"] = [&data](const auto& v) {
+    data.name = Glib::Regex::create(COLOR_CODE_PATTERN)->replace(xmlpp::util::get_string(v), 0, Glib::ustring(), static_cast<Glib::RegexMatchFlags>(0));
+  };
+  cb_data["gametype"] = [&data](const auto& v) { data.game_type = Atom(xmlpp::util::get_string(v)); };
+  cb_data["map"] = [&data](const auto& v) { data.terrain = Atom(xmlpp::util::get_string(v)); };
+  cb_data["numplayers"] = [&data](const auto& v) { data.player_count = xmlpp::util::get_number<int>(v); };
+  cb_data["maxplayers"] = [&data](const auto& v) { data.player_limit = xmlpp::util::get_number<int>(v); };
+  cb_data["numspectators"] = [&data](const auto& v) { data.spectator_count = xmlpp::util::get_number<int>(v); };
+  cb_data["maxspectators"] = [&data](const auto& v) { data.spectator_limit = xmlpp::util::get_number<int>(v); };
+  cb_data["ping"] = [&data](const auto& v) { data.ping = xmlpp::util::get_number<int>(v); };
+  cb_data["rules"] = [&data](const auto& v) {
+    for (auto rule_node : v.find(".//rule"))
+    {
+      auto k = xmlpp::util::get_string(*rule_node, "@name");
+      auto v = xmlpp::util::get_string(*rule_node);
+
+      data.rules[Atom(k)] = v;
+    }
+  };
+  cb_data["players"] = [&data](const auto& v) {
+    for (auto player_node : v.find(".//player"))
+    {
+      auto e = parse_player_entry(*player_node);
+
+      if (!e.name.empty())
+      {
+        data.players.push_back(e);
+      }
+    }
+  };
+  xmlpp::util::map_node(m, cb_data);
+
+  for (const auto& kv : data.rules)
+  {
+    if (std::set<Glib::ustring>{ "punkbuster", "sv_punkbuster", "secure" }.count(kv.first))
+    {
+      data.secure = (kv.second == "0" ? false : true);
+    }
+    if (std::set<Glib::ustring>{ "g_needpass", "needpass", "si_usepass", "pswrd", "password" }.count(kv.first))
+    {
+      data.need_pass = (kv.second == "0" ? false : true);
+    }
+  }
+
+  if (host.empty())
+  {
+    throw DataParseError("Empty host.");
+  }
+
+  return std::make_pair(host, data);
+}
+
+ServerData
+parse_xml(Glib::ustring xml_data, std::string server_type)
+{
+  xmlpp::util::EasyDocument doc;
+  doc.parse(xml_data);
+
+  ServerData data;
+
+  xmlpp::util::CallbackMap cb_data;
+  cb_data["server"] = [&data, server_type](const auto& v) {
+    try
+    {
+      data.emplace(parse_server_entry(v, server_type));
+    }
+    catch (...)
+    {
+    }
+  };
+  xmlpp::util::map_node(doc(), cb_data);
+
+  return data;
+}
+}
+
+void
+compare(size_t servers, const char* path)
+{
+  Glib::ustring doc = Bench::qstat_document(servers, path);
+  auto iterations = doc.bytes() > 16 * 1024 * 1024 ? 3 : 10;
+
+  std::cout << doc.bytes() / 1024 << " KiB, " << Backends::QStat::parse_xml(doc, Bench::QSTAT_SERVER_TYPE).size() << " servers" << std::endl;
+  Bench::run("DOM + XPath", iterations, [&]() { Dom::parse_xml(doc, Bench::QSTAT_SERVER_TYPE); });
+  QuerySink discard{ [](ServerData) {}, nullptr };
+  Bench::run("SAX, one thread", iterations, [&]() { Backends::QStat::parse_xml(doc, Bench::QSTAT_SERVER_TYPE, discard, CancellationToken(), 1); });
+  Bench::run("SAX, all threads", iterations, [&]() { Backends::QStat::parse_xml(doc, Bench::QSTAT_SERVER_TYPE); });
+}
+}
+
+int
+main(int argc, char** argv)
+{
+  if (argc > 1)
+  {
+    compare(std::strtoul(argv[1], nullptr, 10), argc > 2 ? argv[2] : nullptr);
+    return 0;
+  }
+  compare(10000, nullptr);
+  compare(100000, nullptr);
+}
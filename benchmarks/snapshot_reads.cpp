@@ -0,0 +1,77 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+// Allocations per read of a game's servers: the deep copy returned by get_servers against the shared snapshot.
+
+#include <cstdlib>
+#include <string>
+
+#include <libobozrenie/core.hpp>
+
+#include "bench.hpp"
+
+using namespace Obozrenie;
+
+namespace
+{
+ServerData
+make_servers(size_t n)
+{
+  ServerData v;
+  for (size_t i = 0; i < n; i++)
+  {
+    Server s;
+    s.name = "Server " + std::to_string(i);
+    s.country = Atom(i % 2 ? "DE" : "US");
+    s.game_type = Atom("ffa");
+    s.terrain = Atom("q3dm" + std::to_string(i % 20));
+    s.player_count = int(i % 16);
+    s.player_limit = 16;
+    s.ping = int(i % 300);
+    s.rules[Atom("g_needpass")] = "0";
+    s.rules[Atom("sv_hostname")] = *s.name;
+    for (int p = 0; p < 4; p++)
+    {
+      s.players.push_back(Player{ "player" + std::to_string(p), { { "score", std::to_string(p) } } });
+    }
+    v.emplace("10." + std::to_string(i >> 16) + "." + std::to_string((i >> 8) & 255) + "." + std::to_string(i & 255) + ":27960", std::move(s));
+  }
+  return v;
+}
+}
+
+int
+main(int argc, char** argv)
+{
+  size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+  const GameID id = "bench";
+
+  GameTable table;
+  table.create_game_entry(id);
+  table.insert_servers(id, make_servers(n), true);
+  auto host = table.get_server_snapshot(id).data->host(0);
+
+  std::cout << n << " servers" << std::endl;
+  Bench::run("get_servers (deep copy)", 20, [&]() { table.get_servers(id); });
+  Bench::run("get_server_snapshot (shared)", 20000, [&]() { table.get_server_snapshot(id); });
+  Bench::run("get_server_info_by_host", 20000, [&]() { table.get_server_info_by_host(id, host); });
+  Bench::run("snapshot row read", 20000, [&]() {
+    auto snapshot = table.get_server_snapshot(id);
+    snapshot.data->get(snapshot.data->find(host));
+  });
+}
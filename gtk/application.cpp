@@ -19,6 +19,8 @@
 #include "application.hpp"
 
 #include <iostream>
+#include <set>
+#include <sstream>
 
 #include "config.hpp"
 
@@ -29,6 +31,26 @@ namespace GTK
 
 const auto error_message_setting = "gtk_error_label";
 
+AtomSet
+atoms_from_entry(const Glib::ustring& text)
+{
+  AtomSet v;
+
+  std::istringstream ss(text.raw());
+  std::string item;
+  while (std::getline(ss, item, ','))
+  {
+    auto begin = item.find_first_not_of(' ');
+    auto end = item.find_last_not_of(' ');
+    if (begin != std::string::npos)
+    {
+      v.insert(Atom(item.substr(begin, end - begin + 1)));
+    }
+  }
+
+  return v;
+}
+
 void
 Application::show_about_dialog()
 {
@@ -51,6 +73,48 @@ Application::on_game_preferences_button_clicked_cb()
 {
 }
 
+void
+Application::on_filters_changed_cb()
+{
+  ServerFilter f;
+
+  f.game_mods = atoms_from_entry(this->filter_mod_entry->get_text());
+  f.game_types = atoms_from_entry(this->filter_type_entry->get_text());
+  f.terrains = atoms_from_entry(this->filter_terrain_entry->get_text());
+
+  auto max_ping = this->filter_ping_spinbutton->get_value_as_int();
+  if (max_ping > 0)
+  {
+    f.ping_max = max_ping;
+  }
+
+  f.not_full = this->filter_notfull_checkbutton->get_active();
+  f.not_empty = this->filter_notempty_checkbutton->get_active();
+  if (this->filter_nopassword_checkbutton->get_active())
+  {
+    f.need_pass = false;
+  }
+
+  auto secure = this->filter_secure_comboboxtext->get_active_id();
+  if (secure == "secure")
+  {
+    f.secure = true;
+  }
+  else if (secure == "insecure")
+  {
+    f.secure = false;
+  }
+
+  this->server_filter_plan = FilterPlan(f);
+
+  if (!this->server_list_game.empty())
+  {
+    this->selection_signal_connection.block();
+    this->populate_server_list(this->server_list_game);
+    this->selection_signal_connection.unblock();
+  }
+}
+
 void
 Application::on_server_browser_view_selection_changed_cb()
 {
@@ -104,6 +168,7 @@ Application::on_status_changed_cb(GameID id, Obozrenie::QueryStatus new_status)
     if (id == selected)
     {
       this->refresh_button->set_sensitive(false);
+      this->loading_label->set_text("Loading");
       this->server_browser_pager->set_current_page(int(GameBrowserPages::LOADING));
     }
     break;
@@ -118,6 +183,31 @@ Application::on_status_changed_cb(GameID id, Obozrenie::QueryStatus new_status)
   }
 }
 
+void
+Application::on_progress_changed_cb(GameID id, Obozrenie::QueryProgress progress)
+{
+  Glib::ustring selected = (*this->game_browser_view->get_selection()->get_selected())[this->game_list_columns.id];
+  if (id != selected || this->core->game_table->get_query_status(id) != QueryStatus::WORKING)
+  {
+    return;
+  }
+
+  if (progress.expected > 0)
+  {
+    this->loading_label->set_text(Glib::ustring::compose("Loading: %1 of %2 servers", progress.received, progress.expected));
+  }
+  else
+  {
+    this->loading_label->set_text(Glib::ustring::compose("Loading: %1 servers", progress.received));
+  }
+
+  // Leave the loading page as soon as there is something to show; later batches arrive as change sets.
+  if (progress.received > 0 && this->server_browser_pager->get_current_page() == int(GameBrowserPages::LOADING))
+  {
+    this->present_servers(id);
+  }
+}
+
 void
 Application::on_game_browser_view_selection_changed_cb()
 {
@@ -132,7 +222,7 @@ Application::on_game_browser_view_selection_changed_cb()
     auto qs = this->core->game_table->get_query_status(id);
     if (qs == QueryStatus::EMPTY)
     {
-      this->do_refresh(id);
+      this->do_refresh(id, TaskPriority::USER);
     }
     else
     {
@@ -147,7 +237,7 @@ Application::on_refresh_button_clicked_cb()
   auto id = (*this->game_browser_view->get_selection()->get_selected())[this->game_list_columns.id];
   if (this->core->game_table->get_query_status(id) != QueryStatus::WORKING)
   {
-    this->do_refresh(id);
+    this->do_refresh(id, TaskPriority::USER);
   }
 }
 
@@ -161,75 +251,156 @@ Application::show_server_info(Glib::ustring game, Glib::ustring host) {
 }
 
 void
-Application::do_refresh(GameID id)
+Application::do_refresh(GameID id, TaskPriority priority)
 {
-  this->async_cb([this, id]() {
-    try
-    {
-      this->core->refresh_servers(
-        id, false, [this, id](const std::exception& e) { this->core->game_table->set_setting<std::string>(id, Obozrenie::SettingGroup::SYSTEM, error_message_setting, e.what(), true); });
-    }
-    catch (...)
-    {
-      return;
-    }
-    this->core->game_table->set_setting<std::string>(id, Obozrenie::SettingGroup::SYSTEM, error_message_setting, "", true);
-  });
+  this->core->refresh(id, RefreshMode::AUTO, priority).then(
+    [this, id](Future<RefreshResult> result) {
+      std::string message;
+      try
+      {
+        result.get();
+      }
+      catch (const std::exception& e)
+      {
+        message = e.what();
+      }
+      this->core->game_table->set_setting<std::string>(id, Obozrenie::SettingGroup::SYSTEM, error_message_setting, message, true);
+    },
+    this->main_loop);
+}
+
+void
+Application::fill_server_row(const Gtk::TreeRow& row, GameID id, const ServerStore& store, ServerStore::Row r)
+{
+  row[this->server_list_columns.game_id] = id;
+  row[this->server_list_columns.game_icon] = this->pixbufs.at(pixbuf_gameid(id));
+  row[this->server_list_columns.host] = store.host(r);
+  row[this->server_list_columns.name] = store.has(ServerField::NAME, r) ? store.name(r) : Glib::ustring("(unnamed server)");
+  row[this->server_list_columns.need_pass] = store.need_pass(r);
+  row[this->server_list_columns.lock_icon] = store.need_pass(r) ? this->themed_icons.need_pass : Glib::ustring();
+  row[this->server_list_columns.secure] = store.secure(r);
+  row[this->server_list_columns.secure_icon] = store.secure(r) ? this->themed_icons.secure : Glib::ustring();
+  row[this->server_list_columns.player_count] = store.player_count_column()[r];
+  row[this->server_list_columns.player_limit] = store.player_limit_column()[r];
+  row[this->server_list_columns.ping] = store.has(ServerField::PING, r) ? store.ping_column()[r] : 9999;
+  row[this->server_list_columns.game_type] = store.game_type(r);
+  row[this->server_list_columns.game_mod] = store.game_mod(r);
+  row[this->server_list_columns.terrain] = store.terrain(r);
 }
 
 void
 Application::populate_server_list(GameID id)
 {
   this->server_list->clear();
+  this->server_rows.clear();
+
+  auto snapshot = this->core->game_table->get_server_snapshot(id);
+  this->server_list_game = id;
+  this->server_list_generation = snapshot.generation;
+
+  const auto& store = *snapshot.data;
+  for (auto r : this->server_filter_plan.select(store))
+  {
+    auto iter = this->server_list->append();
+    this->fill_server_row(*iter, id, store, r);
+    this->server_rows[store.host(r)] = iter;
+  }
+}
 
-  auto data = this->core->game_table->get_servers(id);
+void
+Application::apply_server_changes(GameID id, const ServerChangeSet& changes)
+{
+  if (id != this->server_list_game || changes.snapshot.generation <= this->server_list_generation)
+  {
+    return;
+  }
 
-  for (auto kv : data)
+  // A skipped generation means the rows no longer match the base of this change set.
+  if (changes.snapshot.generation != this->server_list_generation + 1)
   {
-    auto host = kv.first;
-    auto v = kv.second;
-    auto row = *this->server_list->append();
-    row[this->server_list_columns.game_id] = id;
-    row[this->server_list_columns.game_icon] = this->pixbufs.at(pixbuf_gameid(id));
-    row[this->server_list_columns.host] = host;
-    row[this->server_list_columns.name] = v.name.value_or("(unnamed server)");
-    row[this->server_list_columns.need_pass] = v.need_pass.value_or(false);
-    if (v.need_pass.value_or(false))
+    this->selection_signal_connection.block();
+    this->populate_server_list(id);
+    this->selection_signal_connection.unblock();
+    return;
+  }
+
+  const auto& store = *changes.snapshot.data;
+
+  this->selection_signal_connection.block();
+  for (const auto& host : changes.removed)
+  {
+    auto it = this->server_rows.find(host);
+    if (it != this->server_rows.end())
+    {
+      this->server_list->erase(it->second);
+      this->server_rows.erase(it);
+    }
+  }
+  for (const auto& host : changes.updated)
+  {
+    auto r = store.find(host);
+    auto matches = this->server_filter_plan.matches(store, r);
+    auto it = this->server_rows.find(host);
+    if (it != this->server_rows.end())
+    {
+      if (matches)
+      {
+        this->fill_server_row(*it->second, id, store, r);
+      }
+      else
+      {
+        this->server_list->erase(it->second);
+        this->server_rows.erase(it);
+      }
+    }
+    else if (matches)
     {
-      row[this->server_list_columns.lock_icon] = this->themed_icons.need_pass;
+      auto iter = this->server_list->append();
+      this->fill_server_row(*iter, id, store, r);
+      this->server_rows[host] = iter;
     }
-    row[this->server_list_columns.secure] = v.secure.value_or(false);
-    if (v.secure.value_or(false))
+  }
+  for (const auto& host : changes.added)
+  {
+    auto r = store.find(host);
+    if (this->server_filter_plan.matches(store, r))
     {
-      row[this->server_list_columns.secure_icon] = this->themed_icons.secure;
+      auto iter = this->server_list->append();
+      this->fill_server_row(*iter, id, store, r);
+      this->server_rows[host] = iter;
     }
-    row[this->server_list_columns.player_count] = v.player_count.value_or(0);
-    row[this->server_list_columns.player_limit] = v.player_limit.value_or(0);
-    row[this->server_list_columns.ping] = v.ping.value_or(9999);
-    row[this->server_list_columns.game_type] = v.game_type.value_or("");
-    row[this->server_list_columns.game_mod] = v.game_mod.value_or("");
-    row[this->server_list_columns.terrain] = v.terrain.value_or("");
   }
+  this->selection_signal_connection.unblock();
+
+  this->server_list_generation = changes.snapshot.generation;
 }
 
 void
 Application::connect_signals()
 {
-  this->core->game_table->servers_changed.connect([this](GameID, ServerData) {
-    Glib::signal_idle().connect([this]() {
-      this->server_connect_info_changed();
-      return false;
-    });
-  });
-
-  this->core->game_table->status_changed.connect([this](GameID id, QueryStatus ns, QueryStatus os) {
-    Glib::signal_idle().connect([this, id, ns, os]() {
-      this->on_status_changed_cb(id, ns);
-      return false;
-    });
-  });
+  // Game table events are delivered on the main loop, so the writer never waits for the UI.
+  this->core->game_table->events.subscribe(
+    [this](const GameEvent& e) {
+      switch (e.type)
+      {
+      case GameEventType::SERVERS_CHANGED:
+        this->apply_server_changes(e.id, e.changes);
+        this->server_connect_info_changed();
+        break;
+      case GameEventType::STATUS_CHANGED:
+        this->on_status_changed_cb(e.id, e.status);
+        break;
+      case GameEventType::PROGRESS_CHANGED:
+        this->on_progress_changed_cb(e.id, e.progress);
+        break;
+      default:
+        break;
+      }
+    },
+    this->main_loop);
 
-  this->refresh_button->signal_clicked().connect([this]() { this->async_cb(sigc::mem_fun(*this, &Application::on_refresh_button_clicked_cb)); });
+  // Refreshes return at once, so the click is handled right on the main loop.
+  this->refresh_button->signal_clicked().connect(sigc::mem_fun(*this, &Application::on_refresh_button_clicked_cb));
   this->game_browser_view->get_selection()->signal_changed().connect([this]() {
     if (this->first_selection)
     {
@@ -294,6 +465,17 @@ Application::connect_signals()
 
   this->filters_button->signal_clicked().connect([this]() { this->filters_revealer->set_reveal_child(this->filters_button->get_active()); });
 
+  for (auto entry : { this->filter_mod_entry, this->filter_type_entry, this->filter_terrain_entry })
+  {
+    entry->signal_changed().connect([this]() { this->on_filters_changed_cb(); });
+  }
+  for (auto check : { this->filter_notfull_checkbutton, this->filter_notempty_checkbutton, this->filter_nopassword_checkbutton })
+  {
+    check->signal_toggled().connect([this]() { this->on_filters_changed_cb(); });
+  }
+  this->filter_ping_spinbutton->signal_value_changed().connect([this]() { this->on_filters_changed_cb(); });
+  this->filter_secure_comboboxtext->signal_changed().connect([this]() { this->on_filters_changed_cb(); });
+
   this->app->signal_startup().connect([this]() {
     this->app->add_action("about")->signal_activate().connect([this](const auto&) { this->show_about_dialog(); });
     this->app->add_action("quit")->signal_activate().connect([this](const auto&) { this->app->quit(); });
@@ -311,22 +493,20 @@ Application::start() {
   return this->app->run(*this->main_window.operator->());
 }
 
-Application::Application(std::shared_ptr<ThreadPool> p,
+Application::Application(std::shared_ptr<Obozrenie::TaskPool> p,
                          std::function<void(std::string)> logger,
                          Glib::RefPtr<Gtk::Application> a,
                          std::shared_ptr<Obozrenie::Core> c,
                          Gtk::Builder& b,
                          std::map<Glib::ustring, Glib::RefPtr<Gdk::Pixbuf>> l) {
-  this->pool = p;
-
-  if (!this->pool)
-  {
-    this->async_cb = [](std::function<void()> fn) { std::thread(fn).detach(); };
-  }
-  else
-  {
-    this->async_cb = [this](std::function<void()> fn) { this->pool->enqueue(fn); };
-  }
+  this->pool = p ? p : Obozrenie::default_task_pool();
+  this->async_cb = [this](std::function<void()> fn, TaskPriority priority) { this->pool->post(std::move(fn), priority); };
+  this->main_loop = [](std::function<void()> f) {
+    Glib::signal_idle().connect([f]() {
+      f();
+      return false;
+    });
+  };
   this->log_fn = logger;
   this->app = a;
   this->core = c;
@@ -353,14 +533,28 @@ Application::Application(std::shared_ptr<ThreadPool> p,
   this->game_list = gl;
   this->first_selection = true;
   this->server_list = Gtk::ListStore::create(this->server_list_columns);
+  this->server_list_generation = 0;
 
   this->error_message = &get_widget<Gtk::Label>(b, "error_message");
+  this->loading_label = &get_widget<Gtk::Label>(b, "Loading_Page_Label");
 
   this->game_preferences_button = &get_widget<Gtk::Button>(b, "game_preferences_button");
   this->refresh_button = &get_widget<Gtk::Button>(b, "refresh_button");
   this->filters_button = &get_widget<Gtk::ToggleButton>(b, "filters_button");
 
   this->filters_revealer = &get_widget<Gtk::Revealer>(b, "filters_revealer");
+  this->filter_mod_entry = &get_widget<Gtk::Entry>(b, "filter-mod-entry");
+  this->filter_type_entry = &get_widget<Gtk::Entry>(b, "filter-type-entry");
+  this->filter_terrain_entry = &get_widget<Gtk::Entry>(b, "filter-terrain-entry");
+  this->filter_ping_spinbutton = &get_widget<Gtk::SpinButton>(b, "filter-ping-spinbutton");
+  this->filter_notfull_checkbutton = &get_widget<Gtk::CheckButton>(b, "filter-notfull-checkbutton");
+  this->filter_notempty_checkbutton = &get_widget<Gtk::CheckButton>(b, "filter-notempty-checkbutton");
+  this->filter_nopassword_checkbutton = &get_widget<Gtk::CheckButton>(b, "filter-nopassword-checkbutton");
+  this->filter_secure_comboboxtext = &get_widget<Gtk::ComboBoxText>(b, "filter-secure-comboboxtext");
+  this->filter_secure_comboboxtext->append("any", "Any");
+  this->filter_secure_comboboxtext->append("secure", "Secure");
+  this->filter_secure_comboboxtext->append("insecure", "Insecure");
+  this->filter_secure_comboboxtext->set_active_id("any");
 
   this->server_info_button = &get_widget<Gtk::Button>(b, "server_info_button");
   this->server_connect_button = &get_widget<Gtk::Button>(b, "server_connect_button");
@@ -65,7 +65,7 @@ private:
   sigc::signal<void> server_connect_info_changed;
   sigc::connection selection_signal_connection;
 
-  std::shared_ptr<ThreadPool> pool;
+  std::shared_ptr<Obozrenie::TaskPool> pool;
   Glib::RefPtr<Gtk::Application> app;
   std::shared_ptr<Obozrenie::Core> core;
   std::map<Glib::ustring, Glib::RefPtr<Gdk::Pixbuf>> pixbufs;
@@ -79,6 +79,9 @@ private:
 
   Glib::RefPtr<Gtk::ListStore> game_list;
   Glib::RefPtr<Gtk::ListStore> server_list;
+  GameID server_list_game;
+  uint64_t server_list_generation;
+  std::map<Glib::ustring, Gtk::TreeIter> server_rows;
 
   Glib::RefPtr<Gtk::ListStore> player_list;
   Glib::RefPtr<Gtk::ListStore> rule_list;
@@ -89,6 +92,7 @@ private:
   Gtk::TreeView* server_browser_view;
   Gtk::Notebook* server_browser_pager;
   Gtk::Label* error_message;
+  Gtk::Label* loading_label;
 
   Gtk::ComboBox* server_connect_game_combobox;
   Gtk::Entry* server_connect_host_entry;
@@ -99,23 +103,38 @@ private:
   Gtk::ToggleButton* filters_button;
 
   Gtk::Revealer* filters_revealer;
+  Gtk::Entry* filter_mod_entry;
+  Gtk::Entry* filter_type_entry;
+  Gtk::Entry* filter_terrain_entry;
+  Gtk::SpinButton* filter_ping_spinbutton;
+  Gtk::CheckButton* filter_notfull_checkbutton;
+  Gtk::CheckButton* filter_notempty_checkbutton;
+  Gtk::CheckButton* filter_nopassword_checkbutton;
+  Gtk::ComboBoxText* filter_secure_comboboxtext;
+  FilterPlan server_filter_plan;
 
   Gtk::Button* server_info_button;
   Gtk::Button* server_connect_button;
 
-  std::function<void(std::function<void()>)> async_cb;
+  std::function<void(std::function<void()>, Obozrenie::TaskPriority)> async_cb;
+  // Runs callbacks on the GTK main loop.
+  Obozrenie::Executor main_loop;
 
   void show_about_dialog();
 
   void on_status_changed_cb(GameID, Obozrenie::QueryStatus);
+  void on_progress_changed_cb(GameID, Obozrenie::QueryProgress);
   void on_refresh_button_clicked_cb();
   void on_game_browser_view_selection_changed_cb();
   void on_server_browser_view_selection_changed_cb();
   void on_game_preferences_button_clicked_cb();
+  void on_filters_changed_cb();
   void show_server_info(Glib::ustring, Glib::ustring);
 
-  void do_refresh(GameID);
+  void do_refresh(GameID, Obozrenie::TaskPriority);
+  void fill_server_row(const Gtk::TreeRow&, GameID, const ServerStore&, ServerStore::Row);
   void populate_server_list(GameID);
+  void apply_server_changes(GameID, const ServerChangeSet&);
   void present_servers(GameID);
 
   void connect_signals();
@@ -123,7 +142,7 @@ private:
 public:
   int start();
 
-  Application(std::shared_ptr<ThreadPool>, std::function<void(std::string)>, Glib::RefPtr<Gtk::Application>, std::shared_ptr<Obozrenie::Core>, Gtk::Builder&, std::map<Glib::ustring, Glib::RefPtr<Gdk::Pixbuf>>);
+  Application(std::shared_ptr<Obozrenie::TaskPool>, std::function<void(std::string)>, Glib::RefPtr<Gtk::Application>, std::shared_ptr<Obozrenie::Core>, Gtk::Builder&, std::map<Glib::ustring, Glib::RefPtr<Gdk::Pixbuf>>);
   virtual ~Application();
 };
 }
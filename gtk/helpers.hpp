@@ -37,7 +37,7 @@ T& get_widget(Gtk::Builder& b, Glib::ustring k) {
 
   b.get_widget(k, v);
 
-  if (v) { throw NoSuchWidgetError(k); }
+  if (!v) { throw NoSuchWidgetError(k); }
 
   return *v;
 }
@@ -37,13 +37,27 @@ main(int argc, char* argv[])
   std::vector<std::string> ct_cat_vec = { Obozrenie::CORE_COMPONENT_STRING };
   auto log_core = [cout_ptr, ct_cat_vec](auto msg) { Obozrenie::log_message(*cout_ptr, ct_cat_vec, msg); };
 
-  std::shared_ptr<ThreadPool> pool = nullptr;
+  std::shared_ptr<Obozrenie::TaskPool> pool = nullptr;
 #ifdef ENABLE_THREADPOOL
-  pool = std::shared_ptr<ThreadPool>(new ThreadPool(std::thread::hardware_concurrency()));
+  pool = std::make_shared<Obozrenie::TaskPool>(std::thread::hardware_concurrency());
 #endif
 
-  auto core = std::make_shared<Obozrenie::Core>();
+  auto core = std::make_shared<Obozrenie::Core>(pool);
   core->logger = [cout_ptr](auto cat, auto msg) { Obozrenie::log_message(*cout_ptr, cat, msg); };
+  core->game_table->listener_failed.connect([log_core](auto id, auto error) {
+    try
+    {
+      std::rethrow_exception(error);
+    }
+    catch (const std::exception& e)
+    {
+      log_core(Glib::ustring::compose("Listener failed for %1: %2", id, e.what()));
+    }
+    catch (...)
+    {
+      log_core(Glib::ustring::compose("Listener failed for %1", id));
+    }
+  });
   core->read_game_lists(Obozrenie::string_to_json(Obozrenie::get_string_from_resource(Glib::wrap(io_get_resource()), "/io/obozrenie/game_lists.json")));
 
   std::vector<std::string> game_names;
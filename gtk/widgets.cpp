@@ -32,11 +32,13 @@ void show_server_info_dialog(Gtk::Window& w, Glib::ustring game_v, Glib::ustring
     auto host = Gtk::manage(new Gtk::Label(host_v)); host->set_halign(Gtk::Align::ALIGN_START);
     auto name = Gtk::manage(new Gtk::Label); name->set_halign(Gtk::Align::ALIGN_START);
     auto terrain = Gtk::manage(new Gtk::Label); terrain->set_halign(Gtk::Align::ALIGN_START);
+    auto version = Gtk::manage(new Gtk::Label); version->set_halign(Gtk::Align::ALIGN_START);
     auto ping = Gtk::manage(new Gtk::Label); ping->set_halign(Gtk::Align::ALIGN_START);
     auto players = Gtk::manage(new Gtk::Label); players->set_halign(Gtk::Align::ALIGN_START);
 
     set_label_from_optional(name, data.name);
     set_label_from_optional(terrain, data.terrain);
+    set_label_from_optional(version, data.version);
     set_label_from_optional(ping, data.ping);
 
     try {
@@ -82,6 +84,10 @@ void show_server_info_dialog(Gtk::Window& w, Glib::ustring game_v, Glib::ustring
     server_info_data_grid->attach(*terrain_label, 0, i++, 1, 1);
     server_info_data_grid->attach_next_to(*terrain, *terrain_label, Gtk::PositionType::POS_RIGHT, 1, 1);
 
+    auto version_label = Gtk::manage(new Gtk::Label); version_label->set_markup("<b>Version:</b>"); version_label->set_halign(Gtk::Align::ALIGN_END);
+    server_info_data_grid->attach(*version_label, 0, i++, 1, 1);
+    server_info_data_grid->attach_next_to(*version, *version_label, Gtk::PositionType::POS_RIGHT, 1, 1);
+
     auto players_label = Gtk::manage(new Gtk::Label); players_label->set_markup("<b>Players:</b>"); players_label->set_halign(Gtk::Align::ALIGN_END);
     server_info_data_grid->attach(*players_label, 0, i++, 1, 1);
     server_info_data_grid->attach_next_to(*players, *players_label, Gtk::PositionType::POS_RIGHT, 1, 1);
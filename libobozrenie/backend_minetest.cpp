@@ -0,0 +1,331 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "backend_minetest.hpp"
+
+#include "http_client.hpp"
+#include "json_sax.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <unordered_set>
+
+namespace Obozrenie
+{
+namespace Backends
+{
+namespace Minetest
+{
+namespace
+{
+const int DEFAULT_MASTER_TIMEOUT_MS = 15000;
+const size_t BATCH_SIZE = 256;
+
+// Depths of the interesting parts of {"list": [{...}, ...], "total": {"servers": N}}.
+const size_t SERVER_DEPTH = 3;
+const size_t MAX_TRACKED_DEPTH = 4;
+
+// Entries copied verbatim into the server rules.
+const char* const RULE_KEYS[] = { "version", "description", "url", "creative", "damage", "pvp", "mapgen" };
+
+std::string
+format_number(double v)
+{
+  if (v == std::floor(v) && std::fabs(v) < 1e15)
+  {
+    return std::to_string(int64_t(v));
+  }
+  return std::to_string(v);
+}
+
+// Builds server records while the list document streams in and hands them to the sink in batches.
+// Hosts listed by several masters are only reported once. If a set of wanted hosts is given, all others are skipped.
+class ListHandler : public JsonHandler
+{
+private:
+  const QuerySink& sink;
+  std::unordered_set<std::string>& seen;
+  const std::unordered_set<std::string>* wanted;
+
+  size_t depth = 0;
+  std::array<std::string, MAX_TRACKED_DEPTH> keys;
+  bool in_list = false;
+  bool in_server = false;
+
+  std::string address;
+  int port = MINETEST_DEFAULT_PORT;
+  Server server;
+
+  ServerData batch;
+  size_t received = 0;
+  size_t expected = 0;
+
+  const std::string& current_key() const { return this->keys[this->depth - 1]; }
+
+  void set_rule(const std::string& k, const std::string& v)
+  {
+    for (auto rule : RULE_KEYS)
+    {
+      if (k == rule)
+      {
+        this->server.rules[Atom(k)] = v;
+        return;
+      }
+    }
+  }
+
+  void finish_server()
+  {
+    if (this->address.empty())
+    {
+      return;
+    }
+
+    auto host = this->address.find(':') == std::string::npos ? this->address : "[" + this->address + "]";
+    host += ":" + std::to_string(this->port);
+    if ((this->wanted && !this->wanted->count(host)) || !this->seen.insert(host).second)
+    {
+      return;
+    }
+
+    this->batch[host] = std::move(this->server);
+    this->received++;
+    if (this->batch.size() >= BATCH_SIZE)
+    {
+      this->flush();
+    }
+  }
+
+public:
+  void flush()
+  {
+    if (this->batch.empty())
+    {
+      return;
+    }
+    this->sink.push(std::move(this->batch));
+    this->batch = ServerData();
+    if (this->sink.progress)
+    {
+      this->sink.progress(this->received, std::max(this->expected, this->received));
+    }
+  }
+
+  void start_object() override
+  {
+    this->depth++;
+    if (this->in_list && this->depth == SERVER_DEPTH)
+    {
+      this->in_server = true;
+      this->address.clear();
+      this->port = MINETEST_DEFAULT_PORT;
+      this->server = Server();
+    }
+  }
+
+  void end_object() override
+  {
+    if (this->in_server && this->depth == SERVER_DEPTH)
+    {
+      this->in_server = false;
+      this->finish_server();
+    }
+    this->depth--;
+  }
+
+  void start_array() override
+  {
+    this->depth++;
+    if (this->depth == 2 && this->keys[0] == "list")
+    {
+      this->in_list = true;
+    }
+  }
+
+  void end_array() override
+  {
+    if (this->depth == 2)
+    {
+      this->in_list = false;
+    }
+    this->depth--;
+  }
+
+  void key(const std::string& k) override
+  {
+    if (this->depth > 0 && this->depth <= MAX_TRACKED_DEPTH)
+    {
+      this->keys[this->depth - 1] = k;
+    }
+  }
+
+  void string_value(const std::string& v) override
+  {
+    if (!this->in_server)
+    {
+      return;
+    }
+
+    if (this->depth == SERVER_DEPTH)
+    {
+      const auto& k = this->current_key();
+      if (k == "address")
+      {
+        this->address = v;
+      }
+      else if (k == "name")
+      {
+        this->server.name = Glib::ustring(v);
+      }
+      else if (k == "gameid" || k == "game_id")
+      {
+        this->server.game_mod = Atom(v);
+      }
+      else
+      {
+        this->set_rule(k, v);
+      }
+    }
+    else if (this->depth == SERVER_DEPTH + 1 && this->keys[SERVER_DEPTH - 1] == "clients_list")
+    {
+      Player player;
+      player.name = v;
+      this->server.players.push_back(player);
+    }
+  }
+
+  void number_value(double v) override
+  {
+    if (this->depth == 2 && this->keys[0] == "total" && this->current_key() == "servers")
+    {
+      this->expected = v > 0 ? size_t(v) : 0;
+      return;
+    }
+    if (!this->in_server || this->depth != SERVER_DEPTH)
+    {
+      return;
+    }
+
+    const auto& k = this->current_key();
+    if (k == "port")
+    {
+      this->port = int(v);
+    }
+    else if (k == "clients")
+    {
+      this->server.player_count = int(v);
+    }
+    else if (k == "clients_max")
+    {
+      this->server.player_limit = int(v);
+    }
+    else if (k == "ping")
+    {
+      // The list reports the master's round trip in seconds.
+      this->server.ping = int(std::lround(v * 1000));
+    }
+    else
+    {
+      this->set_rule(k, format_number(v));
+    }
+  }
+
+  void bool_value(bool v) override
+  {
+    if (!this->in_server || this->depth != SERVER_DEPTH)
+    {
+      return;
+    }
+
+    const auto& k = this->current_key();
+    if (k == "password")
+    {
+      this->server.need_pass = v;
+    }
+    else
+    {
+      this->set_rule(k, v ? "true" : "false");
+    }
+  }
+
+  ListHandler(const QuerySink& s, std::unordered_set<std::string>& h, const std::unordered_set<std::string>* w) : sink(s), seen(h), wanted(w) {}
+};
+}
+
+void
+query(GameID, const SettingsView& settings, const QueryScope& scope, const QuerySink& sink, const CancellationToken& token)
+{
+  const auto& masters = settings.get(MASTER_SERVER_URI_SETTING);
+  auto timeout = settings.find(MASTER_TIMEOUT_SETTING);
+
+  // Servers are only reachable through the list, which already carries their status.
+  // Refreshing known hosts therefore fetches it as well and keeps just those hosts.
+  std::unordered_set<std::string> wanted;
+  if (!scope.full)
+  {
+    if (scope.hosts.empty())
+    {
+      return;
+    }
+    wanted.insert(scope.hosts.begin(), scope.hosts.end());
+  }
+
+  // Masters are asked one after another; a failing master is skipped as long as another one answers.
+  std::unordered_set<std::string> seen;
+  std::string error;
+  bool any_succeeded = false;
+  for (const auto& uri : masters)
+  {
+    ListHandler handler(sink, seen, scope.full ? nullptr : &wanted);
+    JsonSaxParser parser(handler);
+    try
+    {
+      http_get(uri,
+               [&parser, &token](const char* data, size_t len) {
+                 token.throw_if_cancelled();
+                 parser.feed(data, len);
+               },
+               std::chrono::milliseconds(timeout ? *timeout : DEFAULT_MASTER_TIMEOUT_MS), token);
+      parser.finish();
+      any_succeeded = true;
+    }
+    catch (const std::exception& e)
+    {
+      // A cancelled or overdue query ends here rather than moving on to the next master.
+      token.throw_if_cancelled();
+      error = uri + " : " + e.what();
+    }
+    handler.flush();
+  }
+
+  if (!any_succeeded && !masters.empty())
+  {
+    throw BackendError(error);
+  }
+}
+
+Backend
+get_information()
+{
+  return Backend{.name = MINETEST_COMPONENT_STRING, .description = "Minetest server list backend", .version = "1.0", .f = query, .concurrency = 2 };
+}
+}
+}
+}
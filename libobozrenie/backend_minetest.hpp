@@ -22,21 +22,26 @@
 #include "common_models.hpp"
 #include "exceptions.hpp"
 
+#include <cstdint>
+#include <string>
+#include <vector>
+
 namespace Obozrenie
 {
 namespace Backends
 {
 namespace Minetest
 {
-ServerData query(GameID, ConfStorage)
-{
-  throw BackendError("backend stubbed");
-};
-Backend
-get_information()
-{
-  return Backend{ .name = "Minetest", .description = "Minetest backend", .version = "0.0", .f = query };
-};
+const char* const MINETEST_COMPONENT_STRING = "Minetest";
+
+// HTTP URLs of server list JSON documents, e.g. http://servers.minetest.net/list
+constexpr SettingKey<std::vector<std::string>> MASTER_SERVER_URI_SETTING{ "master_server_uri" };
+constexpr SettingKey<int32_t> MASTER_TIMEOUT_SETTING{ "master_timeout" };
+
+const uint16_t MINETEST_DEFAULT_PORT = 30000;
+
+void query(GameID, const SettingsView&, const QueryScope&, const QuerySink&, const CancellationToken&);
+Backend get_information();
 }
 }
 }
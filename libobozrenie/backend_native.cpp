@@ -0,0 +1,811 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "backend_native.hpp"
+
+#include "color_codes.hpp"
+#include "endpoint.hpp"
+#include "master_client.hpp"
+#include "rule_classifier.hpp"
+#include "udp_reactor.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+namespace Obozrenie
+{
+namespace Backends
+{
+namespace Native
+{
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+const int DEFAULT_TIMEOUT_MS = 1000;
+const int DEFAULT_RETRIES = 2;
+const int DEFAULT_WINDOW = 256;
+const int DEFAULT_MASTER_CACHE_TTL = 300;
+const char* const DEFAULT_Q3_MASTER_FILTER = "68 empty full";
+const size_t BATCH_SIZE = 256;
+const auto PUSH_INTERVAL = std::chrono::milliseconds(250);
+const auto IDLE_WAIT = std::chrono::milliseconds(50);
+const int MAX_CHALLENGES = 3;
+const size_t MAX_SPLIT_PACKETS = 32;
+
+const std::string HEADER("\xFF\xFF\xFF\xFF", 4);
+const std::string SPLIT_HEADER("\xFE\xFF\xFF\xFF", 4);
+const std::string Q3_GETSTATUS = HEADER + "getstatus\n";
+const std::string Q3_STATUS_RESPONSE = "statusResponse\n";
+
+enum class Protocol
+{
+  Q3,
+  A2S
+};
+
+// Requests outstanding for a server. Quake 3 only uses INFO, answered by statusResponse.
+enum Request : unsigned
+{
+  INFO = 1,
+  PLAYERS = 2,
+  RULES = 4
+};
+
+// Little-endian reader over one datagram.
+class Reader
+{
+private:
+  const uint8_t* p;
+  const uint8_t* end;
+
+  void need(size_t n) const
+  {
+    if (size_t(this->end - this->p) < n)
+    {
+      throw DataParseError("truncated datagram");
+    }
+  }
+
+public:
+  bool done() const { return this->p == this->end; }
+  const uint8_t* data() const { return this->p; }
+  size_t remaining() const { return size_t(this->end - this->p); }
+
+  uint8_t u8()
+  {
+    this->need(1);
+    return *this->p++;
+  }
+
+  int16_t i16()
+  {
+    this->need(2);
+    auto v = uint16_t(this->p[0] | (this->p[1] << 8));
+    this->p += 2;
+    return int16_t(v);
+  }
+
+  int32_t i32()
+  {
+    this->need(4);
+    auto v = uint32_t(this->p[0]) | (uint32_t(this->p[1]) << 8) | (uint32_t(this->p[2]) << 16) | (uint32_t(this->p[3]) << 24);
+    this->p += 4;
+    return int32_t(v);
+  }
+
+  int64_t i64()
+  {
+    auto lo = uint32_t(this->i32());
+    auto hi = uint32_t(this->i32());
+    return int64_t((uint64_t(hi) << 32) | lo);
+  }
+
+  float f32()
+  {
+    auto bits = uint32_t(this->i32());
+    float v;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+  }
+
+  std::string str()
+  {
+    auto nul = static_cast<const uint8_t*>(std::memchr(this->p, 0, this->remaining()));
+    if (!nul)
+    {
+      throw DataParseError("unterminated string");
+    }
+    std::string v(reinterpret_cast<const char*>(this->p), nul - this->p);
+    this->p = nul + 1;
+    return v;
+  }
+
+  Reader(const uint8_t* data, size_t len) : p(data), end(data + len) {}
+};
+
+void
+append_i32(std::string& v, int32_t n)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    v.push_back(char((uint32_t(n) >> (8 * i)) & 0xFF));
+  }
+}
+
+std::string
+a2s_request(Request r, int32_t challenge)
+{
+  auto v = HEADER;
+  switch (r)
+  {
+  case INFO:
+    v += "TSource Engine Query";
+    v.push_back('\0');
+    // Servers that want a challenge for A2S_INFO reply with one; until then the request carries none.
+    if (challenge != -1)
+    {
+      append_i32(v, challenge);
+    }
+    return v;
+  case PLAYERS:
+    v.push_back('U');
+    break;
+  case RULES:
+    v.push_back('V');
+    break;
+  }
+  append_i32(v, challenge);
+  return v;
+}
+
+int
+to_int(const std::string& v)
+{
+  return int(std::strtol(v.c_str(), nullptr, 10));
+}
+
+struct Probe
+{
+  Endpoint endpoint;
+  Server server;
+  Clock::time_point sent;
+  Clock::time_point deadline;
+  int attempts = 0;
+  bool answered = false;
+  bool done = false;
+  unsigned pending = 0;
+  int32_t challenge = -1;
+  int challenges = 0;
+  std::map<int32_t, std::vector<std::string>> split;
+};
+
+// One refresh: a window of servers is queried at a time over a shared reactor,
+// and finished servers are pushed to the sink in batches.
+class Session
+{
+private:
+  Protocol protocol;
+  std::chrono::milliseconds timeout;
+  int retries;
+  size_t window;
+  const QuerySink& sink;
+  const RuleClassifier& classifier;
+  const CancellationToken& token;
+
+  CancellationFd cancelled;
+  UdpReactor reactor;
+  std::vector<Probe> probes;
+  std::unordered_map<Endpoint, size_t> by_endpoint;
+  std::vector<size_t> in_flight;
+  size_t next = 0;
+
+  ServerData batch;
+  size_t received = 0;
+  Clock::time_point last_push;
+
+  bool send_requests(Probe&, bool = true);
+  void on_datagram(const Endpoint&, const uint8_t*, size_t);
+  void on_payload(Probe&, const uint8_t*, size_t);
+  void on_split(Probe&, const uint8_t*, size_t);
+  void finish(Probe&, bool);
+  void expire(Clock::time_point);
+  void flush(bool);
+
+public:
+  void run();
+
+  Session(Protocol, std::chrono::milliseconds, int, size_t, std::vector<Endpoint>, const QuerySink&, const RuleClassifier&, const CancellationToken&);
+};
+
+Session::Session(Protocol p, std::chrono::milliseconds t, int r, size_t w, std::vector<Endpoint> endpoints, const QuerySink& s, const RuleClassifier& c,
+                 const CancellationToken& k)
+  : protocol(p), timeout(t), retries(r), window(w), sink(s), classifier(c), token(k), cancelled(k)
+{
+  this->reactor.set_wakeup(this->cancelled.get());
+  for (const auto& e : endpoints)
+  {
+    if (this->by_endpoint.emplace(e, this->probes.size()).second)
+    {
+      Probe probe;
+      probe.endpoint = e;
+      probe.pending = p == Protocol::Q3 ? INFO : (INFO | PLAYERS | RULES);
+      this->probes.push_back(std::move(probe));
+    }
+  }
+}
+
+bool
+Session::send_requests(Probe& probe, bool new_attempt)
+{
+  bool sent = false;
+  try
+  {
+    for (auto r : { INFO, PLAYERS, RULES })
+    {
+      if (!(probe.pending & r))
+      {
+        continue;
+      }
+      const auto& data = this->protocol == Protocol::Q3 ? Q3_GETSTATUS : a2s_request(r, probe.challenge);
+      if (!this->reactor.send(probe.endpoint, data))
+      {
+        break;
+      }
+      sent = true;
+    }
+  }
+  catch (const SocketError&)
+  {
+    // No socket for this address family: the server is unreachable from here.
+    this->finish(probe, false);
+    return true;
+  }
+  if (!sent)
+  {
+    return false;
+  }
+
+  if (new_attempt)
+  {
+    probe.attempts++;
+  }
+  probe.sent = Clock::now();
+  probe.deadline = probe.sent + this->timeout;
+  return true;
+}
+
+void
+Session::on_datagram(const Endpoint& from, const uint8_t* data, size_t len)
+{
+  auto it = this->by_endpoint.find(from);
+  if (it == this->by_endpoint.end())
+  {
+    return;
+  }
+  auto& probe = this->probes[it->second];
+  if (probe.done || len < 4)
+  {
+    return;
+  }
+
+  if (!probe.answered)
+  {
+    probe.answered = true;
+    probe.server.ping = int(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - probe.sent).count());
+  }
+
+  try
+  {
+    if (std::memcmp(data, HEADER.data(), 4) == 0)
+    {
+      this->on_payload(probe, data + 4, len - 4);
+    }
+    else if (this->protocol == Protocol::A2S && std::memcmp(data, SPLIT_HEADER.data(), 4) == 0)
+    {
+      this->on_split(probe, data + 4, len - 4);
+    }
+  }
+  catch (const DataParseError&)
+  {
+    // A malformed reply counts as no reply; the request is retried or given up on its timer.
+  }
+
+  if (probe.pending == 0)
+  {
+    this->finish(probe, true);
+  }
+}
+
+void
+Session::on_payload(Probe& probe, const uint8_t* data, size_t len)
+{
+  if (len == 0)
+  {
+    return;
+  }
+
+  if (this->protocol == Protocol::Q3)
+  {
+    parse_q3_status(data, len, probe.server);
+    probe.pending = 0;
+    return;
+  }
+
+  switch (data[0])
+  {
+  case 'A':
+    if (len >= 5 && probe.challenges < MAX_CHALLENGES)
+    {
+      Reader r(data + 1, len - 1);
+      probe.challenge = r.i32();
+      probe.challenges++;
+      this->send_requests(probe, false);
+    }
+    break;
+  case 'I':
+    parse_a2s_info(data, len, probe.server);
+    probe.pending &= ~INFO;
+    break;
+  case 'D':
+    parse_a2s_players(data, len, probe.server);
+    probe.pending &= ~PLAYERS;
+    break;
+  case 'E':
+    parse_a2s_rules(data, len, probe.server);
+    probe.pending &= ~RULES;
+    break;
+  default:
+    break;
+  }
+}
+
+void
+Session::on_split(Probe& probe, const uint8_t* data, size_t len)
+{
+  // Source engine split packet: id, total, number and a size field that precedes the fragment.
+  // Compressed (bzip2) payloads are not supported and simply time out.
+  Reader r(data, len);
+  auto id = r.i32();
+  auto total = size_t(r.u8());
+  auto number = size_t(r.u8());
+  r.i16();
+  if ((uint32_t(id) & 0x80000000u) || total == 0 || total > MAX_SPLIT_PACKETS || number >= total)
+  {
+    return;
+  }
+
+  auto& parts = probe.split[id];
+  parts.resize(total);
+  parts[number].assign(reinterpret_cast<const char*>(r.data()), r.remaining());
+
+  for (const auto& part : parts)
+  {
+    if (part.empty())
+    {
+      return;
+    }
+  }
+
+  std::string whole;
+  for (const auto& part : parts)
+  {
+    whole += part;
+  }
+  probe.split.erase(id);
+
+  if (whole.size() >= 4 && whole.compare(0, 4, HEADER) == 0)
+  {
+    this->on_payload(probe, reinterpret_cast<const uint8_t*>(whole.data()) + 4, whole.size() - 4);
+  }
+}
+
+void
+Session::finish(Probe& probe, bool ok)
+{
+  probe.done = true;
+  probe.split.clear();
+  if (ok)
+  {
+    this->classifier.apply(probe.server);
+    this->batch[probe.endpoint.str()] = std::move(probe.server);
+    this->received++;
+  }
+}
+
+void
+Session::expire(Clock::time_point now)
+{
+  for (auto i : this->in_flight)
+  {
+    auto& probe = this->probes[i];
+    if (probe.done || now < probe.deadline)
+    {
+      continue;
+    }
+    if (probe.attempts <= this->retries)
+    {
+      // A full socket buffer leaves the deadline in the past, so the resend is tried again on the next pass.
+      this->send_requests(probe);
+    }
+    else
+    {
+      // Missing players or rules are tolerated; a server that never described itself is not.
+      this->finish(probe, probe.answered && !(probe.pending & INFO));
+    }
+  }
+}
+
+void
+Session::flush(bool force)
+{
+  auto now = Clock::now();
+  if (this->batch.size() < BATCH_SIZE && !(force || (!this->batch.empty() && now - this->last_push >= PUSH_INTERVAL)))
+  {
+    return;
+  }
+
+  if (!this->batch.empty())
+  {
+    this->sink.push(std::move(this->batch));
+    this->batch.clear();
+  }
+  this->last_push = now;
+  if (this->sink.progress)
+  {
+    this->sink.progress(this->received, this->probes.size());
+  }
+}
+
+void
+Session::run()
+{
+  this->last_push = Clock::now();
+  if (this->sink.progress)
+  {
+    this->sink.progress(0, this->probes.size());
+  }
+
+  auto receive = [this](const Endpoint& from, const uint8_t* data, size_t len) { this->on_datagram(from, data, len); };
+  while (this->next < this->probes.size() || !this->in_flight.empty())
+  {
+    // Throwing drops the probes and the unpublished batch with the session.
+    this->token.throw_if_cancelled();
+    while (this->in_flight.size() < this->window && this->next < this->probes.size())
+    {
+      if (!this->send_requests(this->probes[this->next]))
+      {
+        break;
+      }
+      this->in_flight.push_back(this->next++);
+    }
+
+    auto wake = std::min(Clock::now() + IDLE_WAIT, this->token.deadline());
+    for (auto i : this->in_flight)
+    {
+      wake = std::min(wake, this->probes[i].deadline);
+    }
+    this->reactor.poll(wake, receive);
+
+    this->expire(Clock::now());
+    this->in_flight.erase(std::remove_if(this->in_flight.begin(), this->in_flight.end(), [this](size_t i) { return this->probes[i].done; }),
+                          this->in_flight.end());
+    this->flush(false);
+  }
+  this->flush(true);
+}
+}
+
+void
+parse_q3_status(const uint8_t* data, size_t len, Server& server)
+{
+  std::string v(reinterpret_cast<const char*>(data), len);
+  if (v.compare(0, Q3_STATUS_RESPONSE.size(), Q3_STATUS_RESPONSE) != 0)
+  {
+    throw DataParseError("not a statusResponse");
+  }
+
+  auto line_end = v.find('\n', Q3_STATUS_RESPONSE.size());
+  auto info = v.substr(Q3_STATUS_RESPONSE.size(), line_end == std::string::npos ? std::string::npos : line_end - Q3_STATUS_RESPONSE.size());
+
+  // The info string is "\key\value\key\value...".
+  size_t pos = 0;
+  while (pos < info.size() && info[pos] == '\\')
+  {
+    auto key_end = info.find('\\', pos + 1);
+    if (key_end == std::string::npos)
+    {
+      break;
+    }
+    auto value_end = info.find('\\', key_end + 1);
+    auto key = info.substr(pos + 1, key_end - pos - 1);
+    auto value = info.substr(key_end + 1, value_end == std::string::npos ? std::string::npos : value_end - key_end - 1);
+    server.rules[Atom(key)] = value;
+
+    if (key == "sv_hostname" || key == "hostname")
+    {
+      server.name = strip_color_codes(value.data(), value.size());
+    }
+    else if (key == "mapname")
+    {
+      server.terrain = Atom(value);
+    }
+    else if (key == "g_gametype")
+    {
+      server.game_type = Atom(value);
+    }
+    else if (key == "sv_maxclients")
+    {
+      server.player_limit = to_int(value);
+    }
+    pos = value_end;
+  }
+
+  // Every remaining line describes a player: score ping "name".
+  int count = 0;
+  while (line_end != std::string::npos && line_end + 1 < v.size())
+  {
+    auto start = line_end + 1;
+    line_end = v.find('\n', start);
+    auto line = v.substr(start, line_end == std::string::npos ? std::string::npos : line_end - start);
+    if (line.empty())
+    {
+      continue;
+    }
+    count++;
+
+    auto first_space = line.find(' ');
+    auto second_space = first_space == std::string::npos ? std::string::npos : line.find(' ', first_space + 1);
+    auto open_quote = line.find('"');
+    auto close_quote = line.rfind('"');
+
+    Player p;
+    if (open_quote != std::string::npos && close_quote > open_quote)
+    {
+      p.name = strip_color_codes(line.data() + open_quote + 1, close_quote - open_quote - 1);
+    }
+    if (first_space != std::string::npos)
+    {
+      p.info["score"] = line.substr(0, first_space);
+      if (second_space != std::string::npos)
+      {
+        p.info["ping"] = line.substr(first_space + 1, second_space - first_space - 1);
+      }
+    }
+    if (!p.name.empty())
+    {
+      server.players.push_back(p);
+    }
+  }
+  server.player_count = count;
+}
+
+void
+parse_a2s_info(const uint8_t* data, size_t len, Server& server)
+{
+  Reader r(data, len);
+  if (r.u8() != 'I')
+  {
+    throw DataParseError("not an A2S_INFO reply");
+  }
+
+  r.u8(); // protocol version
+  server.name = Glib::ustring(r.str());
+  server.terrain = Atom(r.str());
+  server.game_mod = Atom(r.str());
+  server.game_type = Atom(r.str());
+  auto app_id = r.i16();
+  server.player_count = r.u8();
+  server.player_limit = r.u8();
+  r.u8(); // bots
+  r.u8(); // server type
+  r.u8(); // environment
+  server.need_pass = r.u8() != 0;
+  server.secure = r.u8() != 0;
+
+  // The Ship inserts its game mode, witness count and duration here.
+  if (app_id == 2400)
+  {
+    r.u8();
+    r.u8();
+    r.u8();
+  }
+
+  if (r.done())
+  {
+    return;
+  }
+  server.rules[Atom("version")] = r.str();
+
+  if (r.done())
+  {
+    return;
+  }
+  auto edf = r.u8();
+  if (edf & 0x80)
+  {
+    r.i16(); // game port
+  }
+  if (edf & 0x10)
+  {
+    r.i64(); // Steam ID
+  }
+  if (edf & 0x40)
+  {
+    r.i16(); // SourceTV port
+    r.str(); // SourceTV name
+  }
+  if (edf & 0x20)
+  {
+    server.rules[Atom("keywords")] = r.str();
+  }
+}
+
+void
+parse_a2s_players(const uint8_t* data, size_t len, Server& server)
+{
+  Reader r(data, len);
+  if (r.u8() != 'D')
+  {
+    throw DataParseError("not an A2S_PLAYER reply");
+  }
+
+  auto count = r.u8();
+  server.players.clear();
+  for (int i = 0; i < count && !r.done(); i++)
+  {
+    r.u8(); // index
+    Player p;
+    p.name = r.str();
+    p.info["score"] = std::to_string(r.i32());
+    p.info["time"] = std::to_string(int(r.f32()));
+
+    // Players still connecting have no name yet.
+    if (!p.name.empty())
+    {
+      server.players.push_back(p);
+    }
+  }
+}
+
+void
+parse_a2s_rules(const uint8_t* data, size_t len, Server& server)
+{
+  Reader r(data, len);
+  if (r.u8() != 'E')
+  {
+    throw DataParseError("not an A2S_RULES reply");
+  }
+
+  auto count = uint16_t(r.i16());
+  for (int i = 0; i < count && !r.done(); i++)
+  {
+    auto k = r.str();
+    server.rules[Atom(k)] = r.str();
+  }
+}
+
+void
+query(GameID id, const SettingsView& settings, const QueryScope& scope, const QuerySink& sink, const CancellationToken& token)
+{
+  const auto& protocol_name = settings.get(NATIVE_PROTOCOL_SETTING);
+  Protocol protocol;
+  uint16_t default_port;
+  if (protocol_name == "q3")
+  {
+    protocol = Protocol::Q3;
+    default_port = Q3_DEFAULT_PORT;
+  }
+  else if (protocol_name == "a2s")
+  {
+    protocol = Protocol::A2S;
+    default_port = A2S_DEFAULT_PORT;
+  }
+  else
+  {
+    throw BackendError("Unknown protocol : " + protocol_name);
+  }
+
+  auto timeout = settings.find(NATIVE_TIMEOUT_SETTING);
+  auto retries = settings.find(NATIVE_RETRIES_SETTING);
+  auto window = settings.find(NATIVE_WINDOW_SETTING);
+
+  std::vector<Endpoint> endpoints;
+  if (!scope.full)
+  {
+    // Known hosts are stored in numeric form, so no lookups are needed.
+    for (const auto& host : scope.hosts)
+    {
+      try
+      {
+        endpoints.push_back(Endpoint::parse(host, default_port));
+      }
+      catch (const InvalidEndpointError&)
+      {
+      }
+    }
+  }
+  else
+  {
+    auto server_list = settings.find(SERVER_LIST_SETTING);
+    auto masters = settings.find(MASTER_SERVER_URI_SETTING);
+    if (!server_list && !masters)
+    {
+      throw BackendError("Neither a server list nor master servers are configured");
+    }
+
+    // Duplicates between the static list and the masters are dropped by the session.
+    if (server_list)
+    {
+      for (const auto& host : *server_list)
+      {
+        token.throw_if_cancelled();
+        try
+        {
+          auto resolved = Endpoint::resolve(host, default_port);
+          endpoints.insert(endpoints.end(), resolved.begin(), resolved.end());
+        }
+        catch (const InvalidEndpointError&)
+        {
+        }
+      }
+    }
+    if (masters)
+    {
+      auto filter = settings.find(NATIVE_MASTER_FILTER_SETTING);
+      auto ttl = settings.find(MASTER_CACHE_TTL_SETTING);
+
+      std::vector<MasterQuery> queries;
+      for (const auto& address : *masters)
+      {
+        if (protocol == Protocol::Q3)
+        {
+          queries.push_back(MasterQuery{ MasterProtocol::Q3, address, filter ? *filter : DEFAULT_Q3_MASTER_FILTER });
+        }
+        else
+        {
+          queries.push_back(MasterQuery{ MasterProtocol::VALVE, address, filter ? *filter : std::string() });
+        }
+      }
+      auto listed = fetch_master_lists(queries, std::chrono::seconds(ttl ? *ttl : DEFAULT_MASTER_CACHE_TTL),
+                                       std::chrono::milliseconds(timeout ? *timeout : DEFAULT_TIMEOUT_MS), token);
+      endpoints.insert(endpoints.end(), listed.begin(), listed.end());
+    }
+  }
+
+  auto rule_classes = settings.find(RULE_CLASSES_SETTING);
+  RuleClassifier classifier(rule_classes ? *rule_classes : std::vector<std::string>());
+
+  Session session(protocol, std::chrono::milliseconds(timeout ? *timeout : DEFAULT_TIMEOUT_MS), retries ? *retries : DEFAULT_RETRIES,
+                  size_t(std::max(1, window ? *window : DEFAULT_WINDOW)), endpoints, sink, classifier, token);
+  session.run();
+}
+
+Backend
+get_information()
+{
+  return Backend{.name = NATIVE_COMPONENT_STRING, .description = "Native UDP query backend", .version = "1.0", .f = query, .concurrency = 4 };
+}
+}
+}
+}
@@ -0,0 +1,62 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _BACKEND_NATIVE_HPP_
+#define _BACKEND_NATIVE_HPP_
+
+#include "common_models.hpp"
+#include "exceptions.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Obozrenie
+{
+namespace Backends
+{
+namespace Native
+{
+const char* const NATIVE_COMPONENT_STRING = "Native";
+
+// "q3" for the Quake 3 getstatus protocol, "a2s" for Source engine queries.
+constexpr SettingKey<std::string> NATIVE_PROTOCOL_SETTING{ "native_protocol" };
+constexpr SettingKey<std::vector<std::string>> SERVER_LIST_SETTING{ "server_list" };
+constexpr SettingKey<std::vector<std::string>> MASTER_SERVER_URI_SETTING{ "master_server_uri" };
+// Arguments of getservers for Quake 3 masters, the filter string for Valve masters.
+constexpr SettingKey<std::string> NATIVE_MASTER_FILTER_SETTING{ "native_master_filter" };
+constexpr SettingKey<int32_t> MASTER_CACHE_TTL_SETTING{ "master_cache_ttl" };
+constexpr SettingKey<int32_t> NATIVE_TIMEOUT_SETTING{ "native_timeout" };
+constexpr SettingKey<int32_t> NATIVE_RETRIES_SETTING{ "native_retries" };
+constexpr SettingKey<int32_t> NATIVE_WINDOW_SETTING{ "native_window" };
+
+const uint16_t Q3_DEFAULT_PORT = 27960;
+const uint16_t A2S_DEFAULT_PORT = 27015;
+
+// Decoders for single reply payloads, following the 0xFFFFFFFF header. They throw DataParseError on truncated data.
+void parse_q3_status(const uint8_t*, size_t, Server&);
+void parse_a2s_info(const uint8_t*, size_t, Server&);
+void parse_a2s_players(const uint8_t*, size_t, Server&);
+void parse_a2s_rules(const uint8_t*, size_t, Server&);
+
+void query(GameID, const SettingsView&, const QueryScope&, const QuerySink&, const CancellationToken&);
+Backend get_information();
+}
+}
+}
+#endif
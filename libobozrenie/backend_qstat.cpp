@@ -18,19 +18,33 @@
 
 #include "backend_qstat.hpp"
 
+#include "color_codes.hpp"
 #include "common_models.hpp"
 #include "exceptions.hpp"
-#include "util.hpp"
-#include "xmlpp_util.hpp"
-
-#include <experimental/filesystem>
+#include "process.hpp"
+#include "rule_classifier.hpp"
+#include "task_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <map>
-#include <set>
+#include <memory>
+#include <mutex>
 #include <utility>
 #include <vector>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <boost/algorithm/string/join.hpp>
 #include <glibmm.h>
+#include <libxml/parser.h>
 
 namespace Obozrenie
 {
@@ -38,10 +52,6 @@ namespace Backends
 {
 namespace QStat
 {
-const auto COLOR_CODE_PATTERN = "[\\^](.)";
-
-namespace filesystem = std::experimental::filesystem;
-
 std::vector<std::string>
 make_qstat_cmd(Glib::ustring master_type, std::map<std::string, std::string> rules, std::vector<std::string> master_server_uri)
 {
@@ -70,134 +80,720 @@ make_qstat_cmd(Glib::ustring master_type, std::map<std::string, std::string> rul
   return cmd;
 }
 
-Player parse_player_entry(const xmlpp::Node& data_node) {
-    Player e;
+// Queries the hosts listed in the file directly, skipping the master.
+std::vector<std::string>
+make_qstat_hosts_cmd(Glib::ustring server_type, const std::string& host_file)
+{
+  std::vector<std::string> cmd;
+  cmd.push_back("-xml");
+  cmd.push_back("-utf8");
+  cmd.push_back("-maxsim");
+  cmd.push_back("9999");
+  cmd.push_back("-R");
+  cmd.push_back("-P");
+  cmd.push_back("-default");
+  cmd.push_back(Glib::ustring(server_type).lowercase());
+  cmd.push_back("-f");
+  cmd.push_back(host_file);
+
+  return cmd;
+}
+
+namespace
+{
+// Temporary file listing one host per line, for qstat -f. Thousands of hosts on the command line would overflow ARG_MAX.
+// The file is removed on destruction.
+class HostFile
+{
+private:
+  std::string file_path;
+
+public:
+  const std::string& path() const { return this->file_path; }
+
+  explicit HostFile(const std::vector<std::string>& hosts)
+  {
+    this->file_path = Glib::build_filename(Glib::get_tmp_dir(), "obozrenie-qstat-XXXXXX");
+    int fd = mkostemp(&this->file_path[0], O_CLOEXEC);
+    if (fd < 0)
+    {
+      throw FopenError(std::string("mkostemp: ") + std::strerror(errno));
+    }
+
+    std::string contents;
+    for (const auto& host : hosts)
+    {
+      contents += host + "\n";
+    }
+    for (size_t pos = 0; pos < contents.size();)
+    {
+      auto n = write(fd, contents.data() + pos, contents.size() - pos);
+      if (n < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (n < 0)
+      {
+        auto error = errno;
+        close(fd);
+        unlink(this->file_path.c_str());
+        throw FopenError(this->file_path + " : " + std::strerror(error));
+      }
+      pos += size_t(n);
+    }
+    close(fd);
+  }
+
+  ~HostFile() { unlink(this->file_path.c_str()); }
+
+  HostFile(const HostFile&) = delete;
+  HostFile& operator=(const HostFile&) = delete;
+};
 
-    xmlpp::util::CallbackMap cb_data;
-    cb_data["name"] = [&e](const auto& v) { e.name = xmlpp::util::get_string(v); };
-    cb_data["score"] = [&e](const auto& v) { e.info["score"] = xmlpp::util::get_string(v); };
-    cb_data["ping"] = [&e](const auto& v) { e.info["ping"] = xmlpp::util::get_string(v); };
-    xmlpp::util::map_node(data_node, cb_data);
+// Input is handed to libxml2 in slices of this size, with a cancellation check before each.
+const size_t FEED_SLICE_SIZE = 64 * 1024;
 
-    return e;
+const xmlChar*
+to_xml(const char* v)
+{
+  return reinterpret_cast<const xmlChar*>(v);
 }
 
-std::pair<Glib::ustring, Server>
-parse_server_entry(const xmlpp::Node& m, std::string server_type)
+bool
+is_name(const xmlChar* name, const char* v)
 {
-  auto parsed_type = xmlpp::util::get_string(m, "@type");
-  if (parsed_type != server_type)
+  return xmlStrEqual(name, to_xml(v));
+}
+
+bool
+parse_int(const std::string& v, int& out)
+{
+  char* end = nullptr;
+  auto n = std::strtol(v.c_str(), &end, 10);
+  if (end == v.c_str())
   {
-    throw InvalidServerType(parsed_type);
+    return false;
   }
+  out = int(n);
+  return true;
+}
+
+// Single pass SAX parser for qstat -xml output, fed while qstat is still writing it.
+// <qstat> holds <server> entries; master entries come first and carry the number of servers they listed.
+// Servers of a different type than requested, including the master entries themselves, are skipped.
+class XmlStreamParser
+{
+private:
+  enum Depth
+  {
+    ROOT = 1,
+    SERVER = 2,
+    FIELD = 3,
+    ITEM = 4,
+    ITEM_FIELD = 5
+  };
+
+  std::string server_type;
+  const QuerySink& sink;
+  const RuleClassifier& classifier;
+  CancellationToken token;
+  xmlParserCtxtPtr ctxt;
+  std::exception_ptr error;
+
+  int depth = 0;
+  bool saw_root = false;
+  bool in_server = false;
+  bool in_rules = false;
+  bool in_players = false;
+  bool collecting = false;
+  std::string text;
+  std::string rule_name;
 
   Glib::ustring host;
   Server data;
+  Player player;
+
+  ServerData batch;
+  size_t received = 0;
+  size_t expected = 0;
 
-  xmlpp::util::CallbackMap cb_data;
-  cb_data["hostname"] = [&host](const auto& v) { host = xmlpp::util::get_string(v); };
-  cb_data["name"] = [&data](const auto& v) { data.name = Glib::Regex::create(COLOR_CODE_PATTERN)->replace(xmlpp::util::get_string(v), 0, Glib::ustring(), static_cast<Glib::RegexMatchFlags>(0)); };
-  cb_data["gametype"] = [&data](const auto& v) { data.game_type = xmlpp::util::get_string(v); };
-  cb_data["map"] = [&data](const auto& v) { data.terrain = xmlpp::util::get_string(v); };
-  cb_data["numplayers"] = [&data](const auto& v) { data.player_count = xmlpp::util::get_number<int>(v); };
-  cb_data["maxplayers"] = [&data](const auto& v) { data.player_limit = xmlpp::util::get_number<int>(v); };
-  cb_data["numspectators"] = [&data](const auto& v) { data.spectator_count = xmlpp::util::get_number<int>(v); };
-  cb_data["maxspectators"] = [&data](const auto& v) { data.spectator_limit = xmlpp::util::get_number<int>(v); };
-  cb_data["ping"] = [&data](const auto& v) { data.ping = xmlpp::util::get_number<int>(v); };
-  cb_data["rules"] = [&data](const auto& v) {
-    for (auto rule_node : v.find(".//rule"))
+  void flush()
+  {
+    this->received += this->batch.size();
+    this->sink.push(std::move(this->batch));
+    this->batch.clear();
+    if (this->sink.progress)
     {
-      auto k = xmlpp::util::get_string(*rule_node, "@name");
-      auto v = xmlpp::util::get_string(*rule_node);
+      this->sink.progress(this->received, this->expected);
+    }
+  }
+
+  void collect()
+  {
+    this->text.clear();
+    this->collecting = true;
+  }
 
-      data.rules[k] = v;
+  void start_server(int nb_attributes, const xmlChar** attributes)
+  {
+    std::string type;
+    for (int i = 0; i < nb_attributes; i++)
+    {
+      auto name = attributes[i * 5];
+      std::string value(reinterpret_cast<const char*>(attributes[i * 5 + 3]), attributes[i * 5 + 4] - attributes[i * 5 + 3]);
+      if (is_name(name, "type"))
+      {
+        type = value;
+      }
+      else if (is_name(name, "servers"))
+      {
+        this->expected += std::strtoul(value.c_str(), nullptr, 10);
+      }
     }
-  };
-  cb_data["players"] = [&data](const auto& v) {
-    for (auto player_node : v.find(".//player")) {
-      auto e = parse_player_entry(*player_node);
 
-      if (!e.name.empty())
+    this->in_server = type == this->server_type;
+    this->host.clear();
+    this->data = Server();
+  }
+
+  void end_server()
+  {
+    auto valid = this->in_server && !this->host.empty();
+    this->in_server = false;
+    if (!valid)
+    {
+      return;
+    }
+
+    this->classifier.apply(this->data);
+    this->batch.emplace(std::move(this->host), std::move(this->data));
+    if (this->batch.size() == QSTAT_BATCH_SIZE)
+    {
+      this->flush();
+    }
+  }
+
+  void end_field(const xmlChar* name)
+  {
+    int n;
+    if (is_name(name, "hostname"))
+    {
+      this->host = this->text;
+    }
+    else if (is_name(name, "name"))
+    {
+      strip_color_codes(this->text);
+      this->data.name = this->text;
+    }
+    else if (is_name(name, "gametype"))
+    {
+      this->data.game_type = Atom(this->text);
+    }
+    else if (is_name(name, "map"))
+    {
+      this->data.terrain = Atom(this->text);
+    }
+    else if (is_name(name, "numplayers") && parse_int(this->text, n))
+    {
+      this->data.player_count = n;
+    }
+    else if (is_name(name, "maxplayers") && parse_int(this->text, n))
+    {
+      this->data.player_limit = n;
+    }
+    else if (is_name(name, "numspectators") && parse_int(this->text, n))
+    {
+      this->data.spectator_count = n;
+    }
+    else if (is_name(name, "maxspectators") && parse_int(this->text, n))
+    {
+      this->data.spectator_limit = n;
+    }
+    else if (is_name(name, "ping") && parse_int(this->text, n))
+    {
+      this->data.ping = n;
+    }
+  }
+
+  void on_start(const xmlChar* name, int nb_attributes, const xmlChar** attributes)
+  {
+    this->depth++;
+    this->collecting = false;
+    switch (this->depth)
+    {
+    case ROOT:
+      this->saw_root = is_name(name, "qstat");
+      break;
+    case SERVER:
+      if (is_name(name, "server"))
+      {
+        this->start_server(nb_attributes, attributes);
+      }
+      break;
+    case FIELD:
+      this->in_rules = is_name(name, "rules");
+      this->in_players = is_name(name, "players");
+      if (this->in_server && !this->in_rules && !this->in_players)
+      {
+        this->collect();
+      }
+      break;
+    case ITEM:
+      if (this->in_server && this->in_rules && is_name(name, "rule"))
       {
-        data.players.push_back(e);
+        this->rule_name.clear();
+        for (int i = 0; i < nb_attributes; i++)
+        {
+          if (is_name(attributes[i * 5], "name"))
+          {
+            this->rule_name.assign(reinterpret_cast<const char*>(attributes[i * 5 + 3]), attributes[i * 5 + 4] - attributes[i * 5 + 3]);
+          }
+        }
+        this->collect();
       }
+      else if (this->in_server && this->in_players && is_name(name, "player"))
+      {
+        this->player = Player();
+      }
+      break;
+    case ITEM_FIELD:
+      if (this->in_server && this->in_players)
+      {
+        this->collect();
+      }
+      break;
     }
-  };
-  xmlpp::util::map_node(m, cb_data);
+  }
 
-  for (auto kv : data.rules)
+  void on_end(const xmlChar* name)
   {
-    if (std::set<Glib::ustring>{ "punkbuster", "sv_punkbuster", "secure" }.count(kv.first))
+    if (this->in_server)
     {
-      data.secure = (kv.second == "0" ? false : true);
+      switch (this->depth)
+      {
+      case SERVER:
+        this->end_server();
+        break;
+      case FIELD:
+        if (this->collecting)
+        {
+          this->end_field(name);
+        }
+        this->in_rules = false;
+        this->in_players = false;
+        break;
+      case ITEM:
+        if (this->in_rules && this->collecting)
+        {
+          this->data.rules[Atom(this->rule_name)] = this->text;
+        }
+        else if (this->in_players && !this->player.name.empty())
+        {
+          this->data.players.push_back(std::move(this->player));
+        }
+        break;
+      case ITEM_FIELD:
+        if (this->collecting)
+        {
+          if (is_name(name, "name"))
+          {
+            strip_color_codes(this->text);
+            this->player.name = this->text;
+          }
+          else if (is_name(name, "score") || is_name(name, "ping"))
+          {
+            this->player.info[reinterpret_cast<const char*>(name)] = this->text;
+          }
+        }
+        break;
+      }
     }
-    if (std::set<Glib::ustring>{ "g_needpass", "needpass", "si_usepass", "pswrd", "password" }.count(kv.first))
+    this->collecting = false;
+    this->depth--;
+  }
+
+  // Exceptions must not unwind through libxml2, so they are parked here and rethrown once the parser returns.
+  template <typename F>
+  static void guarded(void* ctx, F f)
+  {
+    auto self = static_cast<XmlStreamParser*>(ctx);
+    if (self->error)
+    {
+      return;
+    }
+    try
+    {
+      f(*self);
+    }
+    catch (...)
     {
-      data.need_pass = (kv.second == "0" ? false : true);
+      self->error = std::current_exception();
+      xmlStopParser(self->ctxt);
     }
   }
 
-  if (host.empty())
+  static void start_element(void* ctx, const xmlChar* localname, const xmlChar*, const xmlChar*, int, const xmlChar**, int nb_attributes, int,
+                            const xmlChar** attributes)
   {
-    throw DataParseError("Empty host.");
+    guarded(ctx, [=](XmlStreamParser& p) { p.on_start(localname, nb_attributes, attributes); });
   }
 
-  return std::make_pair(host, data);
+  static void end_element(void* ctx, const xmlChar* localname, const xmlChar*, const xmlChar*)
+  {
+    guarded(ctx, [=](XmlStreamParser& p) { p.on_end(localname); });
+  }
+
+  static void characters(void* ctx, const xmlChar* ch, int len)
+  {
+    auto self = static_cast<XmlStreamParser*>(ctx);
+    if (self->collecting)
+    {
+      self->text.append(reinterpret_cast<const char*>(ch), size_t(len));
+    }
+  }
+
+  void check(int rc)
+  {
+    if (this->error)
+    {
+      std::rethrow_exception(this->error);
+    }
+    // Recoverable errors such as stray bytes are skipped; only a document that never got going is rejected.
+    if (rc != 0 && !this->saw_root)
+    {
+      throw DataParseError("qstat output is not a qstat XML document");
+    }
+  }
+
+public:
+  void feed(const char* chunk, size_t len)
+  {
+    for (size_t offset = 0; offset < len; offset += FEED_SLICE_SIZE)
+    {
+      this->token.throw_if_cancelled();
+      this->check(xmlParseChunk(this->ctxt, chunk + offset, int(std::min(FEED_SLICE_SIZE, len - offset)), 0));
+    }
+  }
+
+  void finish()
+  {
+    this->check(xmlParseChunk(this->ctxt, nullptr, 0, 1));
+    if (!this->saw_root)
+    {
+      throw DataParseError("qstat output is not a qstat XML document");
+    }
+    this->flush();
+  }
+
+  XmlStreamParser(std::string type, const QuerySink& s, const RuleClassifier& c, const CancellationToken& k)
+    : server_type(type), sink(s), classifier(c), token(k), ctxt(nullptr)
+  {
+    xmlSAXHandler handler;
+    std::memset(&handler, 0, sizeof(handler));
+    handler.initialized = XML_SAX2_MAGIC;
+    handler.startElementNs = &XmlStreamParser::start_element;
+    handler.endElementNs = &XmlStreamParser::end_element;
+    handler.characters = &XmlStreamParser::characters;
+    handler.cdataBlock = &XmlStreamParser::characters;
+
+    this->ctxt = xmlCreatePushParserCtxt(&handler, this, nullptr, 0, nullptr);
+    if (!this->ctxt)
+    {
+      throw DataParseError("cannot create XML parser");
+    }
+    xmlCtxtUseOptions(this->ctxt, XML_PARSE_RECOVER | XML_PARSE_NONET | XML_PARSE_NOERROR | XML_PARSE_NOWARNING | XML_PARSE_HUGE);
+  }
+
+  ~XmlStreamParser()
+  {
+    xmlFreeParserCtxt(this->ctxt);
+  }
+
+  XmlStreamParser(const XmlStreamParser&) = delete;
+};
 }
 
-ServerData
-parse_xml(Glib::ustring xml_data, std::string server_type)
+namespace
 {
-  xmlpp::util::EasyDocument doc;
-  doc.parse(xml_data);
+// qstat output is cut into slices of about this size at <server> boundaries, and the slices are parsed concurrently.
+const size_t PARALLEL_SLICE_SIZE = 64 * 1024;
+
+// Position of the next <server> start tag at or after the offset, or the limit if there is none.
+// Markup cannot occur inside text, so every match is a real tag.
+size_t
+find_server_tag(const std::string& v, size_t from, size_t limit)
+{
+  for (auto pos = v.find("<server", from); pos < limit; pos = v.find("<server", pos + 1))
+  {
+    auto c = pos + 7 < v.size() ? v[pos + 7] : '\0';
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '>' || c == '/')
+    {
+      return pos;
+    }
+  }
+  return limit;
+}
+
+// One slice of a document, parsed by whichever thread claims it first: a pool worker, or the reader once it needs the result.
+// Since the reader runs unclaimed slices itself, it never waits on a pool whose workers are all busy.
+struct SliceJob
+{
+  std::string text;
+  std::atomic<bool> claimed{ false };
+  std::mutex m;
+  std::condition_variable finished;
+  bool done = false;
 
   ServerData data;
+  size_t expected = 0;
+  std::exception_ptr error;
+
+  bool claim() { return !this->claimed.exchange(true); }
 
-  xmlpp::util::CallbackMap cb_data;
-  cb_data["server"] = [&data, server_type](const auto& v) {
+  bool is_done()
+  {
+    std::lock_guard<std::mutex> lock(this->m);
+    return this->done;
+  }
+
+  void wait()
+  {
+    std::unique_lock<std::mutex> lock(this->m);
+    this->finished.wait(lock, [this]() { return this->done; });
+  }
+
+  void run(const std::string& server_type, const RuleClassifier& classifier, const CancellationToken& token)
+  {
     try
     {
-      data.emplace(parse_server_entry(v, server_type));
+      QuerySink sink;
+      sink.push = [this](ServerData batch) {
+        for (auto& kv : batch)
+        {
+          this->data[kv.first] = std::move(kv.second);
+        }
+      };
+      sink.progress = [this](size_t, size_t expected) { this->expected = expected; };
+
+      XmlStreamParser parser(server_type, sink, classifier, token);
+      parser.feed(this->text.data(), this->text.size());
+      parser.finish();
     }
     catch (...)
     {
+      this->error = std::current_exception();
     }
-  };
-  xmlpp::util::map_node(doc(), cb_data);
+    std::string().swap(this->text);
 
-  return data;
+    std::lock_guard<std::mutex> lock(this->m);
+    this->done = true;
+    this->finished.notify_all();
+  }
+};
+
+// Parses qstat output fed in pieces, like XmlStreamParser, but spreads the work over the default task pool.
+// The document head up to the first <server> tag is kept, and every slice is parsed as a document of its own wrapped in it.
+// Slices reach the sink in document order, so a host listed twice ends up with the same entry as with a single parser.
+class SlicedXmlParser
+{
+private:
+  std::string server_type;
+  const QuerySink& sink;
+  const RuleClassifier& classifier;
+  CancellationToken token;
+  size_t parallelism;
+
+  std::string head;
+  bool have_head = false;
+  std::string pending;
+  std::deque<std::shared_ptr<SliceJob>> jobs;
+  size_t received = 0;
+  size_t expected = 0;
+
+  void deliver_front()
+  {
+    auto job = std::move(this->jobs.front());
+    this->jobs.pop_front();
+    if (job->claim())
+    {
+      job->run(this->server_type, this->classifier, this->token);
+    }
+    else
+    {
+      job->wait();
+    }
+    if (job->error)
+    {
+      std::rethrow_exception(job->error);
+    }
+
+    this->received += job->data.size();
+    this->expected += job->expected;
+    this->sink.push(std::move(job->data));
+    if (this->sink.progress)
+    {
+      this->sink.progress(this->received, this->expected);
+    }
+  }
+
+  void submit(std::string text)
+  {
+    auto job = std::make_shared<SliceJob>();
+    job->text = std::move(text);
+    this->jobs.push_back(job);
+    if (this->parallelism < 2)
+    {
+      this->deliver_front();
+      return;
+    }
+
+    // The task only touches the parser once it has claimed the slice, which cannot happen after the destructor has run.
+    // It runs at the priority of the refresh feeding the parser.
+    default_task_pool()->post(
+        [this, job]() {
+          if (job->claim())
+          {
+            job->run(this->server_type, this->classifier, this->token);
+          }
+        },
+        current_task_priority());
+
+    // At most one slice per thread is in flight; the oldest is finished first, on this thread if no worker has taken it.
+    while (this->jobs.size() > this->parallelism || (!this->jobs.empty() && this->jobs.front()->is_done()))
+    {
+      this->deliver_front();
+    }
+  }
+
+public:
+  void feed(const char* chunk, size_t len)
+  {
+    this->token.throw_if_cancelled();
+    this->pending.append(chunk, len);
+    if (!this->have_head)
+    {
+      auto first = find_server_tag(this->pending, 0, this->pending.size());
+      if (first == this->pending.size())
+      {
+        return;
+      }
+      this->head = this->pending.substr(0, first);
+      this->pending.erase(0, first);
+      this->have_head = true;
+    }
+
+    size_t start = 0;
+    for (;;)
+    {
+      auto cut = find_server_tag(this->pending, start + PARALLEL_SLICE_SIZE, this->pending.size());
+      if (cut == this->pending.size())
+      {
+        break;
+      }
+      this->submit(this->head + this->pending.substr(start, cut - start) + "</qstat>");
+      start = cut;
+    }
+    this->pending.erase(0, start);
+  }
+
+  // The rest goes into the last slice as it is, so a truncated document is recovered the same way XmlStreamParser does it.
+  void finish()
+  {
+    this->submit(this->head + this->pending);
+    this->pending.clear();
+    while (!this->jobs.empty())
+    {
+      this->deliver_front();
+    }
+  }
+
+  SlicedXmlParser(std::string type, const QuerySink& s, const RuleClassifier& c, const CancellationToken& k, size_t n)
+    : server_type(type), sink(s), classifier(c), token(k), parallelism(n)
+  {
+  }
+
+  // Slices still queued are claimed so that no worker starts them; running ones use the parser and are waited for.
+  ~SlicedXmlParser()
+  {
+    for (auto& job : this->jobs)
+    {
+      if (!job->claim())
+      {
+        job->wait();
+      }
+    }
+  }
+
+  SlicedXmlParser(const SlicedXmlParser&) = delete;
+};
+}
+
+void
+parse_xml(Glib::ustring xml_data, std::string server_type, const QuerySink& sink, const CancellationToken& token, size_t parallelism)
+{
+  RuleClassifier classifier;
+  SlicedXmlParser parser(server_type, sink, classifier, token, parallelism);
+  parser.feed(xml_data.data(), xml_data.bytes());
+  parser.finish();
 }
 
 ServerData
-query(GameID id, ConfStorage settings)
+parse_xml(Glib::ustring xml_data, std::string server_type)
 {
-  auto qstat_path = get_setting_from_storage<std::string>(settings, "qstat_path");
-  auto master_type = get_setting_from_storage<std::string>(settings, "qstat_master_type");
-  auto server_type = get_setting_from_storage<std::string>(settings, "qstat_server_type");
-  auto master_server_uri = get_setting_from_storage<std::vector<std::string>>(settings, "master_server_uri");
+  ServerData data;
 
-  std::map<std::string, std::string> rules;
-  try
+  QuerySink sink;
+  sink.push = [&data](ServerData batch) { data.insert(batch.begin(), batch.end()); };
+  parse_xml(xml_data, server_type, sink);
+
+  return data;
+}
+
+void
+query(GameID id, const SettingsView& settings, const QueryScope& scope, const QuerySink& sink, const CancellationToken& token)
+{
+  const auto& qstat_path = settings.get(QSTAT_PATH_SETTING);
+  const auto& server_type = settings.get(QSTAT_SERVER_TYPE_SETTING);
+
+  std::vector<std::string> cmd;
+  std::unique_ptr<HostFile> host_file;
+  if (scope.full)
   {
-    auto gt = get_setting_from_storage<std::string>(settings, "qstat_game_type");
-    rules["gametype"] = gt;
+    const auto& master_type = settings.get(QSTAT_MASTER_TYPE_SETTING);
+    const auto& master_server_uri = settings.get(MASTER_SERVER_URI_SETTING);
+
+    std::map<std::string, std::string> rules;
+    if (auto gt = settings.find(QSTAT_GAME_TYPE_SETTING))
+    {
+      rules["gametype"] = *gt;
+    }
+
+    cmd = make_qstat_cmd(master_type, rules, master_server_uri);
   }
-  catch (...)
+  else
   {
+    if (scope.hosts.empty())
+    {
+      return;
+    }
+    host_file.reset(new HostFile(scope.hosts));
+    cmd = make_qstat_hosts_cmd(server_type, host_file->path());
   }
-
-  auto cmd = make_qstat_cmd(master_type, rules, master_server_uri);
   cmd.insert(std::begin(cmd), qstat_path);
 
-  auto data = Obozrenie::exec(cmd);
+  // Servers reach the sink while qstat is still probing the rest.
+  auto rule_classes = settings.find(RULE_CLASSES_SETTING);
+  RuleClassifier classifier(rule_classes ? *rule_classes : std::vector<std::string>());
 
-  return parse_xml(data, server_type);
+  SlicedXmlParser parser(server_type, sink, classifier, token, default_parallelism());
+  exec_stream(cmd, [&parser](const char* chunk, size_t len) { parser.feed(chunk, len); }, std::chrono::milliseconds(0), token);
+  parser.finish();
 }
 
 Backend
 get_information()
 {
-  return Backend{.name = QSTAT_COMPONENT_STRING, .description = "QStat backend", .version = "1.0", .f = query };
+  return Backend{.name = QSTAT_COMPONENT_STRING, .description = "QStat backend", .version = "1.0", .f = query, .concurrency = 2 };
 }
 }
 }
@@ -21,6 +21,7 @@
 
 #include "common_models.hpp"
 #include "exceptions.hpp"
+#include "parallel.hpp"
 
 #include <vector>
 #include <map>
@@ -35,9 +36,19 @@ namespace QStat
 {
 const char* const QSTAT_COMPONENT_STRING = "QStat";
 
+constexpr SettingKey<std::string> QSTAT_PATH_SETTING{ "qstat_path" };
+constexpr SettingKey<std::string> QSTAT_MASTER_TYPE_SETTING{ "qstat_master_type" };
+constexpr SettingKey<std::string> QSTAT_SERVER_TYPE_SETTING{ "qstat_server_type" };
+constexpr SettingKey<std::string> QSTAT_GAME_TYPE_SETTING{ "qstat_game_type" };
+constexpr SettingKey<std::vector<std::string>> MASTER_SERVER_URI_SETTING{ "master_server_uri" };
+
+const size_t QSTAT_BATCH_SIZE = 256;
+
 DEFINE_EXCEPTION(InvalidServerType, "invalid server type");
+// Parses qstat -xml output on up to the given number of threads.
+void parse_xml(Glib::ustring, std::string, const QuerySink&, const CancellationToken& = CancellationToken(), size_t = default_parallelism());
 ServerData parse_xml(Glib::ustring, std::string);
-ServerData query(GameID, ConfStorage);
+void query(GameID, const SettingsView&, const QueryScope&, const QuerySink&, const CancellationToken&);
 Backend get_information();
 }
 }
@@ -0,0 +1,95 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "cancellation.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace Obozrenie
+{
+void
+CancellationToken::cancel() const
+{
+  std::lock_guard<std::mutex> lock(this->state->m);
+  if (this->state->cancelled.exchange(true, std::memory_order_acq_rel))
+  {
+    return;
+  }
+  for (const auto& kv : this->state->callbacks)
+  {
+    kv.second();
+  }
+}
+
+CancellationToken
+CancellationToken::with_deadline(Clock::time_point d) const
+{
+  auto v = *this;
+  v.deadline_point = std::min(v.deadline_point, d);
+  return v;
+}
+
+CancellationCallback::CancellationCallback(const CancellationToken& token, std::function<void()> f) : state(token.state), id(0)
+{
+  std::lock_guard<std::mutex> lock(this->state->m);
+  if (this->state->cancelled.load(std::memory_order_acquire))
+  {
+    f();
+    return;
+  }
+  this->id = ++this->state->next_id;
+  this->state->callbacks[this->id] = std::move(f);
+}
+
+CancellationCallback::~CancellationCallback()
+{
+  if (this->id != 0)
+  {
+    std::lock_guard<std::mutex> lock(this->state->m);
+    this->state->callbacks.erase(this->id);
+  }
+}
+
+CancellationFd::CancellationFd(const CancellationToken& token) : fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+  if (this->fd < 0)
+  {
+    throw SocketError(std::string("eventfd: ") + std::strerror(errno));
+  }
+  auto fd = this->fd;
+  this->callback.reset(new CancellationCallback(token, [fd]() {
+    uint64_t one = 1;
+    auto rc = write(fd, &one, sizeof(one));
+    (void)rc;
+  }));
+}
+
+CancellationFd::~CancellationFd()
+{
+  this->callback.reset();
+  close(this->fd);
+}
+}
@@ -0,0 +1,115 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef _CANCELLATION_HPP_
+#define _CANCELLATION_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "exceptions.hpp"
+
+namespace Obozrenie
+{
+// Flag through which a caller asks long running work to stop, optionally with a deadline after which the work gives up on its own.
+// Copies share the flag; a deadline applies to the copy it was set on and to copies made from that one.
+// Work polls the token at convenient points and throws. Code blocked in a system call registers a CancellationCallback or waits on a
+// CancellationFd, and bounds its waits by the deadline.
+class CancellationToken
+{
+public:
+  typedef std::chrono::steady_clock Clock;
+
+private:
+  friend class CancellationCallback;
+
+  struct State
+  {
+    std::atomic<bool> cancelled{ false };
+    std::mutex m;
+    std::map<size_t, std::function<void()>> callbacks;
+    size_t next_id = 0;
+  };
+
+  std::shared_ptr<State> state;
+  Clock::time_point deadline_point = Clock::time_point::max();
+
+public:
+  void cancel() const;
+  bool is_cancelled() const { return this->state->cancelled.load(std::memory_order_acquire); }
+
+  Clock::time_point deadline() const { return this->deadline_point; }
+  bool expired() const { return this->deadline_point != Clock::time_point::max() && Clock::now() >= this->deadline_point; }
+
+  // Copy sharing the flag whose deadline is the earlier of this token's and the given one.
+  CancellationToken with_deadline(Clock::time_point) const;
+
+  // Throws CancelledError once cancelled and DeadlineExceededError once the deadline has passed.
+  void throw_if_cancelled() const
+  {
+    if (this->is_cancelled())
+    {
+      throw CancelledError();
+    }
+    if (this->expired())
+    {
+      throw DeadlineExceededError();
+    }
+  }
+
+  CancellationToken() : state(std::make_shared<State>()) {}
+};
+
+// Calls the function when the token is cancelled, or right away if it already is, for as long as this object lives.
+// The function runs on the cancelling thread under the token's lock, so it has to be brief and must not use the token.
+// Destruction waits for a call in progress, so the function may safely refer to whatever outlives this object.
+class CancellationCallback
+{
+private:
+  std::shared_ptr<CancellationToken::State> state;
+  size_t id;
+
+public:
+  CancellationCallback(const CancellationToken&, std::function<void()>);
+  CancellationCallback(const CancellationCallback&) = delete;
+  ~CancellationCallback();
+};
+
+// Descriptor that becomes readable once the token is cancelled, for waiting in poll or epoll next to the descriptors of the work itself.
+class CancellationFd
+{
+private:
+  int fd;
+  std::unique_ptr<CancellationCallback> callback;
+
+public:
+  int get() const { return this->fd; }
+
+  explicit CancellationFd(const CancellationToken&);
+  CancellationFd(const CancellationFd&) = delete;
+  ~CancellationFd();
+};
+}
+
+#endif
@@ -0,0 +1,88 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "color_codes.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Obozrenie
+{
+namespace
+{
+bool
+is_hex(char c)
+{
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+// Length of the code that starts with the caret at p. Codes swallow a whole UTF-8 character, never half of one.
+size_t
+code_length(const char* p, const char* end)
+{
+  if (p[1] == 'x' && end - p >= 5 && is_hex(p[2]) && is_hex(p[3]) && is_hex(p[4]))
+  {
+    return 5;
+  }
+
+  auto lead = static_cast<unsigned char>(p[1]);
+  size_t len = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+  return std::min<size_t>(1 + len, size_t(end - p));
+}
+}
+
+void
+strip_color_codes(std::string& v)
+{
+  auto begin = &v[0];
+  auto end = begin + v.size();
+  auto caret = static_cast<char*>(std::memchr(begin, '^', v.size()));
+  if (!caret)
+  {
+    return;
+  }
+
+  // Compact in place: copy the runs between codes down over the removed bytes.
+  auto out = caret;
+  auto p = caret;
+  while (p < end)
+  {
+    if (p + 1 == end)
+    {
+      *out++ = *p++;
+      break;
+    }
+    p += code_length(p, end);
+
+    auto next = static_cast<char*>(std::memchr(p, '^', size_t(end - p)));
+    auto run_end = next ? next : end;
+    std::memmove(out, p, size_t(run_end - p));
+    out += run_end - p;
+    p = run_end;
+  }
+  v.resize(size_t(out - begin));
+}
+
+std::string
+strip_color_codes(const char* data, size_t len)
+{
+  std::string v(data, len);
+  strip_color_codes(v);
+  return v;
+}
+}
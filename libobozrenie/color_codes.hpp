@@ -0,0 +1,32 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _COLOR_CODES_HPP_
+#define _COLOR_CODES_HPP_
+
+#include <string>
+
+namespace Obozrenie
+{
+// Removes Quake style colour codes from a name in one pass: a caret followed by any character, and the DarkPlaces "^xRGB" form with three hex digits.
+// A trailing caret is kept. Names without a caret are only scanned once, by memchr, and left untouched.
+void strip_color_codes(std::string&);
+std::string strip_color_codes(const char*, size_t);
+}
+
+#endif
@@ -24,7 +24,10 @@
 #include <glibmm.h>
 #include <json/json.h>
 
+#include "cancellation.hpp"
 #include "exceptions.hpp"
+#include "settings_view.hpp"
+#include "string_pool.hpp"
 
 namespace Obozrenie
 {
@@ -72,26 +75,65 @@ struct Player
   std::map<Glib::ustring, Glib::ustring> info;
 };
 
+// Low-cardinality strings (countries, mods, game types, versions, terrains and rule keys) are interned atoms.
 struct Server
 {
   std::experimental::optional<Glib::ustring> name;
-  std::experimental::optional<Glib::ustring> country;
-  std::experimental::optional<Glib::ustring> game_mod;
-  std::experimental::optional<Glib::ustring> game_type;
+  std::experimental::optional<Atom> country;
+  std::experimental::optional<Atom> game_mod;
+  std::experimental::optional<Atom> game_type;
+  std::experimental::optional<Atom> version;
   std::experimental::optional<bool> need_pass;
   std::experimental::optional<bool> secure;
   std::experimental::optional<int> player_count;
   std::experimental::optional<int> player_limit;
   std::experimental::optional<int> spectator_count;
   std::experimental::optional<int> spectator_limit;
-  std::experimental::optional<Glib::ustring> terrain;
+  std::experimental::optional<Atom> terrain;
   std::experimental::optional<int> ping;
-  std::map<Glib::ustring, Glib::ustring> rules;
+  std::map<Atom, Glib::ustring> rules;
   std::list<Player> players;
 };
 
+inline bool
+operator==(const Player& a, const Player& b)
+{
+  return a.name == b.name && a.info == b.info;
+}
+
+inline bool
+operator==(const Server& a, const Server& b)
+{
+  return a.name == b.name && a.country == b.country && a.game_mod == b.game_mod && a.game_type == b.game_type && a.version == b.version && a.need_pass == b.need_pass && a.secure == b.secure &&
+         a.player_count == b.player_count && a.player_limit == b.player_limit && a.spectator_count == b.spectator_count && a.spectator_limit == b.spectator_limit &&
+         a.terrain == b.terrain && a.ping == b.ping && a.rules == b.rules && a.players == b.players;
+}
+
+inline bool
+operator!=(const Server& a, const Server& b)
+{
+  return !(a == b);
+}
+
 typedef std::map<Glib::ustring, Server> ServerData;
-typedef std::function<ServerData(GameID, ConfStorage)> QueryFunc;
+
+// Receives the results of a query while it is still running. Calls come from the query's thread, one at a time.
+// The expected count is 0 as long as the backend does not know it.
+struct QuerySink
+{
+  std::function<void(ServerData)> push;
+  std::function<void(size_t, size_t)> progress;
+};
+
+// What a query covers. A full query starts from the master lists; otherwise only the listed hosts are asked again.
+struct QueryScope
+{
+  bool full;
+  std::vector<std::string> hosts;
+};
+// Backends check the token between units of work and wake their blocking waits on it, so that a cancelled or overdue query
+// stops within milliseconds. Batches already pushed may have been published; Core puts those servers back as they were.
+typedef std::function<void(GameID, const SettingsView&, const QueryScope&, const QuerySink&, const CancellationToken&)> QueryFunc;
 
 struct Backend
 {
@@ -99,12 +141,14 @@ struct Backend
   Glib::ustring description;
   Glib::ustring version;
   QueryFunc f;
+  // Queries of this backend Core runs at once; further refreshes wait in line. 0 means no limit.
+  size_t concurrency;
 };
 typedef std::function<Backend()> BackendInfoFunc;
 
 template <typename T>
 T
-get_setting_from_storage(ConfStorage s, Glib::ustring id)
+get_setting_from_storage(const ConfStorage& s, const Glib::ustring& id)
 {
   try
   {
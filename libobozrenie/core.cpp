@@ -18,18 +18,39 @@
 
 #include "core.hpp"
 
+#include "backend_native.hpp"
 #include "backend_qstat.hpp"
 #include "backend_minetest.hpp"
 #include "exceptions.hpp"
+#include "parallel.hpp"
 #include "util.hpp"
 
+#include <algorithm>
+
+#include <arpa/inet.h>
+
 namespace Obozrenie
 {
+namespace
+{
+const size_t GEOCODE_CHUNK_SIZE = 4096;
+// Every publish copies the game's store, so a running refresh publishes at most this often.
+const std::chrono::milliseconds REFRESH_PUBLISH_INTERVAL(250);
+
+bool
+is_numeric_address(const std::string& v)
+{
+  unsigned char buf[16];
+  return inet_pton(AF_INET, v.c_str(), buf) == 1 || inet_pton(AF_INET6, v.c_str(), buf) == 1;
+}
+}
+
 BackendInfoFunc
 get_backend_data(BackendID id)
 {
   std::map<BackendID, BackendInfoFunc> m;
   m["qstat"] = Obozrenie::Backends::QStat::get_information;
+  m["native"] = Obozrenie::Backends::Native::get_information;
   m["minetest"] = Obozrenie::Backends::Minetest::get_information;
 
   try
@@ -42,70 +63,307 @@ get_backend_data(BackendID id)
   }
 }
 
-bool
-GameTable::game_exists(GameID id)
+void
+GameTransaction::finish()
 {
-  return this->data.find(id) != this->data.end();
+  // Views are shared with running queries, so a changed group gets a fresh view instead of an in-place edit.
+  for (auto g : this->dirty_views)
+  {
+    auto view = std::make_shared<SettingsView>();
+    for (const auto& kv : this->entry.settings[g])
+    {
+      view->set(kv.first, kv.second.data);
+    }
+    this->entry.settings_views[g] = view;
+  }
+  this->dirty_views.clear();
+}
+
+void
+GameTransaction::publish_servers(std::shared_ptr<const ServerStore> v, ServerChangeSet changes)
+{
+  this->entry.servers = v;
+  this->entry.servers_generation++;
+
+  // Should a second publish happen in the same transaction, the skipped generation tells listeners to reload.
+  this->server_changes = std::move(changes);
+  this->server_changes.snapshot = ServerSnapshot{ this->entry.servers, this->entry.servers_generation };
+  this->servers_published = true;
+  this->entry_changed = true;
 }
 
 void
-GameTable::modify_game_entry(GameID id, std::function<void(GameEntry&)> cb)
+GameTransaction::set_backend(BackendInfoFunc v)
 {
-  std::lock_guard<std::mutex> lg(this->m);
+  this->entry.backend_info_func = v;
+}
 
+void
+GameTransaction::set_query_status(QueryStatus v)
+{
+  if (!this->old_status)
+  {
+    this->old_status = this->entry.status;
+  }
+  this->entry.status = v;
+  this->status = v;
+  this->entry_changed = true;
+}
+
+void
+GameTransaction::set_query_progress(size_t received, size_t expected)
+{
+  this->entry.progress = QueryProgress{ received, expected };
+  this->progress_changed = true;
+}
+
+void
+GameTransaction::create_setting(Glib::VariantType t, SettingGroup g, Glib::ustring k)
+{
+  this->entry.settings[g][k] = ConfigValue(t);
+  this->dirty_views.insert(g);
+  this->entry_changed = true;
+  this->settings_changed = true;
+}
+
+void
+GameTransaction::set_setting_metadata(SettingGroup g, Glib::ustring k, Json::Value v)
+{
   try
   {
-    cb(this->data.at(id));
+    auto& s = this->entry.settings.at(g);
+    try
+    {
+      s.at(k).metadata = v;
+    }
+    catch (const std::out_of_range& e)
+    {
+      throw InvalidSettingKeyError(e.what());
+    }
   }
   catch (const std::out_of_range& e)
   {
-    throw NoSuchGameError(id);
+    throw InvalidConfStorageError(e.what());
   }
 }
 
 void
-GameTable::modify_game_entry(GameID id, std::function<void(const GameEntry&)> cb) const
+GameTransaction::set_setting_value(SettingGroup g, Glib::ustring k, Glib::VariantBase v, bool upsert)
 {
-  std::lock_guard<std::mutex> lg(this->m);
+  try
+  {
+    const auto& s = this->entry.settings.at(g);
+    if (!upsert && s.find(k) == s.end())
+    {
+      throw InvalidSettingKeyError();
+    }
+  }
+  catch (const std::out_of_range& e)
+  {
+    throw InvalidConfStorageError();
+  }
 
   try
   {
-    cb(this->data.at(id));
+    this->entry.settings[g][k].data = v;
+  }
+  catch (const Json::LogicError& e)
+  {
+    throw SettingTypeMismatchError(e.what());
+  }
+  this->dirty_views.insert(g);
+  this->entry_changed = true;
+  this->settings_changed = true;
+}
+
+void
+GameTransaction::remove_setting(SettingGroup g, Glib::ustring k)
+{
+  try
+  {
+    if (this->entry.settings.at(g).erase(k) == 0)
+    {
+      throw InvalidSettingKeyError();
+    }
   }
   catch (const std::out_of_range& e)
+  {
+    throw InvalidConfStorageError();
+  }
+  this->dirty_views.insert(g);
+  this->entry_changed = true;
+  this->settings_changed = true;
+}
+
+void
+GameTransaction::set_server_indexing(bool v)
+{
+  if (this->entry.servers->indexed() == v)
+  {
+    return;
+  }
+
+  auto next = std::make_shared<ServerStore>(*this->entry.servers);
+  next->set_indexed(v);
+  this->publish_servers(next, ServerChangeSet());
+}
+
+bool
+GameTable::game_exists(GameID id)
+{
+  return this->data.find(id) != this->data.end();
+}
+
+std::shared_ptr<GameTable::GameSlot>
+GameTable::get_slot(GameID id) const
+{
+  std::shared_lock<std::shared_timed_mutex> lock(this->m);
+
+  auto it = this->data.find(id);
+  if (it == this->data.end())
   {
     throw NoSuchGameError(id);
   }
+
+  return it->second;
+}
+
+std::vector<std::pair<GameID, std::shared_ptr<GameTable::GameSlot>>>
+GameTable::get_slots() const
+{
+  std::vector<std::pair<GameID, std::shared_ptr<GameSlot>>> v;
+
+  std::shared_lock<std::shared_timed_mutex> lock(this->m);
+
+  for (const auto& kv : this->data)
+  {
+    v.push_back(kv);
+  }
+
+  return v;
 }
 
 void
-GameTable::create_game_entry(GameID id)
+GameTable::modify_game_entry(GameID id, std::function<void(const GameEntry&)> cb) const
 {
-  std::lock_guard<std::mutex> lg(this->m);
+  auto slot = this->get_slot(id);
+
+  std::lock_guard<std::mutex> lg(slot->m);
+  cb(slot->entry);
+}
 
-  if (this->game_exists(id))
+void
+GameTable::transaction(GameID id, std::function<void(GameTransaction&)> f)
+{
+  auto slot = this->get_slot(id);
+
+  std::unique_lock<std::mutex> lock(slot->m);
+  GameTransaction t(slot->entry);
+  try
   {
-    throw GameExistsError(id);
+    f(t);
   }
-  else
+  catch (...)
   {
-    this->data[id] = GameEntry();
+    // Whatever was applied before the throw stays applied, so listeners still have to hear about it.
+    t.finish();
+    this->queue_events(id, t);
+    lock.unlock();
+    this->events.dispatch();
+    throw;
   }
+  t.finish();
+  this->queue_events(id, t);
+  lock.unlock();
 
-  this->changed(id);
+  this->events.dispatch();
 }
 
 void
-GameTable::remove_game_entry(GameID id)
+GameTable::queue_events(GameID id, const GameTransaction& t)
 {
-  std::lock_guard<std::mutex> lg(this->m);
+  // Queued under the game lock so that events of one game keep the order of the mutations.
+  if (t.entry_changed)
+  {
+    this->events.publish(GameEvent{ GameEventType::CHANGED, id });
+  }
+  if (t.old_status)
+  {
+    this->events.publish(GameEvent{ GameEventType::STATUS_CHANGED, id, t.status, *t.old_status });
+  }
+  if (t.settings_changed)
+  {
+    this->events.publish(GameEvent{ GameEventType::SETTINGS_CHANGED, id });
+  }
+  if (t.servers_published)
+  {
+    this->events.publish(GameEvent{ GameEventType::SERVERS_CHANGED, id, QueryStatus::EMPTY, QueryStatus::EMPTY, t.server_changes });
+  }
+  if (t.progress_changed)
+  {
+    this->events.publish(GameEvent{ GameEventType::PROGRESS_CHANGED, id, QueryStatus::EMPTY, QueryStatus::EMPTY, ServerChangeSet(), t.entry.progress });
+  }
+}
 
-  if (this->data.erase(id) == 0)
+void
+GameTable::create_game_entry(GameID id)
+{
   {
-    throw NoSuchGameError(id);
+    std::unique_lock<std::shared_timed_mutex> lock(this->m);
+
+    if (this->game_exists(id))
+    {
+      throw GameExistsError(id);
+    }
+    else
+    {
+      this->data[id] = std::make_shared<GameSlot>();
+    }
+    this->events.publish(GameEvent{ GameEventType::CHANGED, id });
+  }
+
+  this->events.dispatch();
+}
+
+void
+GameTable::remove_game_entry(GameID id)
+{
+  {
+    std::unique_lock<std::shared_timed_mutex> lock(this->m);
+
+    if (this->data.erase(id) == 0)
+    {
+      throw NoSuchGameError(id);
+    }
+    this->events.publish(GameEvent{ GameEventType::CHANGED, id });
   }
 
-  this->changed(id);
+  this->events.dispatch();
+}
+
+GameTable::GameTable()
+{
+  auto forward = [this](const GameEvent& e) {
+    switch (e.type)
+    {
+    case GameEventType::CHANGED:
+      this->changed(e.id);
+      break;
+    case GameEventType::STATUS_CHANGED:
+      this->status_changed(e.id, e.status, e.old_status);
+      break;
+    case GameEventType::SETTINGS_CHANGED:
+      this->settings_changed(e.id);
+      break;
+    case GameEventType::SERVERS_CHANGED:
+      this->servers_changed(e.id, e.changes);
+      break;
+    case GameEventType::PROGRESS_CHANGED:
+      this->progress_changed(e.id, e.progress);
+      break;
+    }
+  };
+  this->events.subscribe(forward, nullptr, [this](const GameEvent& e, std::exception_ptr error) { this->listener_failed(e.id, error); });
 }
 
 std::vector<GameID>
@@ -113,7 +371,7 @@ GameTable::get_game_list() const
 {
   std::vector<GameID> v;
 
-  std::lock_guard<std::mutex> lg(this->m);
+  std::shared_lock<std::shared_timed_mutex> lock(this->m);
 
   for (const auto& kv : this->data)
   {
@@ -126,7 +384,7 @@ GameTable::get_game_list() const
 void
 GameTable::set_backend(GameID id, BackendInfoFunc v)
 {
-  this->modify_game_entry(id, [v](GameEntry& e) { e.backend_info_func = v; });
+  this->transaction(id, [v](GameTransaction& t) { t.set_backend(v); });
 }
 
 BackendInfoFunc
@@ -154,41 +412,26 @@ GameTable::get_setting_keys(GameID id, SettingGroup g) const
 void
 GameTable::create_setting(GameID id, Glib::VariantType t, SettingGroup g, Glib::ustring k)
 {
-  this->modify_game_entry(id, [this, id, t, g, k](GameEntry& e) {
-    e.settings[g][k] = ConfigValue(t);
-
-    this->changed(id);
-    this->settings_changed(id);
-  });
+  this->transaction(id, [t, g, k](GameTransaction& tx) { tx.create_setting(t, g, k); });
 }
 
-void GameTable::set_setting_metadata(GameID id, SettingGroup g, Glib::ustring k, Json::Value v) {
-    this->modify_game_entry(id, [this, id, g, k, v](GameEntry& e) {
-        try {
-            auto& s = e.settings.at(g);
-            try {
-                s.at(k).metadata = v;
-            } catch (const std::out_of_range& e) { throw InvalidSettingKeyError(e.what()); }
-        } catch (const std::out_of_range& e) { throw InvalidConfStorageError(e.what()); }
-    });
+void
+GameTable::set_setting_metadata(GameID id, SettingGroup g, Glib::ustring k, Json::Value v)
+{
+  this->transaction(id, [g, k, v](GameTransaction& t) { t.set_setting_metadata(g, k, v); });
 }
 
-void GameTable::set_setting_value(GameID id, SettingGroup g, Glib::ustring k, Glib::VariantBase v, bool upsert) {
-    this->modify_game_entry(id, [g, k, v, upsert](GameEntry& e) {
-        try {
-            auto s = e.settings.at(g);
-            try { s.at(k); } catch (const std::out_of_range& e) { if (!upsert) throw InvalidSettingKeyError(); }
-        } catch (const std::out_of_range& e) { throw InvalidConfStorageError(); }
-
-        try { e.settings[g][k].data = v; } catch (const Json::LogicError& e) { throw SettingTypeMismatchError(e.what()); }
-    });
+void
+GameTable::set_setting_value(GameID id, SettingGroup g, Glib::ustring k, Glib::VariantBase v, bool upsert)
+{
+  this->transaction(id, [g, k, v, upsert](GameTransaction& t) { t.set_setting_value(g, k, v, upsert); });
 }
 
 ConfigValue GameTable::get_setting(GameID id, SettingGroup g, Glib::ustring k) const {
     ConfigValue v;
     this->modify_game_entry(id, [g, k, &v](const GameEntry& e) {
         try {
-            auto s = e.settings.at(g);
+            const auto& s = e.settings.at(g);
             try { v = s.at(k); } catch (const std::out_of_range& e) { throw InvalidSettingKeyError(e.what()); }
         } catch (const std::out_of_range& e) { throw InvalidConfStorageError(e.what()); }
     });
@@ -198,7 +441,10 @@ ConfigValue GameTable::get_setting(GameID id, SettingGroup g, Glib::ustring k) c
 std::map<GameID, ConfigValue> GameTable::get_setting_map(SettingGroup g, Glib::ustring k) const {
     std::map<GameID, ConfigValue> m;
 
-    for (auto e : this->data) { try { m[e.first] = e.second.settings.at(g).at(k); } catch (...) {} }
+    for (const auto& kv : this->get_slots()) {
+        std::lock_guard<std::mutex> lg(kv.second->m);
+        try { m[kv.first] = kv.second->entry.settings.at(g).at(k); } catch (...) {}
+    }
 
     return m;
 }
@@ -210,23 +456,32 @@ ConfStorage GameTable::get_settings(GameID id, SettingGroup g) const {
     return v;
 }
 
-void GameTable::remove_setting(GameID id, SettingGroup g, Glib::ustring k) {
-  this->modify_game_entry(id, [this, id, g, k](GameEntry& e) {
-    try { if (e.settings.at(g).erase(k) == 0) throw InvalidSettingKeyError(); } catch (const std::out_of_range& e) { throw InvalidConfStorageError(); }
-    this->changed(id);
-    this->settings_changed(id);
+std::shared_ptr<const SettingsView>
+GameTable::get_settings_view(GameID id, SettingGroup g) const
+{
+  std::shared_ptr<const SettingsView> v;
+  this->modify_game_entry(id, [&v, g](const GameEntry& e) {
+    auto it = e.settings_views.find(g);
+    if (it == e.settings_views.end())
+    {
+      throw InvalidConfStorageError();
+    }
+    v = it->second;
   });
+
+  return v;
 }
 
-void GameTable::set_query_status(GameID id, QueryStatus v)
+void
+GameTable::remove_setting(GameID id, SettingGroup g, Glib::ustring k)
 {
-  this->modify_game_entry(id, [this, id, v](GameEntry& e) {
-    auto old_status = e.status;
-    e.status = v;
+  this->transaction(id, [g, k](GameTransaction& t) { t.remove_setting(g, k); });
+}
 
-    this->changed(id);
-    this->status_changed(id, v, old_status);
-  });
+void
+GameTable::set_query_status(GameID id, QueryStatus v)
+{
+  this->transaction(id, [v](GameTransaction& t) { t.set_query_status(v); });
 }
 
 QueryStatus GameTable::get_query_status(GameID id) const {
@@ -237,56 +492,221 @@ QueryStatus GameTable::get_query_status(GameID id) const {
   return v;
 }
 
-void GameTable::insert_servers(GameID id, ServerData v, bool replace) {
-  this->modify_game_entry(id, [this, id, v, replace](GameEntry& e) {
-    if (replace) { e.servers = v; } else { std::for_each(std::begin(v), std::end(v), [&e](std::pair<Glib::ustring, Server> kv) { e.servers[kv.first] = kv.second; }); }
-    this->changed(id);
-    this->servers_changed(id, e.servers);
-  });
+void
+GameTable::set_query_progress(GameID id, size_t received, size_t expected)
+{
+  this->transaction(id, [received, expected](GameTransaction& t) { t.set_query_progress(received, expected); });
 }
 
-ServerData
-GameTable::get_servers(GameID id, ServerCompareFunc f) const
+QueryProgress
+GameTable::get_query_progress(GameID id) const
 {
-  ServerData matched;
+  QueryProgress v;
 
-  this->modify_game_entry(id, [&matched, f](const GameEntry& e) {
-    if (!f)
+  this->modify_game_entry(id, [&v](const GameEntry& e) { v = e.progress; });
+
+  return v;
+}
+
+void
+GameTable::update_servers(GameID id, std::function<std::shared_ptr<const ServerStore>(const ServerStore&, ServerChangeSet&)> f,
+                          std::function<void(GameTransaction&)> also)
+{
+  // Copy-on-write: the new map is built without holding the game lock and published only if nobody else did so in the meantime.
+  for (;;)
+  {
+    auto old = this->get_server_snapshot(id);
+    ServerChangeSet changes;
+    auto next = f(*old.data, changes);
+
+    bool published = false;
+    this->transaction(id, [&old, &next, &changes, &published, &also](GameTransaction& t) {
+      if (t.entry.servers_generation != old.generation)
+      {
+        return;
+      }
+      t.publish_servers(next, std::move(changes));
+      published = true;
+
+      if (also)
+      {
+        also(t);
+      }
+    });
+
+    if (published)
     {
-      matched = e.servers;
+      return;
     }
-    else
+  }
+}
+
+void
+GameTable::insert_servers(GameID id, ServerData v, bool replace, std::function<void(GameTransaction&)> also)
+{
+  if (replace)
+  {
+    std::shared_ptr<const ServerStore> next;
+    this->update_servers(id, [&v, &next](const ServerStore& old, ServerChangeSet& changes) {
+      if (!next || next->indexed() != old.indexed())
+      {
+        next = std::make_shared<const ServerStore>(v, old.indexed());
+      }
+
+      for (const auto& kv : v)
+      {
+        auto old_row = old.find(kv.first);
+        if (old_row == ServerStore::npos)
+        {
+          changes.added.push_back(kv.first);
+        }
+        else if (!old.equals(old_row, kv.second))
+        {
+          changes.updated.push_back(kv.first);
+        }
+      }
+      for (ServerStore::Row r = 0; r < old.size(); r++)
+      {
+        if (next->find(old.host(r)) == ServerStore::npos)
+        {
+          changes.removed.push_back(old.host(r));
+        }
+      }
+      return next;
+    }, also);
+  }
+  else
+  {
+    this->merge_servers(id, std::move(v), nullptr, also);
+  }
+}
+
+void
+GameTable::merge_servers(GameID id, ServerData v, const std::unordered_set<std::string>* keep, std::function<void(GameTransaction&)> also)
+{
+  this->update_servers(id, [&v, keep](const ServerStore& old, ServerChangeSet& changes) {
+    if (keep)
+    {
+      for (ServerStore::Row r = 0; r < old.size(); r++)
+      {
+        if (!keep->count(old.host(r).raw()))
+        {
+          changes.removed.push_back(old.host(r));
+        }
+      }
+    }
+
+    auto next = std::make_shared<ServerStore>(old);
+    next->begin_bulk(v.size() + changes.removed.size());
+    for (const auto& host : changes.removed)
+    {
+      next->erase(host);
+    }
+    for (const auto& kv : v)
     {
-      for (const auto& kv : e.servers)
+      auto r = next->find(kv.first);
+      if (r == ServerStore::npos)
       {
-        if (f(kv))
+        next->set(kv.first, kv.second);
+        changes.added.push_back(kv.first);
+      }
+      else if (!next->equals(r, kv.second))
+      {
+        next->set(kv.first, kv.second);
+        changes.updated.push_back(kv.first);
+      }
+    }
+    next->end_bulk();
+    return std::shared_ptr<const ServerStore>(next);
+  }, also);
+}
+
+void
+GameTable::restore_servers(GameID id, const ServerStore& base, const std::unordered_set<std::string>& hosts, std::function<void(GameTransaction&)> also)
+{
+  this->update_servers(id, [&base, &hosts](const ServerStore& old, ServerChangeSet& changes) {
+    auto next = std::make_shared<ServerStore>(old);
+    next->begin_bulk(hosts.size());
+    for (const auto& host : hosts)
+    {
+      auto r = next->find(host);
+      auto base_row = base.find(host);
+      if (base_row == ServerStore::npos)
+      {
+        if (r != ServerStore::npos)
         {
-          matched[kv.first] = kv.second;
+          next->erase(host);
+          changes.removed.push_back(host);
         }
+        continue;
+      }
+
+      auto v = base.get(base_row);
+      if (r == ServerStore::npos)
+      {
+        next->set(host, v);
+        changes.added.push_back(host);
+      }
+      else if (!next->equals(r, v))
+      {
+        next->set(host, v);
+        changes.updated.push_back(host);
       }
     }
+    next->end_bulk();
+    return std::shared_ptr<const ServerStore>(next);
+  }, also);
+}
+
+ServerSnapshot
+GameTable::get_server_snapshot(GameID id) const
+{
+  ServerSnapshot v;
+
+  this->modify_game_entry(id, [&v](const GameEntry& e) {
+    v.data = e.servers;
+    v.generation = e.servers_generation;
   });
 
+  return v;
+}
+
+ServerData
+GameTable::get_servers(GameID id, ServerCompareFunc f) const
+{
+  auto snapshot = this->get_server_snapshot(id);
+  const auto& store = *snapshot.data;
+
+  if (!f)
+  {
+    return store.to_server_data();
+  }
+
+  ServerData matched;
+  for (ServerStore::Row r = 0; r < store.size(); r++)
+  {
+    auto kv = std::make_pair(store.host(r), store.get(r));
+    if (f(kv))
+    {
+      matched.emplace(std::move(kv));
+    }
+  }
+
   return matched;
 }
 
 Server
 GameTable::get_server_info_by_host(GameID id, Glib::ustring k) const
 {
-  Server v;
+  auto snapshot = this->get_server_snapshot(id);
 
-  this->modify_game_entry(id, [&v, k](const GameEntry& e) {
-    try
-    {
-      v = e.servers.at(k);
-    }
-    catch (const std::out_of_range&)
-    {
-      throw NotFoundError(Glib::ustring::compose("No data for host %1 found", k));
-    }
-  });
+  auto r = snapshot.data->find(k);
+  if (r == ServerStore::npos)
+  {
+    throw NotFoundError(Glib::ustring::compose("No data for host %1 found", k));
+  }
 
-  return v;
+  return snapshot.data->get(r);
 }
 
 ServerData
@@ -294,35 +714,103 @@ GameTable::remove_servers(GameID id, ServerCompareFunc f)
 {
   ServerData deleted;
 
-  this->modify_game_entry(id, [this, id, &deleted, f](GameEntry& e) {
+  this->update_servers(id, [&deleted, f](const ServerStore& old, ServerChangeSet& changes) {
+    deleted.clear();
+    auto next = std::make_shared<ServerStore>();
     if (!f)
     {
-      deleted = e.servers;
-      e.servers = ServerData();
+      deleted = old.to_server_data();
+      for (ServerStore::Row r = 0; r < old.size(); r++)
+      {
+        changes.removed.push_back(old.host(r));
+      }
+      return std::shared_ptr<const ServerStore>(next);
     }
-    else
+
+    for (ServerStore::Row r = 0; r < old.size(); r++)
     {
-      ServerData nonmatch;
-      for (const auto& kv : e.servers)
+      auto kv = std::make_pair(old.host(r), old.get(r));
+      if (f(kv))
       {
-        if (f(kv))
-        {
-          deleted[kv.first] = kv.second;
-        }
-        else
-        {
-          nonmatch[kv.first] = kv.second;
-        }
+        changes.removed.push_back(kv.first);
+        deleted.emplace(std::move(kv));
       }
-      e.servers = nonmatch;
     }
-    this->changed(id);
-    this->servers_changed(id, e.servers);
+
+    *next = old;
+    next->begin_bulk(changes.removed.size());
+    for (const auto& host : changes.removed)
+    {
+      next->erase(host);
+    }
+    next->end_bulk();
+    return std::shared_ptr<const ServerStore>(next);
+  });
+
+  return deleted;
+}
+
+void
+GameTable::set_server_indexing(GameID id, bool v)
+{
+  this->update_servers(id, [v](const ServerStore& old, ServerChangeSet&) {
+    auto next = std::make_shared<ServerStore>(old);
+    next->set_indexed(v);
+    return std::shared_ptr<const ServerStore>(next);
+  });
+}
+
+ServerSelection
+GameTable::select_servers(GameID id, const ServerFilter& f) const
+{
+  ServerSelection v;
+  v.snapshot = this->get_server_snapshot(id);
+  v.rows = FilterPlan(f).select(*v.snapshot.data);
+
+  return v;
+}
+
+ServerPage
+GameTable::query_servers(GameID id, const ServerQuery& q) const
+{
+  ServerPage v;
+  v.snapshot = this->get_server_snapshot(id);
+  v.total = 0;
+  v.rows = FilterPlan(q.filter).select(*v.snapshot.data, q, q.count_total ? &v.total : nullptr);
+
+  return v;
+}
+
+ServerData
+GameTable::remove_servers(GameID id, const ServerFilter& f)
+{
+  FilterPlan plan(f);
+  ServerData deleted;
+
+  this->update_servers(id, [&plan, &deleted](const ServerStore& old, ServerChangeSet& changes) {
+    deleted.clear();
+    auto rows = plan.select(old);
+    auto next = std::make_shared<ServerStore>(old);
+    next->begin_bulk(rows.size());
+    for (auto r : rows)
+    {
+      next->erase(old.host(r));
+      changes.removed.push_back(old.host(r));
+      deleted.emplace(old.host(r), old.get(r));
+    }
+    next->end_bulk();
+    return std::shared_ptr<const ServerStore>(next);
   });
 
   return deleted;
 }
 
+void
+GameTable::retain_servers(GameID id, const std::unordered_set<std::string>& hosts, std::function<void(GameTransaction&)> also)
+{
+  this->merge_servers(id, ServerData(), &hosts, also);
+}
+
 void
 Core::read_game_lists(Json::Value m)
 {
@@ -334,130 +822,434 @@ Core::read_game_lists(Json::Value m)
   {
     gt->create_game_entry(game_id);
 
-    JSONCallbackMap b;
-    b[name_setting] = [this, game_id, &gt](std::string, Json::Value v) {
-      if (v.isString())
-      {
-        gt->create_setting(game_id, Glib::VARIANT_TYPE_STRING, SettingGroup::SYSTEM, name_setting);
-        gt->set_setting_value(game_id, SettingGroup::SYSTEM, name_setting, make_variant(v.asString()));
-      }
-    };
-    b["backend"] = [this, game_id, &gt](std::string, Json::Value v) {
-      if (v.isString())
-      {
-        gt->set_backend(game_id, get_backend_data(v.asString()));
-      }
-    };
-    b["settings"] = [this, game_id, &gt](std::string, Json::Value v) {
-      for (auto k : v.getMemberNames())
-      {
-        auto entry_data = v[k];
-        auto typestring = entry_data.get("type", Json::Value(Json::nullValue));
-        if (typestring.isString())
+    // The whole entry is loaded under one lock acquisition and announced once.
+    gt->transaction(game_id, [&m, &game_id](GameTransaction& tx) {
+      JSONCallbackMap b;
+      b[name_setting] = [&tx](std::string, Json::Value v) {
+        if (v.isString())
+        {
+          tx.create_setting(Glib::VARIANT_TYPE_STRING, SettingGroup::SYSTEM, name_setting);
+          tx.set_setting_value(SettingGroup::SYSTEM, name_setting, make_variant(v.asString()));
+        }
+      };
+      b["server_indexes"] = [&tx](std::string, Json::Value v) {
+        if (v.isBool())
+        {
+          tx.set_server_indexing(v.asBool());
+        }
+      };
+      b["backend"] = [&tx](std::string, Json::Value v) {
+        if (v.isString())
         {
-          auto t = typestring.asString();
-          if (g_variant_type_string_is_valid(t.c_str()))
+          tx.set_backend(get_backend_data(v.asString()));
+        }
+      };
+      b["settings"] = [&tx](std::string, Json::Value v) {
+        for (auto k : v.getMemberNames())
+        {
+          auto entry_data = v[k];
+          auto typestring = entry_data.get("type", Json::Value(Json::nullValue));
+          if (typestring.isString())
           {
-            Glib::VariantType vtype(t);
-            gt->create_setting(game_id, vtype, SettingGroup::USER, k);
-            gt->set_setting_metadata(game_id, SettingGroup::USER, k, v[k]);
-            auto defaultnode = entry_data.get("default", Json::Value(Json::nullValue));
-            if (!defaultnode.isNull())
+            auto t = typestring.asString();
+            if (g_variant_type_string_is_valid(t.c_str()))
             {
-              gt->set_setting_value(game_id, SettingGroup::USER, k, json_to_variant(vtype, defaultnode));
+              Glib::VariantType vtype(t);
+              tx.create_setting(vtype, SettingGroup::USER, k);
+              tx.set_setting_metadata(SettingGroup::USER, k, v[k]);
+              auto defaultnode = entry_data.get("default", Json::Value(Json::nullValue));
+              if (!defaultnode.isNull())
+              {
+                tx.set_setting_value(SettingGroup::USER, k, json_to_variant(vtype, defaultnode));
+              }
             }
           }
         }
-      }
-    };
-    map_json_object(m[game_id], b);
+      };
+      map_json_object(m[game_id], b);
+    });
   }
   this->game_table = gt;
 }
 
 void
-Core::refresh_servers(GameID id, bool is_async, std::function<void(const std::exception&)> error_handler, boost::signals2::signal<void()>* cancellable)
+Core::geocode(ServerData& batch) const
+{
+  std::vector<ServerData::value_type*> entries;
+  entries.reserve(batch.size());
+  for (auto& kv : batch)
+  {
+    entries.push_back(&kv);
+  }
+
+  // Whole documents parsed in parallel arrive as one large batch; those are looked up on several threads too.
+  auto chunks = (entries.size() + GEOCODE_CHUNK_SIZE - 1) / GEOCODE_CHUNK_SIZE;
+  parallel_for(chunks, [this, &entries](size_t chunk) {
+    auto end = std::min(entries.size(), (chunk + 1) * GEOCODE_CHUNK_SIZE);
+    for (auto i = chunk * GEOCODE_CHUNK_SIZE; i < end; i++)
+    {
+      auto address = strip_port(entries[i]->first);
+      auto country = this->geocoder->country_code_by_addr(address);
+      if (country.empty() && !is_numeric_address(address))
+      {
+        country = this->geocoder->country_code_by_name(address);
+      }
+      if (!country.empty())
+      {
+        entries[i]->second.country = Atom(country);
+      }
+    }
+  });
+}
+
+QueryScope
+Core::get_refresh_scope(GameID id, RefreshMode mode)
+{
+  if (mode == RefreshMode::FULL)
+  {
+    return QueryScope{ true, {} };
+  }
+
+  auto snapshot = this->game_table->get_server_snapshot(id);
+  if (mode == RefreshMode::AUTO)
+  {
+    // Without known servers there is nothing to re-ping, so the masters have to be asked anyway.
+    auto last = this->last_full_refresh.find(id);
+    if (snapshot.data->empty() || last == this->last_full_refresh.end())
+    {
+      return QueryScope{ true, {} };
+    }
+
+    auto interval = this->game_table->get_settings_view(id, SettingGroup::USER)->find(MASTER_REFRESH_INTERVAL_SETTING);
+    if (std::chrono::steady_clock::now() - last->second >= std::chrono::seconds(interval ? *interval : DEFAULT_MASTER_REFRESH_INTERVAL))
+    {
+      return QueryScope{ true, {} };
+    }
+  }
+
+  QueryScope scope{ false, {} };
+  scope.hosts.reserve(snapshot.data->size());
+  for (ServerStore::Row r = 0; r < snapshot.data->size(); r++)
+  {
+    scope.hosts.push_back(snapshot.data->host(r).raw());
+  }
+  return scope;
+}
+
+void
+Core::refresh_servers(GameID id, bool is_async, std::function<void(const std::exception&)> error_handler, boost::signals2::signal<void()>* cancellable,
+                      RefreshMode mode, TaskPriority priority)
+{
+  QueryScope scope;
+  {
+    std::lock_guard<std::mutex> lock(this->m);
+    scope = this->get_refresh_scope(id, mode);
+  }
+
+  auto result = this->run_query(id, std::move(scope), is_async, error_handler, cancellable, priority);
+  if (!is_async)
+  {
+    result.get();
+  }
+}
+
+void
+Core::refresh_hosts(GameID id, std::vector<std::string> hosts, bool is_async, std::function<void(const std::exception&)> error_handler,
+                    TaskPriority priority)
+{
+  auto result = this->run_query(id, QueryScope{ false, std::move(hosts) }, is_async, error_handler, nullptr, priority);
+  if (!is_async)
+  {
+    result.get();
+  }
+}
+
+Future<RefreshResult>
+Core::refresh(GameID id, RefreshMode mode, TaskPriority priority)
+{
+  QueryScope scope;
+  {
+    std::lock_guard<std::mutex> lock(this->m);
+    scope = this->get_refresh_scope(id, mode);
+  }
+
+  return this->run_query(id, std::move(scope), true, nullptr, nullptr, priority);
+}
+
+Future<RefreshResult>
+Core::requery_hosts(GameID id, std::vector<std::string> hosts, TaskPriority priority)
+{
+  return this->run_query(id, QueryScope{ false, std::move(hosts) }, true, nullptr, nullptr, priority);
+}
+
+Future<ServerPage>
+Core::query(GameID id, ServerQuery q, TaskPriority priority)
+{
+  Promise<ServerPage> promise;
+  auto table = this->game_table;
+  this->async_cb(
+    [promise, table, id, q]() {
+      try
+      {
+        promise.token().throw_if_cancelled();
+        promise.set_value(table->query_servers(id, q));
+      }
+      catch (...)
+      {
+        promise.set_exception(std::current_exception());
+      }
+    },
+    priority);
+  return promise.get_future();
+}
+
+std::shared_ptr<TaskLimiter>
+Core::get_limiter(const Backend& b)
+{
+  std::lock_guard<std::mutex> lock(this->m);
+  auto& limiter = this->limiters[b.name.raw()];
+  if (!limiter)
+  {
+    auto it = this->backend_concurrency.find(b.name.raw());
+    limiter = std::make_shared<TaskLimiter>(this->async_cb, it != this->backend_concurrency.end() ? it->second : b.concurrency);
+  }
+  return limiter;
+}
+
+size_t
+Core::get_backend_concurrency(const Backend& b) const
+{
+  std::lock_guard<std::mutex> lock(this->m);
+  auto it = this->backend_concurrency.find(b.name.raw());
+  return it != this->backend_concurrency.end() ? it->second : b.concurrency;
+}
+
+void
+Core::set_backend_concurrency(const std::string& name, size_t v)
+{
+  std::shared_ptr<TaskLimiter> limiter;
+  {
+    std::lock_guard<std::mutex> lock(this->m);
+    this->backend_concurrency[name] = v;
+    auto it = this->limiters.find(name);
+    if (it != this->limiters.end())
+    {
+      limiter = it->second;
+    }
+  }
+  if (limiter)
+  {
+    limiter->set_limit(v);
+  }
+}
+
+Future<RefreshResult>
+Core::run_query(GameID id, QueryScope scope, bool is_async, std::function<void(const std::exception&)> error_handler, boost::signals2::signal<void()>* cancellable,
+                TaskPriority priority)
 {
+  Promise<RefreshResult> promise;
+  auto result = promise.get_future();
   {
     std::lock_guard<std::mutex> lock(this->m);
 
     auto status = this->game_table->get_query_status(id);
     if (status == QueryStatus::WORKING)
     {
-      return;
+      auto it = this->running_refreshes.find(id);
+      if (it != this->running_refreshes.end())
+      {
+        return it->second;
+      }
+      return make_exceptional_future<RefreshResult>(std::make_exception_ptr(BackendError("Game is being refreshed elsewhere : " + id.raw())));
     }
 
-    auto new_status = QueryStatus::WORKING;
-    this->game_table->set_query_status(id, new_status);
+    this->game_table->transaction(id, [](GameTransaction& t) {
+      t.set_query_status(QueryStatus::WORKING);
+      t.set_query_progress(0, 0);
+    });
+    this->running_refreshes[id] = result;
   }
 
-  auto fn = [this, id, error_handler, &cancellable]() {
-    ServerData data;
-    try
+  // Settles the promise once the game's status is final. The entry is dropped first so that a refresh asked for from a
+  // continuation starts afresh instead of joining this one.
+  auto settle = [this, id, promise, result](std::function<void()> f) {
     {
-      auto b = this->game_table->get_backend(id)();
-      this->logger(std::vector<std::string>{ CORE_COMPONENT_STRING, BACKENDS_COMPONENT_STRING, b.name }, "Refreshing servers for " + id);
-
-      if (!b.f)
+      std::lock_guard<std::mutex> lock(this->m);
+      auto it = this->running_refreshes.find(id);
+      if (it != this->running_refreshes.end() && it->second == result)
       {
-        throw BackendError("no query function");
+        this->running_refreshes.erase(it);
       }
+    }
+    f();
+  };
 
-      bool is_cancelled = false;
-      if (cancellable)
-      {
-        cancellable->connect([&is_cancelled]() {
-          is_cancelled = true;
+  auto fail = [this, id, error_handler, promise, settle](const std::exception& e) {
+    this->logger(std::vector<std::string>{ CORE_COMPONENT_STRING }, Glib::ustring::compose("Error refreshing servers for %1: %2", id, e.what()));
+    if (error_handler)
+    {
+      error_handler(e);
+    }
+    this->game_table->set_query_status(id, QueryStatus::ERROR);
+    settle([promise]() { promise.set_exception(std::current_exception()); });
+  };
 
-          throw PopenError("Cancelled");
-        });
+  // The backend is resolved up front since it decides which line the query waits in.
+  Backend b;
+  std::shared_ptr<TaskLimiter> limiter;
+  try
+  {
+    b = this->game_table->get_backend(id)();
+    if (!b.f)
+    {
+      throw BackendError("no query function");
+    }
+    limiter = this->get_limiter(b);
+  }
+  catch (const std::exception& e)
+  {
+    fail(e);
+    return result;
+  }
+  catch (...)
+  {
+    fail(BackendError("Unknown error"));
+    return result;
+  }
+
+  auto fn = [this, id, scope, b, fail, settle, promise, cancellable]() {
+    // The servers as they were before, for taking back what a cancelled or overdue refresh already published.
+    ServerSnapshot base;
+    // Hosts reported by this refresh. Whatever else is still in the table afterwards has gone away.
+    std::unordered_set<std::string> seen;
+    // Answers not published yet.
+    ServerData pending;
+    std::chrono::steady_clock::time_point last_publish;
+    auto roll_back = [this, id, &base, &seen]() {
+      if (!base.data)
+      {
+        return;
       }
+      try
+      {
+        this->game_table->restore_servers(id, *base.data, seen);
+      }
+      catch (...)
+      {
+        // The refresh fails either way; the partial servers then stay until the next one.
+      }
+    };
+    try
+    {
+      promise.token().throw_if_cancelled();
 
-      auto f = std::async(b.f, id, this->game_table->get_settings(id, SettingGroup::USER));
-      auto recvdata = f.get();
+      this->logger(std::vector<std::string>{ CORE_COMPONENT_STRING, BACKENDS_COMPONENT_STRING, b.name }, "Refreshing servers for " + id);
+      base = this->game_table->get_server_snapshot(id);
 
-      for (const auto& kv : recvdata)
+      // The view is immutable and stays alive for the whole query, so the backend borrows it instead of a copy of the settings.
+      auto settings = this->game_table->get_settings_view(id, SettingGroup::USER);
+
+      // The deadline counts from the start of the query, not from when it was queued.
+      auto deadline = settings->find(REFRESH_DEADLINE_SETTING);
+      auto seconds = deadline ? *deadline : DEFAULT_REFRESH_DEADLINE;
+      auto token = seconds > 0 ? promise.token().with_deadline(std::chrono::steady_clock::now() + std::chrono::seconds(seconds)) : promise.token();
+
+      // The old style cancel signal is only listened to while the query runs.
+      boost::signals2::scoped_connection cancel_connection;
+      if (cancellable)
       {
-        try
-        {
-          auto host = kv.first;
-          auto info = kv.second;
+        cancel_connection = cancellable->connect([token]() { token.cancel(); });
+      }
 
-          if (this->geocoder)
+      // Batches are collected and published every REFRESH_PUBLISH_INTERVAL, so the list fills up while the query is still running
+      // without copying the game's store for every batch. The first batch goes out right away.
+      QuerySink sink;
+      sink.push = [this, id, &seen, &pending, &last_publish, &token](ServerData batch) {
+        token.throw_if_cancelled();
+        if (this->geocoder)
+        {
+          this->geocode(batch);
+        }
+        for (const auto& kv : batch)
+        {
+          seen.insert(kv.first.raw());
+        }
+        if (pending.empty())
+        {
+          pending = std::move(batch);
+        }
+        else
+        {
+          for (auto& kv : batch)
           {
-            info.country = this->geocoder->country_code_by_name(host);
+            pending[kv.first] = std::move(kv.second);
           }
-          data[host] = info;
         }
-        catch (const std::experimental::bad_optional_access& e)
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_publish >= REFRESH_PUBLISH_INTERVAL)
         {
+          this->game_table->insert_servers(id, std::move(pending));
+          pending.clear();
+          last_publish = now;
         }
-      }
+      };
+      sink.progress = [this, id](size_t received, size_t expected) { this->game_table->set_query_progress(id, received, expected); };
+
+      // The backend runs right here; the limiter already bounds how many of its queries share the pool.
+      b.f(id, *settings, scope, sink, token);
+      token.throw_if_cancelled();
+
       this->logger(std::vector<std::string>{ CORE_COMPONENT_STRING, BACKENDS_COMPONENT_STRING, b.name }, "Parsed servers for " + id);
+
+      // The rest of the answers, the removal of vanished servers and the final status go out in one publish.
+      if (scope.full)
+      {
+        this->game_table->merge_servers(id, std::move(pending), &seen, [](GameTransaction& t) { t.set_query_status(QueryStatus::READY); });
+
+        std::lock_guard<std::mutex> lock(this->m);
+        this->last_full_refresh[id] = std::chrono::steady_clock::now();
+      }
+      else
+      {
+        // Hosts that did not answer a re-ping keep their last known state until the next full refresh.
+        this->game_table->merge_servers(id, std::move(pending), nullptr, [](GameTransaction& t) { t.set_query_status(QueryStatus::READY); });
+      }
     }
+    // Whatever ended the refresh early, be it cancellation, the deadline or a backend failing halfway, the servers it already
+    // published go back to how they were, so that the table never shows half a refresh next to the ERROR status.
     catch (const std::exception& e)
     {
-      this->logger(std::vector<std::string>{ CORE_COMPONENT_STRING }, Glib::ustring::compose("Error refreshing servers for %1: %2", id, e.what()));
-      if (error_handler)
-      {
-        error_handler(e);
-      }
-      this->game_table->set_query_status(id, QueryStatus::ERROR);
-      throw;
+      roll_back();
+      fail(e);
+      return;
+    }
+    catch (...)
+    {
+      roll_back();
+      fail(BackendError("Unknown error"));
+      return;
     }
-    this->game_table->insert_servers(id, data, true);
     this->logger(std::vector<std::string>{ CORE_COMPONENT_STRING }, "Loaded servers into game table for " + id);
-    this->game_table->set_query_status(id, QueryStatus::READY);
-    return;
+    settle([id, &scope, &seen, promise]() { promise.set_value(RefreshResult{ id, scope.full, seen.size() }); });
   };
 
-  if (is_async)
+  try
   {
-    this->async_cb(fn);
+    if (is_async)
+    {
+      limiter->post(fn, priority);
+    }
+    else
+    {
+      limiter->run(fn, priority);
+    }
   }
-  else
+  catch (const std::exception& e)
   {
-    fn();
+    // The pool refused the query, e.g. because it is shutting down.
+    fail(e);
   }
+  return result;
 }
 }
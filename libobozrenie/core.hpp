@@ -19,10 +19,16 @@
 #ifndef _CORE_HPP_
 #define _CORE_HPP_
 
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <iostream>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <unordered_set>
 #include <vector>
 
 #include <boost/signals2.hpp>
@@ -30,7 +36,12 @@
 #include <glibmm.h>
 
 #include "common_models.hpp"
+#include "event_bus.hpp"
+#include "future.hpp"
 #include "geoip.hpp"
+#include "server_filter.hpp"
+#include "server_store.hpp"
+#include "task_pool.hpp"
 #include "ThreadPool.hpp"
 
 namespace Obozrenie
@@ -55,38 +66,202 @@ enum class QueryStatus
   ERROR
 };
 
+enum class RefreshMode
+{
+  // Fetches the master lists and queries every server on them. Servers missing from the answer are removed.
+  FULL,
+  // Queries only the servers already in the table and merges the answers. Nothing is removed.
+  KNOWN_HOSTS,
+  // KNOWN_HOSTS while the last full refresh is younger than the game's master refresh interval, FULL otherwise.
+  AUTO
+};
+
+// Seconds between master list fetches in RefreshMode::AUTO.
+constexpr SettingKey<int32_t> MASTER_REFRESH_INTERVAL_SETTING{ "master_refresh_interval" };
+const int32_t DEFAULT_MASTER_REFRESH_INTERVAL = 600;
+
+// Seconds a single refresh may run before it is abandoned with DeadlineExceededError. 0 means no limit.
+constexpr SettingKey<int32_t> REFRESH_DEADLINE_SETTING{ "refresh_deadline" };
+const int32_t DEFAULT_REFRESH_DEADLINE = 300;
+
+// Outcome of a finished refresh.
+struct RefreshResult
+{
+  GameID id;
+  // Whether the master lists were fetched and vanished servers removed.
+  bool full;
+  // Servers that answered.
+  size_t servers;
+};
+
+// Servers received so far by a running query. An expected count of 0 means it is not known.
+struct QueryProgress
+{
+  size_t received;
+  size_t expected;
+};
+
 typedef std::map<SettingGroup, ConfStorage> GameSettings;
-typedef std::function<bool(std::pair<Glib::ustring, Server>)> ServerCompareFunc;
+typedef std::function<bool(const std::pair<Glib::ustring, Server>&)> ServerCompareFunc;
+
+// Immutable, reference counted view of a game's servers. The generation is bumped on every publish.
+struct ServerSnapshot
+{
+  std::shared_ptr<const ServerStore> data;
+  uint64_t generation;
+};
+
+// Rows of a snapshot that matched a query. Holding the selection keeps the snapshot alive.
+struct ServerSelection
+{
+  ServerSnapshot snapshot;
+  std::vector<ServerStore::Row> rows;
+};
+
+// One page of a ServerQuery. The total is only filled in when the query asked for it.
+struct ServerPage
+{
+  ServerSnapshot snapshot;
+  std::vector<ServerStore::Row> rows;
+  size_t total;
+};
+
+// Hosts touched by a single publish, together with the snapshot they were applied to.
+struct ServerChangeSet
+{
+  ServerSnapshot snapshot;
+  std::vector<Glib::ustring> added;
+  std::vector<Glib::ustring> removed;
+  std::vector<Glib::ustring> updated;
+
+  bool empty() const { return added.empty() && removed.empty() && updated.empty(); }
+};
 
 struct GameEntry
 {
   QueryStatus status;
+  QueryProgress progress;
 
   std::map<SettingGroup, ConfStorage> settings;
-  ServerData servers;
+  std::map<SettingGroup, std::shared_ptr<const SettingsView>> settings_views;
+  std::shared_ptr<const ServerStore> servers;
+  uint64_t servers_generation;
 
   BackendInfoFunc backend_info_func;
 
-  GameEntry() { status = QueryStatus::EMPTY; }
+  GameEntry()
+  {
+    status = QueryStatus::EMPTY;
+    progress = QueryProgress{ 0, 0 };
+    auto store = std::make_shared<ServerStore>();
+    store->set_indexed(true);
+    servers = store;
+    servers_generation = 0;
+  }
+};
+
+enum class GameEventType
+{
+  CHANGED,
+  STATUS_CHANGED,
+  SETTINGS_CHANGED,
+  SERVERS_CHANGED,
+  PROGRESS_CHANGED
+};
+
+// A notification about one game. The status members are set for STATUS_CHANGED, the change set for SERVERS_CHANGED
+// and the progress for PROGRESS_CHANGED.
+struct GameEvent
+{
+  GameEventType type;
+  GameID id;
+  QueryStatus status;
+  QueryStatus old_status;
+  ServerChangeSet changes;
+  QueryProgress progress;
 };
 
 const char* const name_setting = "name";
 
+class GameTable;
+
+// Mutations of one game applied under a single acquisition of its lock.
+// Notifications are recorded rather than emitted; the table queues them once, coalesced, and dispatches them after the lock is released.
+class GameTransaction
+{
+private:
+  friend class GameTable;
+
+  GameEntry& entry;
+  std::set<SettingGroup> dirty_views;
+  bool entry_changed = false;
+  bool settings_changed = false;
+  std::experimental::optional<QueryStatus> old_status;
+  QueryStatus status;
+  bool progress_changed = false;
+  bool servers_published = false;
+  ServerChangeSet server_changes;
+
+  void finish();
+  void publish_servers(std::shared_ptr<const ServerStore>, ServerChangeSet);
+
+  explicit GameTransaction(GameEntry& e) : entry(e) {}
+
+public:
+  void set_backend(BackendInfoFunc);
+  void set_query_status(QueryStatus);
+  void set_query_progress(size_t, size_t);
+
+  void create_setting(Glib::VariantType, SettingGroup, Glib::ustring);
+  void set_setting_metadata(SettingGroup, Glib::ustring, Json::Value);
+  template <typename T>
+  void set_setting(SettingGroup g, Glib::ustring k, T v, bool upsert = false)
+  {
+    this->set_setting_value(g, k, Glib::Variant<T>::create(v), upsert);
+  }
+  void set_setting_value(SettingGroup, Glib::ustring, Glib::VariantBase, bool = false);
+  void remove_setting(SettingGroup, Glib::ustring);
+
+  void set_server_indexing(bool);
+
+  GameTransaction(const GameTransaction&) = delete;
+};
+
 class GameTable
 {
 private:
-  mutable std::mutex m;
-  std::map<Glib::ustring, GameEntry> data;
+  // Every game is guarded by its own mutex so that work on one game never waits for another.
+  // The table-wide lock only protects the layout of the map and is held just long enough to look up a slot.
+  struct GameSlot
+  {
+    mutable std::mutex m;
+    GameEntry entry;
+  };
+
+  mutable std::shared_timed_mutex m;
+  std::map<Glib::ustring, std::shared_ptr<GameSlot>> data;
 
   bool game_exists(GameID);
-  void modify_game_entry(GameID, std::function<void(GameEntry&)>);
+  std::shared_ptr<GameSlot> get_slot(GameID) const;
+  std::vector<std::pair<GameID, std::shared_ptr<GameSlot>>> get_slots() const;
   void modify_game_entry(GameID, std::function<void(const GameEntry&)>) const;
+  void update_servers(GameID, std::function<std::shared_ptr<const ServerStore>(const ServerStore&, ServerChangeSet&)>, std::function<void(GameTransaction&)> = nullptr);
+  void queue_events(GameID, const GameTransaction&);
 
 public:
+  // Every notification goes through the bus. The signals below are fed by an inline subscriber and kept for existing users.
+  EventBus<GameEvent> events;
+
   boost::signals2::signal<void(GameID)> changed;
   boost::signals2::signal<void(GameID, QueryStatus, QueryStatus)> status_changed;
   boost::signals2::signal<void(GameID)> settings_changed;
-  boost::signals2::signal<void(GameID, ServerData)> servers_changed;
+  boost::signals2::signal<void(GameID, const ServerChangeSet&)> servers_changed;
+  boost::signals2::signal<void(GameID, QueryProgress)> progress_changed;
+  // Emitted when one of the signals above throws; the writer that dispatched the event carries on.
+  boost::signals2::signal<void(GameID, std::exception_ptr)> listener_failed;
+
+  // Runs the callback under the game's lock. Events are dispatched once the lock is released, even if the callback throws.
+  void transaction(GameID, std::function<void(GameTransaction&)>);
 
   void create_game_entry(GameID);
   void remove_game_entry(GameID);
@@ -98,6 +273,9 @@ public:
   void set_query_status(GameID, QueryStatus);
   QueryStatus get_query_status(GameID) const;
 
+  void set_query_progress(GameID, size_t, size_t);
+  QueryProgress get_query_progress(GameID) const;
+
   std::vector<Glib::ustring> get_setting_keys(GameID, SettingGroup) const;
   void create_setting(GameID, Glib::VariantType, SettingGroup, Glib::ustring);
 
@@ -112,41 +290,99 @@ public:
   std::map<GameID, ConfigValue> get_setting_map(SettingGroup, Glib::ustring) const;
 
   ConfStorage get_settings(GameID, SettingGroup) const;
+  std::shared_ptr<const SettingsView> get_settings_view(GameID, SettingGroup) const;
   void remove_setting(GameID, SettingGroup, Glib::ustring);
 
-  void insert_servers(GameID, ServerData, bool = false);
+  // The optional callback runs under the same lock as the publish, e.g. to mark a refresh as finished.
+  void insert_servers(GameID, ServerData, bool = false, std::function<void(GameTransaction&)> = nullptr);
+  ServerSnapshot get_server_snapshot(GameID) const;
   ServerData get_servers(GameID, ServerCompareFunc = nullptr) const;
   Server get_server_info_by_host(GameID, Glib::ustring) const;
+  void set_server_indexing(GameID, bool);
+  ServerSelection select_servers(GameID, const ServerFilter&) const;
+  ServerPage query_servers(GameID, const ServerQuery&) const;
   ServerData remove_servers(GameID, ServerCompareFunc = nullptr);
+  ServerData remove_servers(GameID, const ServerFilter&);
+  // Removes every server whose host is not in the set.
+  void retain_servers(GameID, const std::unordered_set<std::string>&, std::function<void(GameTransaction&)> = nullptr);
+  // Adds or updates the given servers and, if a set of hosts is given, removes every server not in it, all in a single publish.
+  void merge_servers(GameID, ServerData, const std::unordered_set<std::string>* = nullptr, std::function<void(GameTransaction&)> = nullptr);
+  // Puts the given hosts back the way they are in the base store, e.g. a snapshot taken before a refresh: rows are reset to their
+  // base values and hosts the base does not hold are removed. Other hosts are left alone. All in a single publish.
+  void restore_servers(GameID, const ServerStore&, const std::unordered_set<std::string>&, std::function<void(GameTransaction&)> = nullptr);
+
+  GameTable();
+  GameTable(const GameTable&) = delete;
 };
 
 class Core
 {
 private:
   mutable std::mutex m;
+  std::shared_ptr<TaskPool> task_pool;
   std::shared_ptr<ThreadPool> pool;
   std::shared_ptr<Geoip::Geodata> geocoder;
-  std::function<void(std::function<void()>)> async_cb;
+  TaskDispatchFunc async_cb;
   std::map<std::string, BackendInfoFunc> backend_map;
+  std::map<GameID, std::chrono::steady_clock::time_point> last_full_refresh;
+  // Per backend name, see set_backend_concurrency.
+  std::map<std::string, size_t> backend_concurrency;
+  std::map<std::string, std::shared_ptr<TaskLimiter>> limiters;
+  // Refreshes in flight, so that asking for one again joins it.
+  std::map<GameID, Future<RefreshResult>> running_refreshes;
+
+  void use_task_pool(std::shared_ptr<TaskPool> p)
+  {
+    this->task_pool = p ? p : default_task_pool();
+    this->async_cb = [this](Task fn, TaskPriority priority) { this->task_pool->post(std::move(fn), priority); };
+  }
+  void geocode(ServerData&) const;
+  QueryScope get_refresh_scope(GameID, RefreshMode);
+  std::shared_ptr<TaskLimiter> get_limiter(const Backend&);
+  Future<RefreshResult> run_query(GameID, QueryScope, bool, std::function<void(const std::exception&)>, boost::signals2::signal<void()>*, TaskPriority);
 
 public:
   std::function<void(std::vector<std::string>, std::string)> logger;
   std::shared_ptr<GameTable> game_table;
   boost::signals2::signal<void(GameID)> refresh_started;
   boost::signals2::signal<void(GameID)> refresh_complete;
-  void refresh_servers(GameID, bool = true, std::function<void(const std::exception&)> = nullptr, boost::signals2::signal<void()>* = nullptr );
+  void refresh_servers(GameID, bool = true, std::function<void(const std::exception&)> = nullptr, boost::signals2::signal<void()>* = nullptr,
+                       RefreshMode = RefreshMode::AUTO, TaskPriority = TaskPriority::BACKGROUND);
+  // Queries the given hosts again, e.g. the visible rows or favorites, and merges the answers without removing anything.
+  void refresh_hosts(GameID, std::vector<std::string>, bool = true, std::function<void(const std::exception&)> = nullptr,
+                     TaskPriority = TaskPriority::BACKGROUND);
   void read_game_lists(Json::Value);
 
-  Core(std::shared_ptr<ThreadPool> p = nullptr)
+  // Starts a refresh on the task pool and returns its outcome. If the game is already being refreshed, that refresh is joined
+  // instead. Cancelling the future stops the backend within milliseconds, including its qstat process and sockets, takes back the
+  // servers it had already published and leaves the game in the ERROR state. The game's REFRESH_DEADLINE_SETTING bounds how long
+  // the refresh may run; passing it ends the refresh the same way, as does any error the backend throws.
+  Future<RefreshResult> refresh(GameID, RefreshMode = RefreshMode::AUTO, TaskPriority = TaskPriority::BACKGROUND);
+  // Like refresh_hosts, but asynchronous in the same way as refresh.
+  Future<RefreshResult> requery_hosts(GameID, std::vector<std::string>, TaskPriority = TaskPriority::BACKGROUND);
+  // Runs the query against the game's current snapshot on the task pool.
+  Future<ServerPage> query(GameID, ServerQuery, TaskPriority = TaskPriority::USER);
+
+  // Overrides Backend::concurrency for the backend with the given name. 0 lifts the limit.
+  void set_backend_concurrency(const std::string&, size_t);
+  size_t get_backend_concurrency(const Backend&) const;
+
+  // Asynchronous refreshes run on the shared default_task_pool.
+  Core() { this->use_task_pool(nullptr); }
+  explicit Core(std::shared_ptr<TaskPool> p) { this->use_task_pool(p); }
+  // Adapter for callers still handing in a ThreadPool. The pool has a single queue, so priorities are ignored.
+  Core(std::shared_ptr<ThreadPool> p)
   {
     if (!p)
     {
-      this->async_cb = [](std::function<void()> fn) { std::thread(fn).detach(); };
-    }
-    else
-    {
-      this->async_cb = [this](std::function<void()> fn) { this->pool->enqueue(fn); };
+      this->use_task_pool(nullptr);
+      return;
     }
+    this->pool = p;
+    this->async_cb = [this](Task fn, TaskPriority) {
+      auto task = std::make_shared<Task>(std::move(fn));
+      this->pool->enqueue([task]() { (*task)(); });
+    };
   }
   Core(const Core&) = delete;
 };
@@ -0,0 +1,214 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "endpoint.hpp"
+
+#include "exceptions.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+
+namespace Obozrenie
+{
+namespace
+{
+// Splits "host:port", "[v6]:port", "[v6]" or a bare address into its parts.
+void
+split_host_port(const std::string& v, std::string& host, std::string& port)
+{
+  if (!v.empty() && v[0] == '[')
+  {
+    auto close = v.find(']');
+    if (close == std::string::npos)
+    {
+      throw InvalidEndpointError(v);
+    }
+    host = v.substr(1, close - 1);
+    if (close + 1 < v.size())
+    {
+      if (v[close + 1] != ':')
+      {
+        throw InvalidEndpointError(v);
+      }
+      port = v.substr(close + 2);
+    }
+    return;
+  }
+
+  auto colon = v.rfind(':');
+  if (colon == std::string::npos || v.find(':') != colon)
+  {
+    // No port, or an unbracketed IPv6 address.
+    host = v;
+    return;
+  }
+  host = v.substr(0, colon);
+  port = v.substr(colon + 1);
+}
+
+uint16_t
+parse_port(const std::string& v, uint16_t default_port)
+{
+  if (v.empty())
+  {
+    return default_port;
+  }
+
+  char* end = nullptr;
+  auto n = std::strtoul(v.c_str(), &end, 10);
+  if (*end != '\0' || n == 0 || n > 65535)
+  {
+    throw InvalidEndpointError("bad port " + v);
+  }
+  return uint16_t(n);
+}
+}
+
+std::string
+Endpoint::str() const
+{
+  char buf[INET6_ADDRSTRLEN];
+  switch (this->family)
+  {
+  case Family::V4:
+    inet_ntop(AF_INET, this->address.data(), buf, sizeof(buf));
+    return std::string(buf) + ":" + std::to_string(this->port);
+  case Family::V6:
+    inet_ntop(AF_INET6, this->address.data(), buf, sizeof(buf));
+    return "[" + std::string(buf) + "]:" + std::to_string(this->port);
+  default:
+    return std::string();
+  }
+}
+
+socklen_t
+Endpoint::to_sockaddr(sockaddr_storage& v) const
+{
+  std::memset(&v, 0, sizeof(v));
+  if (this->family == Family::V4)
+  {
+    auto& a = reinterpret_cast<sockaddr_in&>(v);
+    a.sin_family = AF_INET;
+    a.sin_port = htons(this->port);
+    std::memcpy(&a.sin_addr, this->address.data(), 4);
+    return sizeof(sockaddr_in);
+  }
+  if (this->family == Family::V6)
+  {
+    auto& a = reinterpret_cast<sockaddr_in6&>(v);
+    a.sin6_family = AF_INET6;
+    a.sin6_port = htons(this->port);
+    std::memcpy(&a.sin6_addr, this->address.data(), 16);
+    return sizeof(sockaddr_in6);
+  }
+  throw InvalidEndpointError("empty endpoint");
+}
+
+Endpoint
+Endpoint::from_sockaddr(const sockaddr* v, socklen_t len)
+{
+  Endpoint e;
+  if (v->sa_family == AF_INET && len >= socklen_t(sizeof(sockaddr_in)))
+  {
+    auto a = reinterpret_cast<const sockaddr_in*>(v);
+    e.family = Family::V4;
+    e.port = ntohs(a->sin_port);
+    std::memcpy(e.address.data(), &a->sin_addr, 4);
+  }
+  else if (v->sa_family == AF_INET6 && len >= socklen_t(sizeof(sockaddr_in6)))
+  {
+    auto a = reinterpret_cast<const sockaddr_in6*>(v);
+    e.family = Family::V6;
+    e.port = ntohs(a->sin6_port);
+    std::memcpy(e.address.data(), &a->sin6_addr, 16);
+  }
+  else
+  {
+    throw InvalidEndpointError("unsupported address family");
+  }
+  return e;
+}
+
+Endpoint
+Endpoint::parse(const std::string& v, uint16_t default_port)
+{
+  std::string host;
+  std::string port;
+  split_host_port(v, host, port);
+
+  Endpoint e;
+  e.port = parse_port(port, default_port);
+  if (inet_pton(AF_INET, host.c_str(), e.address.data()) == 1)
+  {
+    e.family = Family::V4;
+  }
+  else if (inet_pton(AF_INET6, host.c_str(), e.address.data()) == 1)
+  {
+    e.family = Family::V6;
+  }
+  else
+  {
+    throw InvalidEndpointError(v);
+  }
+  return e;
+}
+
+std::vector<Endpoint>
+Endpoint::resolve(const std::string& v, uint16_t default_port)
+{
+  try
+  {
+    return std::vector<Endpoint>{ Endpoint::parse(v, default_port) };
+  }
+  catch (const InvalidEndpointError&)
+  {
+  }
+
+  std::string host;
+  std::string port;
+  split_host_port(v, host, port);
+  auto port_number = parse_port(port, default_port);
+
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  addrinfo* res = nullptr;
+  auto rc = getaddrinfo(host.c_str(), nullptr, &hints, &res);
+  if (rc != 0)
+  {
+    throw InvalidEndpointError(v + " : " + gai_strerror(rc));
+  }
+  std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> guard(res, freeaddrinfo);
+
+  std::vector<Endpoint> endpoints;
+  for (auto ai = res; ai; ai = ai->ai_next)
+  {
+    auto e = Endpoint::from_sockaddr(ai->ai_addr, ai->ai_addrlen);
+    e.port = port_number;
+    endpoints.push_back(e);
+  }
+  return endpoints;
+}
+}
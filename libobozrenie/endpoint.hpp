@@ -0,0 +1,114 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _ENDPOINT_HPP_
+#define _ENDPOINT_HPP_
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+namespace Obozrenie
+{
+// IPv4 or IPv6 address with a port, packed into 20 bytes so that large host lists stay cheap to copy, hash and compare.
+// IPv4 addresses occupy the first four bytes of the address.
+struct Endpoint
+{
+  enum class Family : uint8_t
+  {
+    NONE,
+    V4,
+    V6
+  };
+
+  std::array<uint8_t, 16> address;
+  uint16_t port;
+  Family family;
+
+  // "1.2.3.4:27960" or "[::1]:27960", the form used for host keys.
+  std::string str() const;
+  socklen_t to_sockaddr(sockaddr_storage&) const;
+
+  static Endpoint from_sockaddr(const sockaddr*, socklen_t);
+  // Parses a numeric address with an optional port. Throws InvalidEndpointError.
+  static Endpoint parse(const std::string&, uint16_t);
+  // Like parse, but falls back to a DNS lookup for host names.
+  static std::vector<Endpoint> resolve(const std::string&, uint16_t);
+
+  Endpoint() : address{}, port(0), family(Family::NONE) {}
+};
+static_assert(sizeof(Endpoint) == 20, "Endpoint is expected to stay packed");
+
+inline bool
+operator==(const Endpoint& a, const Endpoint& b)
+{
+  return a.family == b.family && a.port == b.port && a.address == b.address;
+}
+
+inline bool
+operator!=(const Endpoint& a, const Endpoint& b)
+{
+  return !(a == b);
+}
+
+inline bool
+operator<(const Endpoint& a, const Endpoint& b)
+{
+  if (a.family != b.family)
+  {
+    return a.family < b.family;
+  }
+  if (a.address != b.address)
+  {
+    return a.address < b.address;
+  }
+  return a.port < b.port;
+}
+}
+
+namespace std
+{
+template <>
+struct hash<Obozrenie::Endpoint>
+{
+  size_t operator()(const Obozrenie::Endpoint& v) const
+  {
+    // FNV-1a over the significant bytes.
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&h](uint8_t b) {
+      h ^= b;
+      h *= 1099511628211ull;
+    };
+    auto len = v.family == Obozrenie::Endpoint::Family::V4 ? 4 : 16;
+    for (int i = 0; i < len; i++)
+    {
+      mix(v.address[i]);
+    }
+    mix(uint8_t(v.port >> 8));
+    mix(uint8_t(v.port));
+    mix(uint8_t(v.family));
+    return size_t(h);
+  }
+};
+}
+
+#endif
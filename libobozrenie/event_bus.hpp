@@ -0,0 +1,191 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _EVENT_BUS_HPP_
+#define _EVENT_BUS_HPP_
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Obozrenie
+{
+// Runs a task somewhere: on a thread pool, on the GUI main loop or, if empty, right away on the calling thread.
+typedef std::function<void(std::function<void()>)> Executor;
+
+// Multi-producer event queue with subscriber fan-out.
+// Publishing is a lock-free push, so it is safe under any lock. Events are handed to subscribers by dispatch(),
+// which callers run after releasing their locks. Each subscriber receives events in publishing order through its own executor.
+template <typename Event>
+class EventBus
+{
+public:
+  // Told about an exception thrown by an inline subscriber, together with the event it was handling.
+  typedef std::function<void(const Event&, std::exception_ptr)> ErrorHandler;
+
+private:
+  struct Node
+  {
+    std::shared_ptr<const Event> value;
+    Node* next;
+  };
+
+  struct Subscriber
+  {
+    size_t id;
+    std::function<void(const Event&)> f;
+    Executor executor;
+    ErrorHandler on_error;
+  };
+
+  std::atomic<Node*> head;
+  // Held by the thread delivering this bus's events. A subscriber that publishes to this bus and dispatches it again
+  // finds it held and returns; the outer dispatch() picks the new events up. Other buses are not affected.
+  std::atomic<bool> draining;
+
+  mutable std::mutex subscribers_mutex;
+  std::shared_ptr<const std::vector<Subscriber>> subscribers;
+  size_t next_id;
+
+  // Detaches everything queued so far and returns it oldest first.
+  Node* take_all()
+  {
+    auto n = this->head.exchange(nullptr);
+    Node* reversed = nullptr;
+    while (n)
+    {
+      auto next = n->next;
+      n->next = reversed;
+      reversed = n;
+      n = next;
+    }
+    return reversed;
+  }
+
+  void deliver(Node* n)
+  {
+    std::shared_ptr<const std::vector<Subscriber>> subs;
+    {
+      std::lock_guard<std::mutex> lock(this->subscribers_mutex);
+      subs = this->subscribers;
+    }
+
+    while (n)
+    {
+      for (const auto& s : *subs)
+      {
+        try
+        {
+          if (s.executor)
+          {
+            auto f = s.f;
+            auto v = n->value;
+            s.executor([f, v]() { f(*v); });
+          }
+          else
+          {
+            s.f(*n->value);
+          }
+        }
+        catch (...)
+        {
+          if (s.on_error)
+          {
+            try
+            {
+              s.on_error(*n->value, std::current_exception());
+            }
+            catch (...)
+            {
+            }
+          }
+        }
+      }
+      auto next = n->next;
+      delete n;
+      n = next;
+    }
+  }
+
+public:
+  void publish(Event v)
+  {
+    auto n = new Node{ std::make_shared<const Event>(std::move(v)), this->head.load() };
+    while (!this->head.compare_exchange_weak(n->next, n))
+    {
+    }
+  }
+
+  // Delivers queued events. If another thread, or an outer call on this thread, is already delivering, it picks up these events
+  // as well. Exceptions thrown by inline subscribers go to their own error handlers and never reach the caller.
+  void dispatch()
+  {
+    while (this->head.load() && !this->draining.exchange(true))
+    {
+      this->deliver(this->take_all());
+      this->draining = false;
+    }
+  }
+
+  // An inline subscriber's exceptions are passed to on_error if given and dropped otherwise.
+  size_t subscribe(std::function<void(const Event&)> f, Executor executor = nullptr, ErrorHandler on_error = nullptr)
+  {
+    std::lock_guard<std::mutex> lock(this->subscribers_mutex);
+
+    auto next = std::make_shared<std::vector<Subscriber>>(*this->subscribers);
+    auto id = this->next_id++;
+    next->push_back(Subscriber{ id, f, executor, on_error });
+    this->subscribers = next;
+
+    return id;
+  }
+
+  void unsubscribe(size_t id)
+  {
+    std::lock_guard<std::mutex> lock(this->subscribers_mutex);
+
+    auto next = std::make_shared<std::vector<Subscriber>>();
+    for (const auto& s : *this->subscribers)
+    {
+      if (s.id != id)
+      {
+        next->push_back(s);
+      }
+    }
+    this->subscribers = next;
+  }
+
+  EventBus() : head(nullptr), draining(false), subscribers(std::make_shared<std::vector<Subscriber>>()), next_id(0) {}
+  EventBus(const EventBus&) = delete;
+  ~EventBus()
+  {
+    auto n = this->head.load();
+    while (n)
+    {
+      auto next = n->next;
+      delete n;
+      n = next;
+    }
+  }
+};
+}
+
+#endif
@@ -50,5 +50,10 @@ DEFINE_EXCEPTION(InvalidConfStorageError, "Invalid settings storage");
 DEFINE_EXCEPTION(InvalidSettingKeyError, "Invalid setting key");
 DEFINE_EXCEPTION(SettingTypeMismatchError, "Setting type mismatch");
 DEFINE_EXCEPTION(BackendError, "Backend error");
+DEFINE_EXCEPTION(SocketError, "Socket error");
+DEFINE_EXCEPTION(InvalidEndpointError, "Invalid network endpoint");
+DEFINE_EXCEPTION(HttpError, "HTTP request failed");
+DEFINE_EXCEPTION(CancelledError, "Operation cancelled");
+DEFINE_EXCEPTION(DeadlineExceededError, "Deadline exceeded");
 }
 #endif
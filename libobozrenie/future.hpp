@@ -0,0 +1,335 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef _FUTURE_HPP_
+#define _FUTURE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <experimental/optional>
+
+#include "cancellation.hpp"
+#include "event_bus.hpp"
+
+namespace Obozrenie
+{
+template <typename T>
+class Future;
+template <typename T>
+class Promise;
+
+namespace detail
+{
+template <typename T>
+struct FutureStorage
+{
+  std::experimental::optional<T> value;
+
+  template <typename... A>
+  void emplace(A&&... v)
+  {
+    this->value.emplace(std::forward<A>(v)...);
+  }
+  const T& get() const { return *this->value; }
+};
+
+template <>
+struct FutureStorage<void>
+{
+  void emplace() {}
+  void get() const {}
+};
+
+// Result slot shared by a promise and its futures. Continuations run on the thread that completes it, after the lock is released.
+template <typename T>
+struct FutureState : FutureStorage<T>
+{
+  std::mutex m;
+  std::condition_variable cv;
+  bool ready = false;
+  std::exception_ptr error;
+  std::vector<std::function<void()>> continuations;
+  CancellationToken token;
+  std::function<void()> on_cancel;
+
+  void finish(std::unique_lock<std::mutex>& lock)
+  {
+    this->ready = true;
+    auto cs = std::move(this->continuations);
+    this->continuations.clear();
+    lock.unlock();
+    this->cv.notify_all();
+    for (auto& c : cs)
+    {
+      c();
+    }
+  }
+
+  void on_ready(std::function<void()> f)
+  {
+    std::unique_lock<std::mutex> lock(this->m);
+    if (!this->ready)
+    {
+      this->continuations.push_back(std::move(f));
+      return;
+    }
+    lock.unlock();
+    f();
+  }
+
+  void cancel()
+  {
+    this->token.cancel();
+    std::function<void()> hook;
+    {
+      std::lock_guard<std::mutex> lock(this->m);
+      if (this->ready)
+      {
+        return;
+      }
+      hook = this->on_cancel;
+    }
+    if (hook)
+    {
+      hook();
+    }
+  }
+};
+
+template <typename R, typename F, typename T>
+void
+fulfil(const Promise<R>& p, F& f, const Future<T>& v, std::false_type)
+{
+  p.set_value(f(v));
+}
+
+template <typename R, typename F, typename T>
+void
+fulfil(const Promise<R>& p, F& f, const Future<T>& v, std::true_type)
+{
+  f(v);
+  p.set_value();
+}
+}
+
+// Result of an asynchronous operation. Copies share the result, which may be read any number of times.
+template <typename T>
+class Future
+{
+private:
+  template <typename>
+  friend class Future;
+  template <typename>
+  friend class Promise;
+  template <typename U>
+  friend Future<std::vector<Future<U>>> when_all(std::vector<Future<U>>);
+
+  std::shared_ptr<detail::FutureState<T>> state;
+
+  explicit Future(std::shared_ptr<detail::FutureState<T>> s) : state(std::move(s)) {}
+
+public:
+  bool valid() const { return bool(this->state); }
+
+  bool is_ready() const
+  {
+    std::lock_guard<std::mutex> lock(this->state->m);
+    return this->state->ready;
+  }
+
+  void wait() const
+  {
+    std::unique_lock<std::mutex> lock(this->state->m);
+    this->state->cv.wait(lock, [this]() { return this->state->ready; });
+  }
+
+  template <typename Rep, typename Period>
+  bool wait_for(const std::chrono::duration<Rep, Period>& d) const
+  {
+    std::unique_lock<std::mutex> lock(this->state->m);
+    return this->state->cv.wait_for(lock, d, [this]() { return this->state->ready; });
+  }
+
+  // Blocks until the result is there, then returns it or rethrows the error.
+  decltype(auto) get() const
+  {
+    this->wait();
+    if (this->state->error)
+    {
+      std::rethrow_exception(this->state->error);
+    }
+    return this->state->get();
+  }
+
+  // Asks the operation behind the future to stop. It finishes with CancelledError unless it completes first.
+  void cancel() const { this->state->cancel(); }
+  CancellationToken token() const { return this->state->token; }
+
+  // Calls the function with this future once it is ready, through the executor or, if that is empty, on the thread that
+  // completes it. The returned future holds the function's result or exception and shares this future's cancellation.
+  template <typename F>
+  Future<typename std::result_of<F(Future<T>)>::type> then(F f, Executor executor = nullptr) const
+  {
+    typedef typename std::result_of<F(Future<T>)>::type R;
+    auto upstream = this->state;
+    Promise<R> p(upstream->token, [upstream]() { upstream->cancel(); });
+    auto self = *this;
+    std::function<void()> run = [p, f, self]() mutable {
+      try
+      {
+        detail::fulfil(p, f, self, std::is_void<R>());
+      }
+      catch (...)
+      {
+        p.set_exception(std::current_exception());
+      }
+    };
+    if (executor)
+    {
+      upstream->on_ready([executor, run]() { executor(run); });
+    }
+    else
+    {
+      upstream->on_ready(run);
+    }
+    return p.get_future();
+  }
+
+  friend bool operator==(const Future& a, const Future& b) { return a.state == b.state; }
+  friend bool operator!=(const Future& a, const Future& b) { return a.state != b.state; }
+
+  Future() {}
+};
+
+// Write end of a Future. Copies share the result; once the last copy is gone without a result, waiters get a broken promise error.
+template <typename T>
+class Promise
+{
+private:
+  std::shared_ptr<detail::FutureState<T>> state;
+  std::shared_ptr<void> guard;
+
+  template <typename F>
+  void complete(F&& f) const
+  {
+    std::unique_lock<std::mutex> lock(this->state->m);
+    if (this->state->ready)
+    {
+      throw std::future_error(std::future_errc::promise_already_satisfied);
+    }
+    f();
+    this->state->finish(lock);
+  }
+
+public:
+  Future<T> get_future() const { return Future<T>(this->state); }
+  // Cancellation requested through any of the futures. Work should poll it.
+  const CancellationToken& token() const { return this->state->token; }
+
+  template <typename... A>
+  void set_value(A&&... v) const
+  {
+    this->complete([&]() { this->state->emplace(std::forward<A>(v)...); });
+  }
+
+  void set_exception(std::exception_ptr e) const
+  {
+    this->complete([&]() { this->state->error = e; });
+  }
+
+  // The token is shared with the futures; the hook runs when one of them is cancelled before the result is set.
+  explicit Promise(CancellationToken token = CancellationToken(), std::function<void()> on_cancel = nullptr)
+    : state(std::make_shared<detail::FutureState<T>>())
+  {
+    this->state->token = token;
+    this->state->on_cancel = std::move(on_cancel);
+    auto s = this->state;
+    this->guard = std::shared_ptr<void>(nullptr, [s](void*) {
+      std::unique_lock<std::mutex> lock(s->m);
+      if (!s->ready)
+      {
+        s->error = std::make_exception_ptr(std::future_error(std::future_errc::broken_promise));
+        s->finish(lock);
+      }
+    });
+  }
+};
+
+template <typename T>
+Future<T>
+make_ready_future(T v)
+{
+  Promise<T> p;
+  p.set_value(std::move(v));
+  return p.get_future();
+}
+
+template <typename T>
+Future<T>
+make_exceptional_future(std::exception_ptr e)
+{
+  Promise<T> p;
+  p.set_exception(e);
+  return p.get_future();
+}
+
+// Becomes ready once every future is. The futures are handed back in order and read individually, so one failure does not hide
+// the other results. Cancelling the combined future cancels all of them.
+template <typename T>
+Future<std::vector<Future<T>>>
+when_all(std::vector<Future<T>> fs)
+{
+  auto all = std::make_shared<const std::vector<Future<T>>>(std::move(fs));
+  Promise<std::vector<Future<T>>> p(CancellationToken(), [all]() {
+    for (const auto& f : *all)
+    {
+      f.cancel();
+    }
+  });
+  if (all->empty())
+  {
+    p.set_value(*all);
+    return p.get_future();
+  }
+
+  auto remaining = std::make_shared<std::atomic<size_t>>(all->size());
+  for (const auto& f : *all)
+  {
+    f.state->on_ready([p, all, remaining]() {
+      if (remaining->fetch_sub(1) == 1)
+      {
+        p.set_value(*all);
+      }
+    });
+  }
+  return p.get_future();
+}
+}
+
+#endif
@@ -42,14 +42,15 @@ Geodata::~Geodata()
 std::string
 Geodata::country_code_by_addr(std::string addr) const
 {
-  std::lock_guard<std::mutex> lock(this->m);
-  return GeoIP_country_code_by_addr(this->data, addr.c_str());
+  auto v = GeoIP_country_code_by_addr(this->data, addr.c_str());
+  return v ? v : "";
 }
 
 std::string
 Geodata::country_code_by_name(std::string name) const
 {
   std::lock_guard<std::mutex> lock(this->m);
-  return GeoIP_country_code_by_name(this->data, name.c_str());
+  auto v = GeoIP_country_code_by_name(this->data, name.c_str());
+  return v ? v : "";
 }
 }
@@ -54,7 +54,9 @@ private:
 
 public:
   std::string filename() { return this->_filename; }
+  // Lookups of numeric addresses only read the in-memory database and may run concurrently.
   std::string country_code_by_addr(std::string) const;
+  // Host names go through the resolver and are serialized.
   std::string country_code_by_name(std::string) const;
 
   Geodata(std::string);
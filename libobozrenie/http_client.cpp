@@ -0,0 +1,550 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "http_client.hpp"
+
+#include "endpoint.hpp"
+#include "exceptions.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace Obozrenie
+{
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+const uint16_t HTTP_DEFAULT_PORT = 80;
+const int MAX_REDIRECTS = 3;
+const size_t MAX_HEADER_SIZE = 64 * 1024;
+const size_t MAX_LINE_SIZE = 4096;
+const size_t READ_BUFFER_SIZE = 64 * 1024;
+
+struct Url
+{
+  std::string authority;
+  std::string path;
+};
+
+Url
+parse_url(const std::string& v)
+{
+  const std::string scheme = "http://";
+  if (v.compare(0, scheme.size(), scheme) != 0)
+  {
+    throw HttpError("unsupported URL " + v);
+  }
+
+  auto rest = v.substr(scheme.size(), v.find('#') - scheme.size());
+  auto slash = rest.find_first_of("/?");
+
+  Url url;
+  url.authority = rest.substr(0, slash);
+  url.path = slash == std::string::npos ? "/" : rest.substr(slash);
+  if (url.path[0] == '?')
+  {
+    url.path.insert(0, "/");
+  }
+  if (url.authority.empty())
+  {
+    throw HttpError("no host in URL " + v);
+  }
+  return url;
+}
+
+std::string
+resolve_location(const Url& base, const std::string& location)
+{
+  if (location.find("://") != std::string::npos)
+  {
+    return location;
+  }
+  if (!location.empty() && location[0] == '/')
+  {
+    return "http://" + base.authority + location;
+  }
+  return "http://" + base.authority + base.path.substr(0, base.path.rfind('/') + 1) + location;
+}
+
+std::string
+to_lower(std::string v)
+{
+  std::transform(v.begin(), v.end(), v.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+  return v;
+}
+
+std::string
+trim(const std::string& v)
+{
+  auto begin = v.find_first_not_of(" \t\r");
+  if (begin == std::string::npos)
+  {
+    return std::string();
+  }
+  return v.substr(begin, v.find_last_not_of(" \t\r") - begin + 1);
+}
+
+class Connection
+{
+private:
+  int fd;
+  Clock::time_point deadline;
+  const CancellationToken& token;
+  const CancellationFd& cancelled;
+
+  void wait(short events)
+  {
+    for (;;)
+    {
+      this->token.throw_if_cancelled();
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(this->deadline - Clock::now()).count();
+      if (left <= 0)
+      {
+        throw HttpError("timed out");
+      }
+
+      pollfd p[2] = { { this->fd, events, 0 }, { this->cancelled.get(), POLLIN, 0 } };
+      auto rc = poll(p, 2, int(left));
+      if (rc > 0)
+      {
+        if (p[0].revents != 0)
+        {
+          return;
+        }
+        continue;
+      }
+      if (rc < 0 && errno != EINTR)
+      {
+        throw HttpError(std::string("poll: ") + std::strerror(errno));
+      }
+    }
+  }
+
+  bool try_connect(const Endpoint& e)
+  {
+    this->fd = socket(e.family == Endpoint::Family::V6 ? AF_INET6 : AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (this->fd < 0)
+    {
+      return false;
+    }
+
+    sockaddr_storage addr;
+    auto len = e.to_sockaddr(addr);
+    if (connect(this->fd, reinterpret_cast<sockaddr*>(&addr), len) != 0)
+    {
+      if (errno != EINPROGRESS)
+      {
+        return false;
+      }
+      this->wait(POLLOUT);
+
+      int error = 0;
+      socklen_t error_len = sizeof(error);
+      getsockopt(this->fd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+      if (error != 0)
+      {
+        errno = error;
+        return false;
+      }
+    }
+    return true;
+  }
+
+public:
+  void send_all(const std::string& v)
+  {
+    size_t sent = 0;
+    while (sent < v.size())
+    {
+      auto n = send(this->fd, v.data() + sent, v.size() - sent, MSG_NOSIGNAL);
+      if (n >= 0)
+      {
+        sent += size_t(n);
+      }
+      else if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        this->wait(POLLOUT);
+      }
+      else if (errno != EINTR)
+      {
+        throw HttpError(std::string("send: ") + std::strerror(errno));
+      }
+    }
+  }
+
+  // Returns 0 once the server has closed the connection.
+  size_t receive(char* buffer, size_t len)
+  {
+    for (;;)
+    {
+      auto n = recv(this->fd, buffer, len, 0);
+      if (n >= 0)
+      {
+        return size_t(n);
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        this->wait(POLLIN);
+      }
+      else if (errno != EINTR)
+      {
+        throw HttpError(std::string("recv: ") + std::strerror(errno));
+      }
+    }
+  }
+
+  // Tries every address of the host in turn.
+  Connection(const std::string& authority, Clock::time_point d, const CancellationToken& t, const CancellationFd& c)
+    : fd(-1), deadline(d), token(t), cancelled(c)
+  {
+    std::vector<Endpoint> endpoints;
+    try
+    {
+      endpoints = Endpoint::resolve(authority, HTTP_DEFAULT_PORT);
+    }
+    catch (const InvalidEndpointError& e)
+    {
+      throw HttpError(e.what());
+    }
+
+    std::string error = "no address";
+    for (const auto& e : endpoints)
+    {
+      try
+      {
+        if (this->try_connect(e))
+        {
+          return;
+        }
+        error = std::strerror(errno);
+      }
+      catch (...)
+      {
+        close(this->fd);
+        throw;
+      }
+      if (this->fd >= 0)
+      {
+        close(this->fd);
+        this->fd = -1;
+      }
+    }
+    throw HttpError("cannot connect to " + authority + " : " + error);
+  }
+
+  ~Connection()
+  {
+    if (this->fd >= 0)
+    {
+      close(this->fd);
+    }
+  }
+
+  Connection(const Connection&) = delete;
+};
+
+// Incremental HTTP/1.1 response decoder. Body bytes are passed on as soon as their framing is known.
+class ResponseReader
+{
+private:
+  enum class State
+  {
+    HEADERS,
+    BODY_LENGTH,
+    BODY_CLOSE,
+    CHUNK_SIZE,
+    CHUNK_DATA,
+    CHUNK_DATA_END,
+    TRAILER,
+    DONE
+  };
+
+  const HttpBodyFunc& on_body;
+  State state;
+  std::string buffer;
+  size_t remaining;
+
+  void on_headers()
+  {
+    auto line_end = this->buffer.find("\r\n");
+    auto status_line = this->buffer.substr(0, line_end);
+    if (status_line.compare(0, 5, "HTTP/") != 0 || status_line.size() < 12)
+    {
+      throw HttpError("malformed status line");
+    }
+    this->status = std::atoi(status_line.c_str() + status_line.find(' ') + 1);
+
+    bool chunked = false;
+    bool has_length = false;
+    while (line_end != std::string::npos && line_end + 2 < this->buffer.size())
+    {
+      auto begin = line_end + 2;
+      line_end = this->buffer.find("\r\n", begin);
+      auto line = this->buffer.substr(begin, line_end - begin);
+      auto colon = line.find(':');
+      if (colon == std::string::npos)
+      {
+        continue;
+      }
+
+      auto name = to_lower(line.substr(0, colon));
+      auto value = trim(line.substr(colon + 1));
+      if (name == "content-length")
+      {
+        has_length = true;
+        this->remaining = std::strtoull(value.c_str(), nullptr, 10);
+      }
+      else if (name == "transfer-encoding")
+      {
+        chunked = to_lower(value).find("chunked") != std::string::npos;
+      }
+      else if (name == "location")
+      {
+        this->location = value;
+      }
+    }
+    this->buffer.clear();
+
+    if (this->is_redirect())
+    {
+      this->state = State::DONE;
+      return;
+    }
+    if (this->status != 200)
+    {
+      throw HttpError("HTTP status " + std::to_string(this->status));
+    }
+
+    if (chunked)
+    {
+      this->state = State::CHUNK_SIZE;
+    }
+    else if (has_length)
+    {
+      this->state = this->remaining ? State::BODY_LENGTH : State::DONE;
+    }
+    else
+    {
+      this->state = State::BODY_CLOSE;
+    }
+  }
+
+  // Collects a CRLF terminated line of the chunked framing. Returns false while the line is incomplete.
+  bool take_line(const char*& data, size_t& len)
+  {
+    auto nl = static_cast<const char*>(std::memchr(data, '\n', len));
+    auto n = nl ? size_t(nl - data) : len;
+    this->buffer.append(data, n);
+    if (this->buffer.size() > MAX_LINE_SIZE)
+    {
+      throw HttpError("chunk header too long");
+    }
+    if (!nl)
+    {
+      data += len;
+      len = 0;
+      return false;
+    }
+
+    data += n + 1;
+    len -= n + 1;
+    if (!this->buffer.empty() && this->buffer.back() == '\r')
+    {
+      this->buffer.pop_back();
+    }
+    return true;
+  }
+
+  void pass_body(const char*& data, size_t& len, size_t n)
+  {
+    this->on_body(data, n);
+    data += n;
+    len -= n;
+  }
+
+public:
+  int status;
+  std::string location;
+
+  bool is_redirect() const
+  {
+    return (this->status == 301 || this->status == 302 || this->status == 303 || this->status == 307 || this->status == 308) && !this->location.empty();
+  }
+
+  bool done() const { return this->state == State::DONE; }
+
+  void feed(const char* data, size_t len)
+  {
+    while (len > 0 && this->state != State::DONE)
+    {
+      switch (this->state)
+      {
+      case State::HEADERS:
+      {
+        auto old_size = this->buffer.size();
+        this->buffer.append(data, len);
+        auto end = this->buffer.find("\r\n\r\n", old_size < 3 ? 0 : old_size - 3);
+        if (end == std::string::npos)
+        {
+          if (this->buffer.size() > MAX_HEADER_SIZE)
+          {
+            throw HttpError("response headers too long");
+          }
+          return;
+        }
+
+        // Whatever follows the blank line already belongs to the body.
+        auto consumed = end + 4 - old_size;
+        this->buffer.resize(end + 2);
+        data += consumed;
+        len -= consumed;
+        this->on_headers();
+        break;
+      }
+      case State::BODY_LENGTH:
+      {
+        auto n = std::min(len, this->remaining);
+        this->pass_body(data, len, n);
+        this->remaining -= n;
+        if (this->remaining == 0)
+        {
+          this->state = State::DONE;
+        }
+        break;
+      }
+      case State::BODY_CLOSE:
+        this->pass_body(data, len, len);
+        break;
+      case State::CHUNK_SIZE:
+        if (this->take_line(data, len))
+        {
+          char* end = nullptr;
+          this->remaining = std::strtoull(this->buffer.c_str(), &end, 16);
+          if (end == this->buffer.c_str())
+          {
+            throw HttpError("malformed chunk size");
+          }
+          this->buffer.clear();
+          this->state = this->remaining ? State::CHUNK_DATA : State::TRAILER;
+        }
+        break;
+      case State::CHUNK_DATA:
+      {
+        auto n = std::min(len, this->remaining);
+        this->pass_body(data, len, n);
+        this->remaining -= n;
+        if (this->remaining == 0)
+        {
+          this->state = State::CHUNK_DATA_END;
+        }
+        break;
+      }
+      case State::CHUNK_DATA_END:
+        if (this->take_line(data, len))
+        {
+          if (!this->buffer.empty())
+          {
+            throw HttpError("malformed chunk");
+          }
+          this->state = State::CHUNK_SIZE;
+        }
+        break;
+      case State::TRAILER:
+        if (this->take_line(data, len))
+        {
+          if (this->buffer.empty())
+          {
+            this->state = State::DONE;
+          }
+          this->buffer.clear();
+        }
+        break;
+      case State::DONE:
+        break;
+      }
+    }
+  }
+
+  // Called when the server closes the connection.
+  void finish()
+  {
+    if (this->state == State::BODY_CLOSE)
+    {
+      this->state = State::DONE;
+    }
+    if (this->state != State::DONE)
+    {
+      throw HttpError("connection closed before the response was complete");
+    }
+  }
+
+  explicit ResponseReader(const HttpBodyFunc& f) : on_body(f), state(State::HEADERS), remaining(0), status(0) {}
+};
+}
+
+void
+http_get(const std::string& url, const HttpBodyFunc& on_body, std::chrono::milliseconds timeout, const CancellationToken& token)
+{
+  auto deadline = std::min(Clock::now() + timeout, token.deadline());
+  CancellationFd cancelled(token);
+  auto current = url;
+  std::vector<char> buffer(READ_BUFFER_SIZE);
+  for (int redirects = 0;; redirects++)
+  {
+    auto target = parse_url(current);
+    Connection connection(target.authority, deadline, token, cancelled);
+    connection.send_all("GET " + target.path + " HTTP/1.1\r\n"
+                        "Host: " + target.authority + "\r\n"
+                        "User-Agent: Obozrenie\r\n"
+                        "Accept-Encoding: identity\r\n"
+                        "Connection: close\r\n\r\n");
+
+    ResponseReader reader(on_body);
+    while (!reader.done())
+    {
+      auto n = connection.receive(buffer.data(), buffer.size());
+      if (n == 0)
+      {
+        reader.finish();
+        break;
+      }
+      reader.feed(buffer.data(), n);
+    }
+
+    if (!reader.is_redirect())
+    {
+      return;
+    }
+    if (redirects == MAX_REDIRECTS)
+    {
+      throw HttpError("too many redirects");
+    }
+    current = resolve_location(target, reader.location);
+  }
+}
+}
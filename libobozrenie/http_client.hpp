@@ -0,0 +1,38 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _HTTP_CLIENT_HPP_
+#define _HTTP_CLIENT_HPP_
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+#include "cancellation.hpp"
+
+namespace Obozrenie
+{
+typedef std::function<void(const char*, size_t)> HttpBodyFunc;
+
+// Fetches a plain http:// URL and hands the decoded body to the callback as it arrives, so that large responses never sit in memory whole.
+// Follows up to three redirects. The timeout covers the whole exchange and is cut short by the token's deadline.
+// Throws HttpError on failure or a non-200 status; cancelling the token aborts the transfer at once with the token's error.
+void http_get(const std::string&, const HttpBodyFunc&, std::chrono::milliseconds, const CancellationToken& = CancellationToken());
+}
+
+#endif
@@ -0,0 +1,430 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "json_sax.hpp"
+
+#include "exceptions.hpp"
+
+#include <glib.h>
+
+namespace Obozrenie
+{
+namespace
+{
+bool
+is_whitespace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool
+is_number_char(char c)
+{
+  return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+int
+hex_value(char c)
+{
+  if (c >= '0' && c <= '9')
+  {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f')
+  {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F')
+  {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+}
+
+JsonSaxParser::JsonSaxParser(JsonHandler& h)
+  : handler(h), expect(Expect::VALUE), lexer(Lexer::NONE), unicode(0), unicode_digits(0), high_surrogate(0)
+{
+}
+
+void
+JsonSaxParser::append_code_point(uint32_t cp)
+{
+  // A lone surrogate cannot be encoded; it becomes U+FFFD like any other broken sequence.
+  if (cp >= 0xD800 && cp <= 0xDFFF)
+  {
+    cp = 0xFFFD;
+  }
+
+  if (cp < 0x80)
+  {
+    this->token.push_back(char(cp));
+  }
+  else if (cp < 0x800)
+  {
+    this->token.push_back(char(0xC0 | (cp >> 6)));
+    this->token.push_back(char(0x80 | (cp & 0x3F)));
+  }
+  else if (cp < 0x10000)
+  {
+    this->token.push_back(char(0xE0 | (cp >> 12)));
+    this->token.push_back(char(0x80 | ((cp >> 6) & 0x3F)));
+    this->token.push_back(char(0x80 | (cp & 0x3F)));
+  }
+  else
+  {
+    this->token.push_back(char(0xF0 | (cp >> 18)));
+    this->token.push_back(char(0x80 | ((cp >> 12) & 0x3F)));
+    this->token.push_back(char(0x80 | ((cp >> 6) & 0x3F)));
+    this->token.push_back(char(0x80 | (cp & 0x3F)));
+  }
+}
+
+void
+JsonSaxParser::value_done()
+{
+  this->expect = this->stack.empty() ? Expect::NOTHING : Expect::COMMA_OR_END;
+}
+
+void
+JsonSaxParser::on_string()
+{
+  if (this->high_surrogate)
+  {
+    this->append_code_point(this->high_surrogate);
+    this->high_surrogate = 0;
+  }
+
+  if (this->expect == Expect::KEY || this->expect == Expect::KEY_OR_END)
+  {
+    this->handler.key(this->token);
+    this->expect = Expect::COLON;
+  }
+  else
+  {
+    this->handler.string_value(this->token);
+    this->value_done();
+  }
+}
+
+void
+JsonSaxParser::on_number()
+{
+  // JSON numbers always use a dot, whatever LC_NUMERIC the UI has set.
+  char* end = nullptr;
+  auto v = g_ascii_strtod(this->token.c_str(), &end);
+  if (this->token.empty() || *end != '\0')
+  {
+    throw DataParseError("invalid number " + this->token);
+  }
+  this->handler.number_value(v);
+  this->value_done();
+}
+
+void
+JsonSaxParser::on_literal()
+{
+  if (this->token == "true")
+  {
+    this->handler.bool_value(true);
+  }
+  else if (this->token == "false")
+  {
+    this->handler.bool_value(false);
+  }
+  else if (this->token == "null")
+  {
+    this->handler.null_value();
+  }
+  else
+  {
+    throw DataParseError("invalid literal " + this->token);
+  }
+  this->value_done();
+}
+
+void
+JsonSaxParser::on_structural(char c)
+{
+  auto value_expected = this->expect == Expect::VALUE || this->expect == Expect::VALUE_OR_END;
+  switch (c)
+  {
+  case '{':
+    if (!value_expected)
+    {
+      break;
+    }
+    this->handler.start_object();
+    this->stack.push_back(Container::OBJECT);
+    this->expect = Expect::KEY_OR_END;
+    return;
+  case '[':
+    if (!value_expected)
+    {
+      break;
+    }
+    this->handler.start_array();
+    this->stack.push_back(Container::ARRAY);
+    this->expect = Expect::VALUE_OR_END;
+    return;
+  case '}':
+    if (this->stack.empty() || this->stack.back() != Container::OBJECT || (this->expect != Expect::KEY_OR_END && this->expect != Expect::COMMA_OR_END))
+    {
+      break;
+    }
+    this->stack.pop_back();
+    this->handler.end_object();
+    this->value_done();
+    return;
+  case ']':
+    if (this->stack.empty() || this->stack.back() != Container::ARRAY || (this->expect != Expect::VALUE_OR_END && this->expect != Expect::COMMA_OR_END))
+    {
+      break;
+    }
+    this->stack.pop_back();
+    this->handler.end_array();
+    this->value_done();
+    return;
+  case ':':
+    if (this->expect != Expect::COLON)
+    {
+      break;
+    }
+    this->expect = Expect::VALUE;
+    return;
+  case ',':
+    if (this->expect != Expect::COMMA_OR_END)
+    {
+      break;
+    }
+    this->expect = this->stack.back() == Container::OBJECT ? Expect::KEY : Expect::VALUE;
+    return;
+  }
+  throw DataParseError(std::string("unexpected '") + c + "'");
+}
+
+void
+JsonSaxParser::feed(const char* data, size_t len)
+{
+  size_t i = 0;
+  while (i < len)
+  {
+    switch (this->lexer)
+    {
+    case Lexer::STRING:
+    {
+      // Copy plain runs in one go; only quotes, escapes and control characters need a closer look.
+      auto start = i;
+      while (i < len && data[i] != '"' && data[i] != '\\' && static_cast<unsigned char>(data[i]) >= 0x20)
+      {
+        i++;
+      }
+      if (i > start && this->high_surrogate)
+      {
+        this->append_code_point(this->high_surrogate);
+        this->high_surrogate = 0;
+      }
+      this->token.append(data + start, i - start);
+      if (i == len)
+      {
+        break;
+      }
+
+      auto c = data[i++];
+      if (c == '"')
+      {
+        this->lexer = Lexer::NONE;
+        this->on_string();
+      }
+      else if (c == '\\')
+      {
+        this->lexer = Lexer::STRING_ESCAPE;
+      }
+      else
+      {
+        throw DataParseError("control character in string");
+      }
+      break;
+    }
+    case Lexer::STRING_ESCAPE:
+    {
+      auto c = data[i++];
+      if (c == 'u')
+      {
+        this->lexer = Lexer::STRING_UNICODE;
+        this->unicode = 0;
+        this->unicode_digits = 0;
+        break;
+      }
+
+      if (this->high_surrogate)
+      {
+        this->append_code_point(this->high_surrogate);
+        this->high_surrogate = 0;
+      }
+      switch (c)
+      {
+      case '"':
+      case '\\':
+      case '/':
+        this->token.push_back(c);
+        break;
+      case 'b':
+        this->token.push_back('\b');
+        break;
+      case 'f':
+        this->token.push_back('\f');
+        break;
+      case 'n':
+        this->token.push_back('\n');
+        break;
+      case 'r':
+        this->token.push_back('\r');
+        break;
+      case 't':
+        this->token.push_back('\t');
+        break;
+      default:
+        throw DataParseError(std::string("invalid escape \\") + c);
+      }
+      this->lexer = Lexer::STRING;
+      break;
+    }
+    case Lexer::STRING_UNICODE:
+    {
+      auto digit = hex_value(data[i++]);
+      if (digit < 0)
+      {
+        throw DataParseError("invalid unicode escape");
+      }
+      this->unicode = (this->unicode << 4) | uint32_t(digit);
+      if (++this->unicode_digits < 4)
+      {
+        break;
+      }
+
+      auto cp = this->unicode;
+      if (cp >= 0xD800 && cp <= 0xDBFF)
+      {
+        if (this->high_surrogate)
+        {
+          this->append_code_point(this->high_surrogate);
+        }
+        this->high_surrogate = cp;
+      }
+      else if (cp >= 0xDC00 && cp <= 0xDFFF && this->high_surrogate)
+      {
+        this->append_code_point(0x10000 + ((this->high_surrogate - 0xD800) << 10) + (cp - 0xDC00));
+        this->high_surrogate = 0;
+      }
+      else
+      {
+        if (this->high_surrogate)
+        {
+          this->append_code_point(this->high_surrogate);
+          this->high_surrogate = 0;
+        }
+        this->append_code_point(cp);
+      }
+      this->lexer = Lexer::STRING;
+      break;
+    }
+    case Lexer::NUMBER:
+      if (is_number_char(data[i]))
+      {
+        this->token.push_back(data[i++]);
+        break;
+      }
+      this->lexer = Lexer::NONE;
+      this->on_number();
+      break;
+    case Lexer::LITERAL:
+      if (data[i] >= 'a' && data[i] <= 'z')
+      {
+        this->token.push_back(data[i++]);
+        break;
+      }
+      this->lexer = Lexer::NONE;
+      this->on_literal();
+      break;
+    case Lexer::NONE:
+    {
+      auto c = data[i++];
+      if (is_whitespace(c))
+      {
+        break;
+      }
+
+      auto value_expected = this->expect == Expect::VALUE || this->expect == Expect::VALUE_OR_END;
+      if (c == '"')
+      {
+        if (!value_expected && this->expect != Expect::KEY && this->expect != Expect::KEY_OR_END)
+        {
+          throw DataParseError("unexpected string");
+        }
+        this->lexer = Lexer::STRING;
+        this->token.clear();
+      }
+      else if (c == '-' || (c >= '0' && c <= '9'))
+      {
+        if (!value_expected)
+        {
+          throw DataParseError("unexpected number");
+        }
+        this->lexer = Lexer::NUMBER;
+        this->token.assign(1, c);
+      }
+      else if (c == 't' || c == 'f' || c == 'n')
+      {
+        if (!value_expected)
+        {
+          throw DataParseError("unexpected literal");
+        }
+        this->lexer = Lexer::LITERAL;
+        this->token.assign(1, c);
+      }
+      else
+      {
+        this->on_structural(c);
+      }
+      break;
+    }
+    }
+  }
+}
+
+void
+JsonSaxParser::finish()
+{
+  if (this->lexer == Lexer::NUMBER)
+  {
+    this->lexer = Lexer::NONE;
+    this->on_number();
+  }
+  else if (this->lexer == Lexer::LITERAL)
+  {
+    this->lexer = Lexer::NONE;
+    this->on_literal();
+  }
+
+  if (this->lexer != Lexer::NONE || this->expect != Expect::NOTHING)
+  {
+    throw DataParseError("unexpected end of JSON input");
+  }
+}
+}
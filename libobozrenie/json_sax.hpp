@@ -0,0 +1,102 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _JSON_SAX_HPP_
+#define _JSON_SAX_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Obozrenie
+{
+// Receives the events of a JsonSaxParser. Keys are reported before the value they name.
+class JsonHandler
+{
+public:
+  virtual void start_object() {}
+  virtual void end_object() {}
+  virtual void start_array() {}
+  virtual void end_array() {}
+  virtual void key(const std::string&) {}
+  virtual void string_value(const std::string&) {}
+  virtual void number_value(double) {}
+  virtual void bool_value(bool) {}
+  virtual void null_value() {}
+
+  virtual ~JsonHandler() {}
+};
+
+// Incremental JSON parser. Input may be fed in arbitrary pieces; tokens split between pieces are carried over.
+// Malformed input throws DataParseError.
+class JsonSaxParser
+{
+private:
+  enum class Container : uint8_t
+  {
+    OBJECT,
+    ARRAY
+  };
+
+  enum class Expect : uint8_t
+  {
+    VALUE,
+    VALUE_OR_END,
+    KEY,
+    KEY_OR_END,
+    COLON,
+    COMMA_OR_END,
+    NOTHING
+  };
+
+  enum class Lexer : uint8_t
+  {
+    NONE,
+    STRING,
+    STRING_ESCAPE,
+    STRING_UNICODE,
+    NUMBER,
+    LITERAL
+  };
+
+  JsonHandler& handler;
+  std::vector<Container> stack;
+  Expect expect;
+  Lexer lexer;
+  std::string token;
+  uint32_t unicode;
+  int unicode_digits;
+  uint32_t high_surrogate;
+
+  void value_done();
+  void on_string();
+  void on_number();
+  void on_literal();
+  void on_structural(char);
+  void append_code_point(uint32_t);
+
+public:
+  void feed(const char*, size_t);
+  // Checks that the input ended after one complete value.
+  void finish();
+
+  explicit JsonSaxParser(JsonHandler&);
+};
+}
+
+#endif
@@ -17,8 +17,21 @@
 // along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <libobozrenie/geoip.hpp>
+#include <libobozrenie/cancellation.hpp>
+#include <libobozrenie/color_codes.hpp>
 #include <libobozrenie/core.hpp>
+#include <libobozrenie/event_bus.hpp>
+#include <libobozrenie/server_filter.hpp>
+#include <libobozrenie/server_store.hpp>
+#include <libobozrenie/settings_view.hpp>
 #include <libobozrenie/exceptions.hpp>
+#include <libobozrenie/future.hpp>
+#include <libobozrenie/backend_minetest.hpp>
+#include <libobozrenie/backend_native.hpp>
 #include <libobozrenie/backend_qstat.hpp>
+#include <libobozrenie/parallel.hpp>
+#include <libobozrenie/process.hpp>
+#include <libobozrenie/rule_classifier.hpp>
+#include <libobozrenie/task_pool.hpp>
 #include <libobozrenie/util.hpp>
 #include <libobozrenie/ThreadPool.hpp>
@@ -0,0 +1,382 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "master_client.hpp"
+
+#include "exceptions.hpp"
+#include "udp_reactor.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace Obozrenie
+{
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+const int MAX_RETRIES = 2;
+// Master lists kept at most. Expired lists go first, then the ones closest to expiry.
+const size_t MAX_CACHE_ENTRIES = 64;
+const auto IDLE_WAIT = std::chrono::milliseconds(50);
+
+const std::string HEADER("\xFF\xFF\xFF\xFF", 4);
+const std::string Q3_RESPONSE = "getservers";
+const std::string VALVE_RESPONSE("\x66\x0A", 2);
+const std::string VALVE_FIRST_SEED = "0.0.0.0:0";
+
+struct CacheEntry
+{
+  Clock::time_point expires;
+  std::vector<Endpoint> servers;
+};
+
+std::mutex cache_mutex;
+std::map<std::string, CacheEntry> cache;
+
+std::string
+cache_key(const MasterQuery& q)
+{
+  return std::to_string(int(q.protocol)) + "\n" + q.address + "\n" + q.filter;
+}
+
+// Must be called with cache_mutex held.
+void
+cache_store(std::string key, CacheEntry v)
+{
+  auto now = Clock::now();
+  for (auto it = cache.begin(); it != cache.end();)
+  {
+    it = it->second.expires <= now ? cache.erase(it) : std::next(it);
+  }
+  if (cache.size() >= MAX_CACHE_ENTRIES && !cache.count(key))
+  {
+    typedef decltype(cache)::value_type Item;
+    cache.erase(std::min_element(cache.begin(), cache.end(), [](const Item& a, const Item& b) { return a.second.expires < b.second.expires; }));
+  }
+  cache[key] = std::move(v);
+}
+
+uint16_t
+read_port(const uint8_t* p)
+{
+  return uint16_t((p[0] << 8) | p[1]);
+}
+
+std::string
+q3_request(const std::string& filter)
+{
+  // The filter may name the command itself, e.g. "getserversExt Xonotic 3 empty full ipv4 ipv6".
+  if (filter.compare(0, Q3_RESPONSE.size(), Q3_RESPONSE) == 0)
+  {
+    return HEADER + filter;
+  }
+  return HEADER + "getservers " + filter;
+}
+
+std::string
+valve_request(const std::string& seed, const std::string& filter)
+{
+  std::string v;
+  v.push_back('\x31');
+  v.push_back('\xFF');
+  v += seed;
+  v.push_back('\0');
+  v += filter;
+  v.push_back('\0');
+  return v;
+}
+
+struct MasterState
+{
+  const MasterQuery* query;
+  Endpoint endpoint;
+  std::vector<Endpoint> servers;
+  std::string request;
+  Clock::time_point deadline;
+  int attempts = 0;
+  bool answered = false;
+  // Set once the end of list marker arrived, so that only whole lists get cached.
+  bool complete = false;
+  bool started = false;
+  bool done = false;
+};
+}
+
+bool
+parse_q3_master_reply(const uint8_t* data, size_t len, std::vector<Endpoint>& out)
+{
+  // "getserversResponse" or "getserversExtResponse", then "\" + IPv4 + port or "/" + IPv6 + port entries.
+  if (len < Q3_RESPONSE.size() || std::memcmp(data, Q3_RESPONSE.data(), Q3_RESPONSE.size()) != 0)
+  {
+    throw DataParseError("not a getservers reply");
+  }
+
+  auto p = data;
+  auto end = data + len;
+  while (p < end && *p != '\\' && *p != '/')
+  {
+    p++;
+  }
+
+  while (p < end)
+  {
+    auto is_v6 = *p == '/';
+    size_t addr_len = is_v6 ? 16 : 4;
+    if (size_t(end - p) < 1 + addr_len + 2)
+    {
+      break;
+    }
+    if (!is_v6 && std::memcmp(p + 1, "EOT", 3) == 0)
+    {
+      return true;
+    }
+
+    Endpoint e;
+    e.family = is_v6 ? Endpoint::Family::V6 : Endpoint::Family::V4;
+    std::memcpy(e.address.data(), p + 1, addr_len);
+    e.port = read_port(p + 1 + addr_len);
+    if (e.port != 0)
+    {
+      out.push_back(e);
+    }
+    p += 1 + addr_len + 2;
+  }
+  return false;
+}
+
+bool
+parse_valve_master_reply(const uint8_t* data, size_t len, std::vector<Endpoint>& out)
+{
+  // 0x66 0x0A, then six bytes per server. The list ends with 0.0.0.0:0.
+  if (len < VALVE_RESPONSE.size() || std::memcmp(data, VALVE_RESPONSE.data(), VALVE_RESPONSE.size()) != 0)
+  {
+    throw DataParseError("not a master server reply");
+  }
+
+  for (auto p = data + VALVE_RESPONSE.size(); p + 6 <= data + len; p += 6)
+  {
+    Endpoint e;
+    e.family = Endpoint::Family::V4;
+    std::memcpy(e.address.data(), p, 4);
+    e.port = read_port(p + 4);
+    if (e.port == 0 && p[0] == 0 && p[1] == 0 && p[2] == 0 && p[3] == 0)
+    {
+      return true;
+    }
+    out.push_back(e);
+  }
+  return false;
+}
+
+std::vector<Endpoint>
+fetch_master_lists(const std::vector<MasterQuery>& queries, std::chrono::seconds ttl, std::chrono::milliseconds timeout, const CancellationToken& token)
+{
+  std::vector<MasterState> states;
+  std::vector<std::vector<Endpoint>> lists(queries.size());
+  std::vector<size_t> state_list;
+
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto now = Clock::now();
+    for (size_t i = 0; i < queries.size(); i++)
+    {
+      auto it = cache.find(cache_key(queries[i]));
+      if (ttl.count() > 0 && it != cache.end() && it->second.expires > now)
+      {
+        lists[i] = it->second.servers;
+        continue;
+      }
+
+      MasterState s;
+      s.query = &queries[i];
+      states.push_back(std::move(s));
+      state_list.push_back(i);
+    }
+  }
+
+  for (auto& s : states)
+  {
+    auto default_port = s.query->protocol == MasterProtocol::Q3 ? Q3_MASTER_DEFAULT_PORT : VALVE_MASTER_DEFAULT_PORT;
+    try
+    {
+      s.endpoint = Endpoint::resolve(s.query->address, default_port).at(0);
+      s.request = s.query->protocol == MasterProtocol::Q3 ? q3_request(s.query->filter) : valve_request(VALVE_FIRST_SEED, s.query->filter);
+    }
+    catch (const std::exception&)
+    {
+      s.done = true;
+    }
+  }
+
+  if (std::any_of(states.begin(), states.end(), [](const MasterState& s) { return !s.done; }))
+  {
+    CancellationFd cancelled(token);
+    UdpReactor reactor;
+    reactor.set_wakeup(cancelled.get());
+    // Replies are told apart by their source, so only one query per master address runs at a time.
+    std::unordered_map<Endpoint, size_t> active;
+
+    auto start = [&reactor, timeout](MasterState& s) {
+      s.started = true;
+      s.attempts++;
+      s.answered = false;
+      s.deadline = Clock::now() + timeout;
+      try
+      {
+        reactor.send(s.endpoint, s.request);
+      }
+      catch (const SocketError&)
+      {
+        s.done = true;
+      }
+    };
+
+    auto receive = [&states, &active, &start, timeout](const Endpoint& from, const uint8_t* data, size_t len) {
+      auto it = active.find(from);
+      if (it == active.end() || len < HEADER.size() || std::memcmp(data, HEADER.data(), HEADER.size()) != 0)
+      {
+        return;
+      }
+      auto& s = states[it->second];
+
+      try
+      {
+        if (s.query->protocol == MasterProtocol::Q3)
+        {
+          s.complete = s.done = parse_q3_master_reply(data + HEADER.size(), len - HEADER.size(), s.servers);
+          // Lists span several datagrams; keep listening while they keep coming.
+          s.deadline = Clock::now() + timeout;
+        }
+        else
+        {
+          auto first_new = s.servers.size();
+          s.complete = s.done = parse_valve_master_reply(data + HEADER.size(), len - HEADER.size(), s.servers);
+          if (!s.done)
+          {
+            // Each page is requested with the last address of the previous one as the seed.
+            if (s.servers.size() == first_new)
+            {
+              return;
+            }
+            s.request = valve_request(s.servers.back().str(), s.query->filter);
+            s.attempts = 0;
+            start(s);
+          }
+        }
+        s.answered = true;
+      }
+      catch (const DataParseError&)
+      {
+      }
+    };
+
+    for (;;)
+    {
+      token.throw_if_cancelled();
+      auto now = Clock::now();
+      auto wake = std::min(now + IDLE_WAIT, token.deadline());
+      bool pending = false;
+
+      for (size_t i = 0; i < states.size(); i++)
+      {
+        auto& s = states[i];
+        if (s.done)
+        {
+          if (s.started)
+          {
+            active.erase(s.endpoint);
+            s.started = false;
+          }
+          continue;
+        }
+        pending = true;
+
+        if (!s.started)
+        {
+          if (!active.count(s.endpoint))
+          {
+            active[s.endpoint] = i;
+            start(s);
+          }
+          continue;
+        }
+
+        if (now >= s.deadline)
+        {
+          // A Q3 master that answered and then went quiet has most likely sent its whole list. Without the end marker it is used
+          // for this fetch but not cached.
+          if (s.answered && s.query->protocol == MasterProtocol::Q3)
+          {
+            s.done = true;
+          }
+          else if (s.attempts <= MAX_RETRIES)
+          {
+            start(s);
+          }
+          else
+          {
+            s.done = true;
+          }
+          continue;
+        }
+        wake = std::min(wake, s.deadline);
+      }
+
+      if (!pending)
+      {
+        break;
+      }
+      reactor.poll(wake, receive);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto expires = Clock::now() + ttl;
+    for (size_t k = 0; k < states.size(); k++)
+    {
+      auto& s = states[k];
+      if (s.complete && ttl.count() > 0)
+      {
+        cache_store(cache_key(*s.query), CacheEntry{ expires, s.servers });
+      }
+      lists[state_list[k]] = std::move(s.servers);
+    }
+  }
+
+  std::vector<Endpoint> merged;
+  std::unordered_set<Endpoint> seen;
+  for (const auto& list : lists)
+  {
+    for (const auto& e : list)
+    {
+      if (seen.insert(e).second)
+      {
+        merged.push_back(e);
+      }
+    }
+  }
+  return merged;
+}
+}
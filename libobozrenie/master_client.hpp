@@ -0,0 +1,64 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _MASTER_CLIENT_HPP_
+#define _MASTER_CLIENT_HPP_
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "cancellation.hpp"
+#include "endpoint.hpp"
+
+namespace Obozrenie
+{
+enum class MasterProtocol
+{
+  // getservers / getserversExt, used by Quake 3 and its descendants.
+  Q3,
+  // The Valve master server protocol (0x31 queries, paged by seed address).
+  VALVE
+};
+
+const uint16_t Q3_MASTER_DEFAULT_PORT = 27950;
+const uint16_t VALVE_MASTER_DEFAULT_PORT = 27011;
+
+// One master to ask. For Q3 masters the filter is the argument string of getservers, e.g. "68 empty full";
+// for Valve masters it is the filter string, e.g. "\gamedir\cstrike".
+struct MasterQuery
+{
+  MasterProtocol protocol;
+  std::string address;
+  std::string filter;
+};
+
+// Decoders for single master replies, following the 0xFFFFFFFF header. They return true once the list is complete.
+bool parse_q3_master_reply(const uint8_t*, size_t, std::vector<Endpoint>&);
+bool parse_valve_master_reply(const uint8_t*, size_t, std::vector<Endpoint>&);
+
+// Asks all masters at once and returns the union of their lists without duplicates, in first-seen order.
+// Complete lists younger than the TTL are served from a small process-wide cache; a TTL of zero bypasses it. Lists cut short by a
+// timeout are returned but not cached.
+// Masters that cannot be resolved or do not answer contribute nothing. Cancelling the token or passing its deadline abandons the fetch
+// with the token's error.
+std::vector<Endpoint> fetch_master_lists(const std::vector<MasterQuery>&, std::chrono::seconds, std::chrono::milliseconds,
+                                         const CancellationToken& = CancellationToken());
+}
+
+#endif
@@ -0,0 +1,120 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "parallel.hpp"
+
+#include "task_pool.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace Obozrenie
+{
+size_t
+default_parallelism()
+{
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+namespace
+{
+// Shared with the helper tasks, which may be picked up only after parallel_for has returned.
+// They must then find nothing left to claim and leave without touching the function.
+struct ParallelState
+{
+  const std::function<void(size_t)>* f;
+  size_t count;
+  size_t next = 0;
+  size_t active = 0;
+  bool failed = false;
+  std::exception_ptr error;
+  std::mutex m;
+  std::condition_variable idle;
+
+  void work()
+  {
+    for (;;)
+    {
+      size_t i;
+      {
+        std::lock_guard<std::mutex> lock(this->m);
+        if (this->failed || this->next >= this->count)
+        {
+          return;
+        }
+        i = this->next++;
+        this->active++;
+      }
+
+      std::exception_ptr e;
+      try
+      {
+        (*this->f)(i);
+      }
+      catch (...)
+      {
+        e = std::current_exception();
+      }
+
+      std::lock_guard<std::mutex> lock(this->m);
+      if (e && !this->error)
+      {
+        this->error = e;
+        this->failed = true;
+      }
+      if (--this->active == 0)
+      {
+        this->idle.notify_all();
+      }
+    }
+  }
+
+  ParallelState(const std::function<void(size_t)>& fn, size_t n) : f(&fn), count(n) {}
+};
+}
+
+void
+parallel_for(size_t count, const std::function<void(size_t)>& f, size_t threads)
+{
+  auto state = std::make_shared<ParallelState>(f, count);
+
+  auto helper_count = std::min(threads, count);
+  if (helper_count > 1)
+  {
+    auto pool = default_task_pool();
+    for (size_t i = 1; i < helper_count; i++)
+    {
+      pool->post([state]() { state->work(); }, current_task_priority());
+    }
+  }
+
+  // Helpers that have not started by the time this thread runs out of indices are not waited for.
+  state->work();
+  std::unique_lock<std::mutex> lock(state->m);
+  state->idle.wait(lock, [&state]() { return state->active == 0; });
+
+  if (state->error)
+  {
+    std::rethrow_exception(state->error);
+  }
+}
+}
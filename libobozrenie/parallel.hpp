@@ -0,0 +1,37 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _PARALLEL_HPP_
+#define _PARALLEL_HPP_
+
+#include <cstddef>
+#include <functional>
+
+namespace Obozrenie
+{
+// Number of threads parallel_for uses by default: one per hardware thread, at least one.
+size_t default_parallelism();
+
+// Calls the function for every index below the count on up to the given number of threads: the calling thread and workers of the
+// default task pool, which run at the caller's current_task_priority(). A count of one or a single thread runs everything inline. Indices are handed out one at a time to even out uneven work.
+// The caller never waits for a worker to become free, so calling this from a pool task cannot deadlock.
+// Returns once every call has finished; the first exception thrown by any call is rethrown and stops the remaining indices from starting.
+void parallel_for(size_t, const std::function<void(size_t)>&, size_t = default_parallelism());
+}
+
+#endif
@@ -0,0 +1,213 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "process.hpp"
+
+#include "exceptions.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/algorithm/string/join.hpp>
+
+extern char** environ;
+
+namespace Obozrenie
+{
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+const size_t READ_BUFFER_SIZE = 64 * 1024;
+const auto REAP_INTERVAL = std::chrono::milliseconds(5);
+
+// A spawned program. Unless it has been reaped, destroying it kills its process group and collects the exit status, so no path leaves a zombie or a stray qstat behind.
+struct Child
+{
+  pid_t pid = -1;
+  int output = -1;
+  bool reaped = false;
+
+  bool try_reap(int& status)
+  {
+    auto rc = waitpid(this->pid, &status, WNOHANG);
+    if (rc == this->pid || (rc < 0 && errno == ECHILD))
+    {
+      this->reaped = true;
+    }
+    return this->reaped;
+  }
+
+  ~Child()
+  {
+    if (this->output >= 0)
+    {
+      close(this->output);
+    }
+    if (this->pid > 0 && !this->reaped)
+    {
+      kill(-this->pid, SIGKILL);
+      int status;
+      while (waitpid(this->pid, &status, 0) < 0 && errno == EINTR)
+      {
+      }
+    }
+  }
+};
+
+void
+spawn(const std::vector<std::string>& argv, Child& child)
+{
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0)
+  {
+    throw PopenError(std::string("pipe: ") + std::strerror(errno));
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+  // A group of its own lets a deadline take down the program together with anything it started.
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  sigset_t mask;
+  sigemptyset(&mask);
+  posix_spawnattr_setsigmask(&attr, &mask);
+  posix_spawnattr_setpgroup(&attr, 0);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+
+  std::vector<char*> args;
+  for (const auto& a : argv)
+  {
+    args.push_back(const_cast<char*>(a.c_str()));
+  }
+  args.push_back(nullptr);
+
+  auto rc = posix_spawnp(&child.pid, args[0], &actions, &attr, args.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  close(fds[1]);
+  if (rc != 0)
+  {
+    close(fds[0]);
+    child.pid = -1;
+    throw PopenError(std::string(std::strerror(rc)) + " - " + boost::join(argv, " "));
+  }
+
+  child.output = fds[0];
+  fcntl(child.output, F_SETFL, fcntl(child.output, F_GETFL) | O_NONBLOCK);
+}
+
+// Milliseconds to block before the deadline passes, or -1 without one. Cancellation wakes the wait through its descriptor instead.
+int
+check(const std::vector<std::string>& argv, Clock::time_point deadline, const CancellationToken& token)
+{
+  token.throw_if_cancelled();
+
+  if (deadline == Clock::time_point::max())
+  {
+    return -1;
+  }
+  auto now = Clock::now();
+  if (now >= deadline)
+  {
+    throw PopenError("Timed out - " + boost::join(argv, " "));
+  }
+  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+  return int(std::min<decltype(left)>(left, std::numeric_limits<int>::max()));
+}
+}
+
+void
+exec_stream(const std::vector<std::string>& argv, const OutputFunc& on_output, std::chrono::milliseconds timeout, const CancellationToken& token)
+{
+  if (argv.empty())
+  {
+    throw PopenError("empty command");
+  }
+
+  auto deadline = timeout.count() > 0 ? Clock::now() + timeout : Clock::time_point::max();
+  deadline = std::min(deadline, token.deadline());
+  token.throw_if_cancelled();
+
+  CancellationFd cancelled(token);
+  Child child;
+  spawn(argv, child);
+
+  std::vector<char> buffer(READ_BUFFER_SIZE);
+  for (;;)
+  {
+    auto wait = check(argv, deadline, token);
+
+    pollfd p[2] = { { child.output, POLLIN, 0 }, { cancelled.get(), POLLIN, 0 } };
+    auto rc = poll(p, 2, wait);
+    if (rc < 0 && errno != EINTR)
+    {
+      throw PopenError(std::string("poll: ") + std::strerror(errno));
+    }
+    if (rc <= 0 || p[0].revents == 0)
+    {
+      continue;
+    }
+
+    // One read per round keeps a chatty program from starving the deadline check.
+    auto n = read(child.output, buffer.data(), buffer.size());
+    if (n > 0)
+    {
+      on_output(buffer.data(), size_t(n));
+    }
+    else if (n == 0)
+    {
+      break;
+    }
+    else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    {
+      throw PopenError(std::string("read: ") + std::strerror(errno));
+    }
+  }
+
+  // Standard output is closed, but the program may still be shutting down.
+  int status = 0;
+  while (!child.try_reap(status))
+  {
+    check(argv, deadline, token);
+    std::this_thread::sleep_for(REAP_INTERVAL);
+  }
+
+  if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+  {
+    throw PopenError("Exited with status " + std::to_string(WEXITSTATUS(status)) + " - " + boost::join(argv, " "));
+  }
+  if (WIFSIGNALED(status))
+  {
+    throw PopenError(std::string("Killed by ") + strsignal(WTERMSIG(status)) + " - " + boost::join(argv, " "));
+  }
+}
+}
@@ -0,0 +1,41 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _PROCESS_HPP_
+#define _PROCESS_HPP_
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "cancellation.hpp"
+
+namespace Obozrenie
+{
+typedef std::function<void(const char*, size_t)> OutputFunc;
+
+// Runs a program in its own process group and hands its standard output to the callback chunk by chunk while it runs.
+// On timeout, cancellation or an exception thrown by the callback the whole group is killed and reaped before the error propagates.
+// Cancelling the token wakes the wait at once. A zero timeout waits indefinitely unless the token has a deadline.
+// Throws PopenError if the program cannot be started, fails or times out, and whatever the token throws once cancelled or expired.
+void exec_stream(const std::vector<std::string>&, const OutputFunc&, std::chrono::milliseconds = std::chrono::milliseconds(0),
+                 const CancellationToken& = CancellationToken());
+}
+
+#endif
@@ -0,0 +1,204 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "rule_classifier.hpp"
+
+#include "exceptions.hpp"
+
+
+namespace Obozrenie
+{
+namespace
+{
+template <size_t N>
+constexpr uint32_t
+literal_hash(const char (&v)[N])
+{
+  return rule_hash(v, N - 1);
+}
+
+// The hash only narrows the candidates down; the name is still compared so that a collision cannot misclassify a rule.
+RuleClassifier::Match
+verify(const std::string& v, const char* expected, RuleClass c, uint8_t rank)
+{
+  return v == expected ? RuleClassifier::Match{ c, rank } : RuleClassifier::Match{ RuleClass::NONE, 0 };
+}
+
+// When a server has several rules of one class, the lowest rank wins, e.g. fs_game over gamename.
+RuleClassifier::Match
+classify_builtin(const std::string& v)
+{
+  switch (rule_hash(v.data(), v.size()))
+  {
+  case literal_hash("sv_punkbuster"):
+    return verify(v, "sv_punkbuster", RuleClass::SECURE, 1);
+  case literal_hash("punkbuster"):
+    return verify(v, "punkbuster", RuleClass::SECURE, 2);
+  case literal_hash("secure"):
+    return verify(v, "secure", RuleClass::SECURE, 3);
+  case literal_hash("g_needpass"):
+    return verify(v, "g_needpass", RuleClass::NEED_PASS, 1);
+  case literal_hash("needpass"):
+    return verify(v, "needpass", RuleClass::NEED_PASS, 2);
+  case literal_hash("si_usepass"):
+    return verify(v, "si_usepass", RuleClass::NEED_PASS, 3);
+  case literal_hash("pswrd"):
+    return verify(v, "pswrd", RuleClass::NEED_PASS, 4);
+  case literal_hash("password"):
+    return verify(v, "password", RuleClass::NEED_PASS, 5);
+  case literal_hash("fs_game"):
+    return verify(v, "fs_game", RuleClass::GAME_MOD, 1);
+  case literal_hash("gamedir"):
+    return verify(v, "gamedir", RuleClass::GAME_MOD, 2);
+  case literal_hash("gamename"):
+    return verify(v, "gamename", RuleClass::GAME_MOD, 3);
+  case literal_hash("shortversion"):
+    return verify(v, "shortversion", RuleClass::VERSION, 1);
+  case literal_hash("gameversion"):
+    return verify(v, "gameversion", RuleClass::VERSION, 2);
+  case literal_hash("version"):
+    return verify(v, "version", RuleClass::VERSION, 3);
+  default:
+    return RuleClassifier::Match{ RuleClass::NONE, 0 };
+  }
+}
+
+RuleClass
+parse_rule_class(const std::string& v)
+{
+  if (v == "secure")
+  {
+    return RuleClass::SECURE;
+  }
+  if (v == "need_pass")
+  {
+    return RuleClass::NEED_PASS;
+  }
+  if (v == "game_mod")
+  {
+    return RuleClass::GAME_MOD;
+  }
+  if (v == "version")
+  {
+    return RuleClass::VERSION;
+  }
+  throw InvalidSettingKeyError("unknown rule class " + v);
+}
+}
+
+RuleClassifier::RuleClassifier(const std::vector<std::string>& entries)
+{
+  for (const auto& entry : entries)
+  {
+    auto colon = entry.rfind(':');
+    if (colon == std::string::npos || colon == 0)
+    {
+      throw InvalidSettingKeyError("malformed rule class " + entry);
+    }
+    this->extra[entry.substr(0, colon)] = parse_rule_class(entry.substr(colon + 1));
+  }
+}
+
+RuleClassifier::Match
+RuleClassifier::match(const std::string& v) const
+{
+  if (!this->extra.empty())
+  {
+    auto it = this->extra.find(v);
+    if (it != this->extra.end())
+    {
+      // Names a game configures take precedence over the built-in ones.
+      return Match{ it->second, 0 };
+    }
+  }
+  return classify_builtin(v);
+}
+
+RuleClass
+RuleClassifier::classify(const std::string& v) const
+{
+  return this->match(v).c;
+}
+
+void
+RuleClassifier::apply(Server& server) const
+{
+  const Match none{ RuleClass::NONE, 0 };
+  auto secure = none;
+  auto need_pass = none;
+  auto game_mod = none;
+  auto version = none;
+  const Glib::ustring* secure_value = nullptr;
+  const Glib::ustring* need_pass_value = nullptr;
+  const Glib::ustring* game_mod_value = nullptr;
+  const Glib::ustring* version_value = nullptr;
+
+  auto pick = [](Match& best, const Glib::ustring*& best_value, const Match& m, const Glib::ustring& value) {
+    if (best.c == RuleClass::NONE || m.rank < best.rank)
+    {
+      best = m;
+      best_value = &value;
+    }
+  };
+
+  for (const auto& kv : server.rules)
+  {
+    auto m = this->match(kv.first.str().raw());
+    switch (m.c)
+    {
+    case RuleClass::SECURE:
+      pick(secure, secure_value, m, kv.second);
+      break;
+    case RuleClass::NEED_PASS:
+      pick(need_pass, need_pass_value, m, kv.second);
+      break;
+    case RuleClass::GAME_MOD:
+      if (!kv.second.empty())
+      {
+        pick(game_mod, game_mod_value, m, kv.second);
+      }
+      break;
+    case RuleClass::VERSION:
+      if (!kv.second.empty())
+      {
+        pick(version, version_value, m, kv.second);
+      }
+      break;
+    case RuleClass::NONE:
+      break;
+    }
+  }
+
+  if (secure_value && !server.secure)
+  {
+    server.secure = *secure_value != "0";
+  }
+  if (need_pass_value && !server.need_pass)
+  {
+    server.need_pass = *need_pass_value != "0";
+  }
+  if (game_mod_value && !server.game_mod)
+  {
+    server.game_mod = Atom(*game_mod_value);
+  }
+  if (version_value && !server.version)
+  {
+    server.version = Atom(*version_value);
+  }
+}
+}
@@ -0,0 +1,87 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _RULE_CLASSIFIER_HPP_
+#define _RULE_CLASSIFIER_HPP_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common_models.hpp"
+
+namespace Obozrenie
+{
+// What a server rule says about the server.
+enum class RuleClass : uint8_t
+{
+  NONE,
+  // A non-zero value marks an anti-cheat protected server.
+  SECURE,
+  // A non-zero value marks a password protected server.
+  NEED_PASS,
+  // The value names the running mod.
+  GAME_MOD,
+  // The value is the server's version.
+  VERSION
+};
+
+// Extra rule names for one game, as "name:class" with class being secure, need_pass, game_mod or version.
+constexpr SettingKey<std::vector<std::string>> RULE_CLASSES_SETTING{ "rule_classes" };
+
+// FNV-1a, usable in constant expressions so that rule names can serve as case labels.
+constexpr uint32_t
+rule_hash(const char* v, size_t len)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+  {
+    h = (h ^ uint8_t(v[i])) * 16777619u;
+  }
+  return h;
+}
+
+// Maps rule names to RuleClass without allocating. Well known names are compiled in; a game may add its own.
+class RuleClassifier
+{
+public:
+  // A class and its precedence among the names of that class; lower ranks win.
+  struct Match
+  {
+    RuleClass c;
+    uint8_t rank;
+  };
+
+private:
+  std::unordered_map<std::string, RuleClass> extra;
+
+  Match match(const std::string&) const;
+
+public:
+  RuleClass classify(const std::string&) const;
+  // Derives secure, need_pass, game_mod and version from the rules. Values a backend already filled in from its protocol are kept.
+  // If several rules map onto one field, the game's own names win over built-in ones, and built-in ones follow a fixed order.
+  void apply(Server&) const;
+
+  // Throws InvalidSettingKeyError for malformed entries.
+  explicit RuleClassifier(const std::vector<std::string>& = std::vector<std::string>());
+};
+}
+
+#endif
@@ -0,0 +1,505 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "server_filter.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <iterator>
+
+namespace Obozrenie
+{
+namespace
+{
+char
+ascii_lower(char c)
+{
+  return (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c;
+}
+
+const std::vector<int>&
+int_column(const ServerStore& s, ServerField f)
+{
+  switch (f)
+  {
+  case ServerField::PING:
+    return s.ping_column();
+  case ServerField::PLAYER_COUNT:
+    return s.player_count_column();
+  case ServerField::PLAYER_LIMIT:
+    return s.player_limit_column();
+  case ServerField::SPECTATOR_COUNT:
+    return s.spectator_count_column();
+  default:
+    return s.spectator_limit_column();
+  }
+}
+
+const std::vector<Atom>&
+atom_column(const ServerStore& s, ServerField f)
+{
+  switch (f)
+  {
+  case ServerField::COUNTRY:
+    return s.country_column();
+  case ServerField::TERRAIN:
+    return s.terrain_column();
+  case ServerField::GAME_TYPE:
+    return s.game_type_column();
+  default:
+    return s.game_mod_column();
+  }
+}
+
+bool
+has_sort_field(const ServerStore& s, ServerSortKey k, ServerStore::Row r)
+{
+  switch (k)
+  {
+  case ServerSortKey::NAME:
+    return s.has(ServerField::NAME, r);
+  case ServerSortKey::PING:
+    return s.has(ServerField::PING, r);
+  case ServerSortKey::PLAYER_COUNT:
+    return s.has(ServerField::PLAYER_COUNT, r);
+  case ServerSortKey::PLAYER_LIMIT:
+    return s.has(ServerField::PLAYER_LIMIT, r);
+  case ServerSortKey::GAME_TYPE:
+    return s.has(ServerField::GAME_TYPE, r);
+  case ServerSortKey::TERRAIN:
+    return s.has(ServerField::TERRAIN, r);
+  default:
+    return true;
+  }
+}
+
+int
+compare_int(int a, int b)
+{
+  return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+// Three-way comparison of two present values of the sort field.
+int
+compare_sort_field(const ServerStore& s, ServerSortKey k, ServerStore::Row a, ServerStore::Row b)
+{
+  switch (k)
+  {
+  case ServerSortKey::HOST:
+    return s.host(a).raw().compare(s.host(b).raw());
+  case ServerSortKey::NAME:
+    return s.name(a).raw().compare(s.name(b).raw());
+  case ServerSortKey::PING:
+    return compare_int(s.ping_column()[a], s.ping_column()[b]);
+  case ServerSortKey::PLAYER_COUNT:
+    return compare_int(s.player_count_column()[a], s.player_count_column()[b]);
+  case ServerSortKey::PLAYER_LIMIT:
+    return compare_int(s.player_limit_column()[a], s.player_limit_column()[b]);
+  case ServerSortKey::GAME_TYPE:
+    return s.game_type(a) == s.game_type(b) ? 0 : s.game_type(a).str().raw().compare(s.game_type(b).str().raw());
+  case ServerSortKey::TERRAIN:
+    return s.terrain(a) == s.terrain(b) ? 0 : s.terrain(a).str().raw().compare(s.terrain(b).str().raw());
+  default:
+    return 0;
+  }
+}
+}
+
+bool
+ServerFilter::empty() const
+{
+  return !this->ping_min && !this->ping_max && !this->players_min && !this->players_max && !this->not_full && !this->not_empty && !this->need_pass && !this->secure &&
+         this->countries.empty() && this->terrains.empty() && this->game_types.empty() && this->game_mods.empty() && this->name_contains.empty();
+}
+
+FilterPlan::FilterPlan(const ServerFilter& f)
+{
+  auto add_range = [this](ServerField field, std::experimental::optional<int> min, std::experimental::optional<int> max) {
+    if (min || max)
+    {
+      Step s{};
+      s.op = Op::INT_RANGE;
+      s.field = field;
+      s.min = min.value_or(INT_MIN);
+      s.max = max.value_or(INT_MAX);
+      this->steps.push_back(s);
+    }
+  };
+  auto add_flag = [this](ServerField field, std::experimental::optional<bool> v) {
+    if (v)
+    {
+      Step s{};
+      s.op = Op::FLAG;
+      s.field = field;
+      s.flag = *v;
+      this->steps.push_back(s);
+    }
+  };
+  auto add_atoms = [this](ServerField field, const AtomSet& v) {
+    if (!v.empty())
+    {
+      Step s{};
+      s.op = Op::ATOM_IN;
+      s.field = field;
+      for (const auto& a : v)
+      {
+        s.atoms.push_back(a.value());
+        this->pinned.push_back(a);
+      }
+      std::sort(s.atoms.begin(), s.atoms.end());
+      this->steps.push_back(std::move(s));
+    }
+  };
+
+  add_range(ServerField::PING, f.ping_min, f.ping_max);
+  add_range(ServerField::PLAYER_COUNT, f.players_min, f.players_max);
+  if (f.not_empty)
+  {
+    Step s{};
+    s.op = Op::NOT_EMPTY;
+    this->steps.push_back(s);
+  }
+  if (f.not_full)
+  {
+    Step s{};
+    s.op = Op::NOT_FULL;
+    this->steps.push_back(s);
+  }
+  add_flag(ServerField::NEED_PASS, f.need_pass);
+  add_flag(ServerField::SECURE, f.secure);
+  add_atoms(ServerField::COUNTRY, f.countries);
+  add_atoms(ServerField::GAME_TYPE, f.game_types);
+  add_atoms(ServerField::GAME_MOD, f.game_mods);
+  add_atoms(ServerField::TERRAIN, f.terrains);
+  if (!f.name_contains.empty())
+  {
+    Step s{};
+    s.op = Op::NAME_CONTAINS;
+    s.needle = f.name_contains.raw();
+    std::transform(s.needle.begin(), s.needle.end(), s.needle.begin(), ascii_lower);
+    this->steps.push_back(std::move(s));
+  }
+}
+
+bool
+FilterPlan::eval(const Step& s, const ServerStore& store, ServerStore::Row r)
+{
+  switch (s.op)
+  {
+  case Op::INT_RANGE:
+  {
+    if (!store.has(s.field, r))
+    {
+      return false;
+    }
+    auto v = int_column(store, s.field)[r];
+    return v >= s.min && v <= s.max;
+  }
+  case Op::NOT_EMPTY:
+    return store.player_count_column()[r] > 0;
+  case Op::NOT_FULL:
+    return !store.has(ServerField::PLAYER_LIMIT, r) || store.player_count_column()[r] < store.player_limit_column()[r];
+  case Op::FLAG:
+  {
+    auto v = s.field == ServerField::NEED_PASS ? store.need_pass(r) : store.secure(r);
+    return v == s.flag;
+  }
+  case Op::ATOM_IN:
+  {
+    auto id = atom_column(store, s.field)[r].value();
+    return s.atoms.size() == 1 ? s.atoms[0] == id : std::binary_search(s.atoms.begin(), s.atoms.end(), id);
+  }
+  case Op::NAME_CONTAINS:
+  {
+    const auto& name = store.name(r).raw();
+    return std::search(name.begin(), name.end(), s.needle.begin(), s.needle.end(), [](char a, char b) { return ascii_lower(a) == b; }) != name.end();
+  }
+  }
+  return false;
+}
+
+void
+FilterPlan::apply(const Step& s, const ServerStore& store, std::vector<ServerStore::Row>& rows)
+{
+  // Compacts the selection vector in place, touching a single column per pass.
+  auto out = rows.begin();
+  switch (s.op)
+  {
+  case Op::INT_RANGE:
+  {
+    const auto& column = int_column(store, s.field);
+    for (auto r : rows)
+    {
+      auto v = column[r];
+      if (v >= s.min && v <= s.max && store.has(s.field, r))
+      {
+        *out++ = r;
+      }
+    }
+    break;
+  }
+  case Op::ATOM_IN:
+  {
+    const auto& column = atom_column(store, s.field);
+    for (auto r : rows)
+    {
+      auto id = column[r].value();
+      if (s.atoms.size() == 1 ? s.atoms[0] == id : std::binary_search(s.atoms.begin(), s.atoms.end(), id))
+      {
+        *out++ = r;
+      }
+    }
+    break;
+  }
+  default:
+    for (auto r : rows)
+    {
+      if (eval(s, store, r))
+      {
+        *out++ = r;
+      }
+    }
+    break;
+  }
+  rows.erase(out, rows.end());
+}
+
+bool
+FilterPlan::matches(const ServerStore& store, ServerStore::Row r) const
+{
+  for (const auto& s : this->steps)
+  {
+    if (!eval(s, store, r))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void
+FilterPlan::refine(const ServerStore& store, std::vector<ServerStore::Row>& rows) const
+{
+  for (const auto& s : this->steps)
+  {
+    if (rows.empty())
+    {
+      return;
+    }
+    apply(s, store, rows);
+  }
+}
+
+bool
+FilterPlan::seed(const ServerStore& store, std::vector<ServerStore::Row>& rows) const
+{
+  const Step* best = nullptr;
+  auto best_cost = store.size();
+
+  for (const auto& s : this->steps)
+  {
+    size_t cost;
+    if (s.op == Op::INT_RANGE && (s.field == ServerField::PING || s.field == ServerField::PLAYER_COUNT))
+    {
+      cost = store.count_in_range(s.field, s.min, s.max);
+    }
+    else if (s.op == Op::ATOM_IN && s.field != ServerField::GAME_MOD)
+    {
+      cost = 0;
+      for (auto id : s.atoms)
+      {
+        cost += store.rows_with(s.field, Atom::from_value(id)).size();
+      }
+    }
+    else
+    {
+      continue;
+    }
+
+    if (cost < best_cost)
+    {
+      best = &s;
+      best_cost = cost;
+    }
+  }
+
+  if (!best)
+  {
+    return false;
+  }
+
+  if (best->op == Op::INT_RANGE)
+  {
+    rows = store.rows_in_range(best->field, best->min, best->max);
+  }
+  else
+  {
+    rows.reserve(best_cost);
+    for (auto id : best->atoms)
+    {
+      const auto& bucket = store.rows_with(best->field, Atom::from_value(id));
+      rows.insert(rows.end(), bucket.begin(), bucket.end());
+    }
+  }
+  // Keep row order so that the remaining passes walk the columns forward.
+  std::sort(rows.begin(), rows.end());
+
+  return true;
+}
+
+std::vector<ServerStore::Row>
+FilterPlan::walk_index(const ServerStore& store, const ServerQuery& q) const
+{
+  // Walks the ordered index in the requested direction and stops as soon as the page is full.
+  auto field = q.sort_key == ServerSortKey::PING ? ServerField::PING : ServerField::PLAYER_COUNT;
+  auto wanted = q.offset + q.limit;
+
+  const auto& index = store.sorted_by(field);
+  std::vector<ServerStore::Row> rows;
+  auto take = [this, &store, &rows, wanted](ServerStore::Row r) {
+    if (this->matches(store, r))
+    {
+      rows.push_back(r);
+    }
+    return rows.size() == wanted;
+  };
+
+  if (!q.descending)
+  {
+    for (const auto& e : index)
+    {
+      if (take(e.second))
+      {
+        return rows;
+      }
+    }
+  }
+  else
+  {
+    // Equal values are walked from the top down, each in ascending row order to match the comparator of the sorting path.
+    auto end = index.end();
+    while (end != index.begin())
+    {
+      auto begin = std::lower_bound(index.begin(), end, std::make_pair(std::prev(end)->first, ServerStore::Row(0)));
+      for (auto it = begin; it != end; ++it)
+      {
+        if (take(it->second))
+        {
+          return rows;
+        }
+      }
+      end = begin;
+    }
+  }
+
+  for (ServerStore::Row r = 0; r < store.size() && rows.size() < wanted; r++)
+  {
+    if (!store.has(field, r) && this->matches(store, r))
+    {
+      rows.push_back(r);
+    }
+  }
+  return rows;
+}
+
+std::vector<ServerStore::Row>
+FilterPlan::select(const ServerStore& store, const ServerQuery& q, size_t* total) const
+{
+  std::vector<ServerStore::Row> rows;
+
+  auto index_sorted = q.sort_key == ServerSortKey::PING || q.sort_key == ServerSortKey::PLAYER_COUNT;
+  if (index_sorted && store.indexed() && q.limit > 0 && !q.count_total)
+  {
+    rows = this->walk_index(store, q);
+  }
+  else
+  {
+    rows = this->select(store);
+    if (total)
+    {
+      *total = rows.size();
+    }
+
+    if (q.sort_key != ServerSortKey::NONE)
+    {
+      auto key = q.sort_key;
+      auto descending = q.descending;
+      auto less = [&store, key, descending](ServerStore::Row a, ServerStore::Row b) {
+        auto has_a = has_sort_field(store, key, a);
+        auto has_b = has_sort_field(store, key, b);
+        if (has_a != has_b)
+        {
+          return has_a;
+        }
+        auto c = has_a ? compare_sort_field(store, key, a, b) : 0;
+        if (c != 0)
+        {
+          return descending ? c > 0 : c < 0;
+        }
+        return a < b;
+      };
+
+      // Only the rows up to the end of the page need to be in order.
+      auto wanted = q.limit > 0 ? q.offset + q.limit : rows.size();
+      if (wanted < rows.size())
+      {
+        std::partial_sort(rows.begin(), rows.begin() + wanted, rows.end(), less);
+        rows.resize(wanted);
+      }
+      else
+      {
+        std::sort(rows.begin(), rows.end(), less);
+      }
+    }
+  }
+
+  if (q.offset >= rows.size())
+  {
+    rows.clear();
+  }
+  else
+  {
+    rows.erase(rows.begin(), rows.begin() + q.offset);
+  }
+  if (q.limit > 0 && rows.size() > q.limit)
+  {
+    rows.resize(q.limit);
+  }
+
+  return rows;
+}
+
+std::vector<ServerStore::Row>
+FilterPlan::select(const ServerStore& store) const
+{
+  std::vector<ServerStore::Row> rows;
+
+  if (!store.indexed() || !this->seed(store, rows))
+  {
+    rows.resize(store.size());
+    for (ServerStore::Row r = 0; r < rows.size(); r++)
+    {
+      rows[r] = r;
+    }
+  }
+
+  this->refine(store, rows);
+
+  return rows;
+}
+}
@@ -0,0 +1,132 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SERVER_FILTER_HPP_
+#define _SERVER_FILTER_HPP_
+
+#include <cstdint>
+#include <experimental/optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <glibmm.h>
+
+#include "server_store.hpp"
+#include "string_pool.hpp"
+
+namespace Obozrenie
+{
+// Atoms to match against; only membership matters, so they are kept in ID order.
+typedef std::set<Atom, AtomIdLess> AtomSet;
+
+// Declarative description of which servers to keep. Unset members do not constrain the result.
+struct ServerFilter
+{
+  std::experimental::optional<int> ping_min;
+  std::experimental::optional<int> ping_max;
+  std::experimental::optional<int> players_min;
+  std::experimental::optional<int> players_max;
+  bool not_full = false;
+  bool not_empty = false;
+  std::experimental::optional<bool> need_pass;
+  std::experimental::optional<bool> secure;
+  AtomSet countries;
+  AtomSet terrains;
+  AtomSet game_types;
+  AtomSet game_mods;
+  Glib::ustring name_contains;
+
+  bool empty() const;
+};
+
+enum class ServerSortKey
+{
+  NONE,
+  HOST,
+  NAME,
+  PING,
+  PLAYER_COUNT,
+  PLAYER_LIMIT,
+  GAME_TYPE,
+  TERRAIN
+};
+
+// A filtered, sorted window of servers. A limit of 0 means "everything after offset".
+// Servers lacking the sort field always come last, whichever the direction.
+struct ServerQuery
+{
+  ServerFilter filter;
+  ServerSortKey sort_key = ServerSortKey::NONE;
+  bool descending = false;
+  size_t offset = 0;
+  size_t limit = 0;
+  // Counting every match defeats early termination, so it has to be asked for.
+  bool count_total = false;
+};
+
+// A ServerFilter compiled into a sequence of single-column passes.
+// Cheap numeric and flag checks run first so that the string checks only see the rows that survived them.
+// On an indexed store the most selective indexed step provides the starting rows instead of a full scan.
+class FilterPlan
+{
+private:
+  enum class Op
+  {
+    INT_RANGE,
+    NOT_FULL,
+    NOT_EMPTY,
+    FLAG,
+    ATOM_IN,
+    NAME_CONTAINS
+  };
+
+  struct Step
+  {
+    Op op;
+    ServerField field;
+    int min;
+    int max;
+    bool flag;
+    std::vector<uint32_t> atoms;
+    std::string needle;
+  };
+
+  std::vector<Step> steps;
+  // Keeps the IDs in the steps from being reused while the plan lives.
+  std::vector<Atom> pinned;
+
+  static bool eval(const Step&, const ServerStore&, ServerStore::Row);
+  static void apply(const Step&, const ServerStore&, std::vector<ServerStore::Row>&);
+  bool seed(const ServerStore&, std::vector<ServerStore::Row>&) const;
+  std::vector<ServerStore::Row> walk_index(const ServerStore&, const ServerQuery&) const;
+
+public:
+  bool empty() const { return this->steps.empty(); }
+  bool matches(const ServerStore&, ServerStore::Row) const;
+  void refine(const ServerStore&, std::vector<ServerStore::Row>&) const;
+  std::vector<ServerStore::Row> select(const ServerStore&) const;
+  // Returns the requested page; total receives the number of matches when the query asks for it.
+  std::vector<ServerStore::Row> select(const ServerStore&, const ServerQuery&, size_t* total = nullptr) const;
+
+  FilterPlan() {}
+  explicit FilterPlan(const ServerFilter&);
+};
+}
+
+#endif
@@ -0,0 +1,586 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "server_store.hpp"
+
+#include <algorithm>
+#include <climits>
+
+namespace Obozrenie
+{
+namespace
+{
+template <typename T>
+void
+move_last(std::vector<T>& column, ServerStore::Row r)
+{
+  if (r != column.size() - 1)
+  {
+    column[r] = std::move(column.back());
+  }
+  column.pop_back();
+}
+
+void
+move_last(Bitmap& column, ServerStore::Row r)
+{
+  column.set(r, column.test(column.size() - 1));
+  column.pop_back();
+}
+
+template <typename T>
+void
+store_optional(Bitmap& present, std::vector<T>& column, ServerStore::Row r, const std::experimental::optional<T>& v)
+{
+  present.set(r, bool(v));
+  column[r] = v ? *v : T();
+}
+
+void
+store_optional(Bitmap& present, Bitmap& column, ServerStore::Row r, const std::experimental::optional<bool>& v)
+{
+  present.set(r, bool(v));
+  column.set(r, v ? *v : false);
+}
+
+template <typename T>
+std::experimental::optional<T>
+load_optional(const Bitmap& present, const std::vector<T>& column, ServerStore::Row r)
+{
+  return present.test(r) ? std::experimental::optional<T>(column[r]) : std::experimental::nullopt;
+}
+
+std::experimental::optional<bool>
+load_optional(const Bitmap& present, const Bitmap& column, ServerStore::Row r)
+{
+  return present.test(r) ? std::experimental::optional<bool>(column.test(r)) : std::experimental::nullopt;
+}
+
+template <typename T>
+bool
+optional_equals(const Bitmap& present, const std::vector<T>& column, ServerStore::Row r, const std::experimental::optional<T>& v)
+{
+  return present.test(r) == bool(v) && (!v || column[r] == *v);
+}
+
+bool
+optional_equals(const Bitmap& present, const Bitmap& column, ServerStore::Row r, const std::experimental::optional<bool>& v)
+{
+  return present.test(r) == bool(v) && (!v || column.test(r) == *v);
+}
+
+// Rows changed at once beyond which rebuilding the indexes beats updating them row by row.
+const size_t BULK_INDEX_MIN_ROWS = 64;
+
+typedef std::vector<std::pair<int, uint32_t>> OrderedIndex;
+typedef std::unordered_map<Atom, std::vector<uint32_t>> HashedIndex;
+
+void
+ordered_insert(OrderedIndex& index, int v, ServerStore::Row r)
+{
+  auto e = std::make_pair(v, r);
+  index.insert(std::lower_bound(index.begin(), index.end(), e), e);
+}
+
+void
+ordered_erase(OrderedIndex& index, int v, ServerStore::Row r)
+{
+  auto e = std::make_pair(v, r);
+  auto it = std::lower_bound(index.begin(), index.end(), e);
+  if (it != index.end() && *it == e)
+  {
+    index.erase(it);
+  }
+}
+
+void
+hashed_insert(HashedIndex& index, Atom v, ServerStore::Row r)
+{
+  auto& bucket = index[v];
+  bucket.insert(std::lower_bound(bucket.begin(), bucket.end(), r), r);
+}
+
+void
+hashed_erase(HashedIndex& index, Atom v, ServerStore::Row r)
+{
+  auto it = index.find(v);
+  if (it == index.end())
+  {
+    return;
+  }
+
+  auto& bucket = it->second;
+  auto pos = std::lower_bound(bucket.begin(), bucket.end(), r);
+  if (pos != bucket.end() && *pos == r)
+  {
+    bucket.erase(pos);
+  }
+  if (bucket.empty())
+  {
+    index.erase(it);
+  }
+}
+
+const OrderedIndex&
+ordered_index(const ServerIndexes& indexes, ServerField f)
+{
+  if (f == ServerField::PING)
+  {
+    return indexes.ping;
+  }
+  else if (f == ServerField::PLAYER_COUNT)
+  {
+    return indexes.player_count;
+  }
+  throw NotFoundError("No ordered index for the requested field");
+}
+
+const HashedIndex&
+hashed_index(const ServerIndexes& indexes, ServerField f)
+{
+  if (f == ServerField::COUNTRY)
+  {
+    return indexes.country;
+  }
+  else if (f == ServerField::TERRAIN)
+  {
+    return indexes.terrain;
+  }
+  else if (f == ServerField::GAME_TYPE)
+  {
+    return indexes.game_type;
+  }
+  throw NotFoundError("No hashed index for the requested field");
+}
+}
+
+const ServerStore::Row ServerStore::npos;
+
+ServerStore::ServerStore() : presence(size_t(ServerField::COUNT)), is_indexed(false), bulk(false)
+{
+}
+
+ServerStore::ServerStore(const ServerData& data, bool indexed) : ServerStore()
+{
+  this->hosts.reserve(data.size());
+  this->host_rows.reserve(data.size());
+  for (const auto& kv : data)
+  {
+    this->append(kv.first, kv.second);
+  }
+  this->set_indexed(indexed);
+}
+
+void
+ServerStore::set_indexed(bool v)
+{
+  if (v == this->is_indexed)
+  {
+    return;
+  }
+
+  this->is_indexed = v;
+  this->bulk = false;
+  this->indexes = ServerIndexes();
+  if (v)
+  {
+    this->build_indexes();
+  }
+}
+
+void
+ServerStore::begin_bulk(size_t rows)
+{
+  if (!this->is_indexed || this->bulk || rows < BULK_INDEX_MIN_ROWS)
+  {
+    return;
+  }
+
+  this->bulk = true;
+  this->indexes = ServerIndexes();
+}
+
+void
+ServerStore::end_bulk()
+{
+  if (!this->bulk)
+  {
+    return;
+  }
+
+  this->bulk = false;
+  this->build_indexes();
+}
+
+void
+ServerStore::build_indexes()
+{
+  // Bulk build: rows are visited in ascending order, so hashed buckets come out sorted without extra work.
+  auto& p = this->presence;
+  for (Row r = 0; r < this->size(); r++)
+  {
+    if (p[size_t(ServerField::PING)].test(r))
+    {
+      this->indexes.ping.emplace_back(this->pings[r], r);
+    }
+    if (p[size_t(ServerField::PLAYER_COUNT)].test(r))
+    {
+      this->indexes.player_count.emplace_back(this->player_counts[r], r);
+    }
+    if (p[size_t(ServerField::COUNTRY)].test(r))
+    {
+      this->indexes.country[this->countries[r]].push_back(r);
+    }
+    if (p[size_t(ServerField::TERRAIN)].test(r))
+    {
+      this->indexes.terrain[this->terrains[r]].push_back(r);
+    }
+    if (p[size_t(ServerField::GAME_TYPE)].test(r))
+    {
+      this->indexes.game_type[this->game_types[r]].push_back(r);
+    }
+  }
+  std::sort(this->indexes.ping.begin(), this->indexes.ping.end());
+  std::sort(this->indexes.player_count.begin(), this->indexes.player_count.end());
+}
+
+void
+ServerStore::index_row(Row r)
+{
+  if (!this->is_indexed || this->bulk)
+  {
+    return;
+  }
+
+  auto& p = this->presence;
+  if (p[size_t(ServerField::PING)].test(r))
+  {
+    ordered_insert(this->indexes.ping, this->pings[r], r);
+  }
+  if (p[size_t(ServerField::PLAYER_COUNT)].test(r))
+  {
+    ordered_insert(this->indexes.player_count, this->player_counts[r], r);
+  }
+  if (p[size_t(ServerField::COUNTRY)].test(r))
+  {
+    hashed_insert(this->indexes.country, this->countries[r], r);
+  }
+  if (p[size_t(ServerField::TERRAIN)].test(r))
+  {
+    hashed_insert(this->indexes.terrain, this->terrains[r], r);
+  }
+  if (p[size_t(ServerField::GAME_TYPE)].test(r))
+  {
+    hashed_insert(this->indexes.game_type, this->game_types[r], r);
+  }
+}
+
+void
+ServerStore::unindex_row(Row r)
+{
+  if (!this->is_indexed || this->bulk)
+  {
+    return;
+  }
+
+  auto& p = this->presence;
+  if (p[size_t(ServerField::PING)].test(r))
+  {
+    ordered_erase(this->indexes.ping, this->pings[r], r);
+  }
+  if (p[size_t(ServerField::PLAYER_COUNT)].test(r))
+  {
+    ordered_erase(this->indexes.player_count, this->player_counts[r], r);
+  }
+  if (p[size_t(ServerField::COUNTRY)].test(r))
+  {
+    hashed_erase(this->indexes.country, this->countries[r], r);
+  }
+  if (p[size_t(ServerField::TERRAIN)].test(r))
+  {
+    hashed_erase(this->indexes.terrain, this->terrains[r], r);
+  }
+  if (p[size_t(ServerField::GAME_TYPE)].test(r))
+  {
+    hashed_erase(this->indexes.game_type, this->game_types[r], r);
+  }
+}
+
+std::vector<ServerStore::Row>
+ServerStore::rows_in_range(ServerField f, int min, int max) const
+{
+  std::vector<Row> v;
+
+  if (this->is_indexed)
+  {
+    const auto& index = ordered_index(this->indexes, f);
+    auto begin = std::lower_bound(index.begin(), index.end(), std::make_pair(min, Row(0)));
+    auto end = std::upper_bound(begin, index.end(), std::make_pair(max, npos));
+    v.reserve(end - begin);
+    for (auto it = begin; it != end; ++it)
+    {
+      v.push_back(it->second);
+    }
+    return v;
+  }
+
+  const auto& column = f == ServerField::PING ? this->pings : this->player_counts;
+  std::vector<std::pair<int, Row>> matched;
+  for (Row r = 0; r < this->size(); r++)
+  {
+    if (this->has(f, r) && column[r] >= min && column[r] <= max)
+    {
+      matched.emplace_back(column[r], r);
+    }
+  }
+  std::sort(matched.begin(), matched.end());
+  for (const auto& e : matched)
+  {
+    v.push_back(e.second);
+  }
+  return v;
+}
+
+size_t
+ServerStore::count_in_range(ServerField f, int min, int max) const
+{
+  const auto& index = ordered_index(this->indexes, f);
+  auto begin = std::lower_bound(index.begin(), index.end(), std::make_pair(min, Row(0)));
+  auto end = std::upper_bound(begin, index.end(), std::make_pair(max, npos));
+  return end - begin;
+}
+
+const std::vector<std::pair<int, ServerStore::Row>>&
+ServerStore::sorted_by(ServerField f) const
+{
+  if (!this->is_indexed)
+  {
+    throw NotFoundError("Server store is not indexed");
+  }
+
+  return ordered_index(this->indexes, f);
+}
+
+const std::vector<ServerStore::Row>&
+ServerStore::rows_with(ServerField f, Atom v) const
+{
+  static const std::vector<Row> none;
+
+  if (!this->is_indexed)
+  {
+    throw NotFoundError("Server store is not indexed");
+  }
+
+  const auto& index = hashed_index(this->indexes, f);
+  auto it = index.find(v);
+  return it == index.end() ? none : it->second;
+}
+
+ServerStore::Row
+ServerStore::find(const Glib::ustring& host) const
+{
+  auto it = this->host_rows.find(host.raw());
+  return it == this->host_rows.end() ? npos : it->second;
+}
+
+void
+ServerStore::append(const Glib::ustring& host, const Server& v)
+{
+  auto r = Row(this->hosts.size());
+
+  this->hosts.push_back(host);
+  this->host_rows[host.raw()] = r;
+
+  for (auto& p : this->presence)
+  {
+    p.push_back(false);
+  }
+  this->names.emplace_back();
+  this->countries.emplace_back();
+  this->game_mods.emplace_back();
+  this->game_types.emplace_back();
+  this->terrains.emplace_back();
+  this->versions.emplace_back();
+  this->need_pass_flags.push_back(false);
+  this->secure_flags.push_back(false);
+  this->player_counts.push_back(0);
+  this->player_limits.push_back(0);
+  this->spectator_counts.push_back(0);
+  this->spectator_limits.push_back(0);
+  this->pings.push_back(0);
+  this->rule_sets.emplace_back();
+  this->player_lists.emplace_back();
+
+  this->assign(r, v);
+  this->index_row(r);
+}
+
+void
+ServerStore::assign(Row r, const Server& v)
+{
+  auto& p = this->presence;
+  store_optional(p[size_t(ServerField::NAME)], this->names, r, v.name);
+  store_optional(p[size_t(ServerField::COUNTRY)], this->countries, r, v.country);
+  store_optional(p[size_t(ServerField::GAME_MOD)], this->game_mods, r, v.game_mod);
+  store_optional(p[size_t(ServerField::GAME_TYPE)], this->game_types, r, v.game_type);
+  store_optional(p[size_t(ServerField::NEED_PASS)], this->need_pass_flags, r, v.need_pass);
+  store_optional(p[size_t(ServerField::SECURE)], this->secure_flags, r, v.secure);
+  store_optional(p[size_t(ServerField::PLAYER_COUNT)], this->player_counts, r, v.player_count);
+  store_optional(p[size_t(ServerField::PLAYER_LIMIT)], this->player_limits, r, v.player_limit);
+  store_optional(p[size_t(ServerField::SPECTATOR_COUNT)], this->spectator_counts, r, v.spectator_count);
+  store_optional(p[size_t(ServerField::SPECTATOR_LIMIT)], this->spectator_limits, r, v.spectator_limit);
+  store_optional(p[size_t(ServerField::TERRAIN)], this->terrains, r, v.terrain);
+  store_optional(p[size_t(ServerField::PING)], this->pings, r, v.ping);
+  store_optional(p[size_t(ServerField::VERSION)], this->versions, r, v.version);
+  this->rule_sets[r] = v.rules;
+  this->player_lists[r] = v.players;
+}
+
+void
+ServerStore::remove_row(Row r)
+{
+  auto last = Row(this->hosts.size() - 1);
+
+  this->unindex_row(r);
+  if (r != last)
+  {
+    this->unindex_row(last);
+  }
+
+  this->host_rows.erase(this->hosts[r].raw());
+  if (r != last)
+  {
+    this->host_rows[this->hosts[last].raw()] = r;
+  }
+
+  move_last(this->hosts, r);
+  for (auto& p : this->presence)
+  {
+    move_last(p, r);
+  }
+  move_last(this->names, r);
+  move_last(this->countries, r);
+  move_last(this->game_mods, r);
+  move_last(this->game_types, r);
+  move_last(this->terrains, r);
+  move_last(this->versions, r);
+  move_last(this->need_pass_flags, r);
+  move_last(this->secure_flags, r);
+  move_last(this->player_counts, r);
+  move_last(this->player_limits, r);
+  move_last(this->spectator_counts, r);
+  move_last(this->spectator_limits, r);
+  move_last(this->pings, r);
+  move_last(this->rule_sets, r);
+  move_last(this->player_lists, r);
+
+  if (r != last)
+  {
+    this->index_row(r);
+  }
+}
+
+Server
+ServerStore::get(Row r) const
+{
+  const auto& p = this->presence;
+
+  Server v;
+  v.name = load_optional(p[size_t(ServerField::NAME)], this->names, r);
+  v.country = load_optional(p[size_t(ServerField::COUNTRY)], this->countries, r);
+  v.game_mod = load_optional(p[size_t(ServerField::GAME_MOD)], this->game_mods, r);
+  v.game_type = load_optional(p[size_t(ServerField::GAME_TYPE)], this->game_types, r);
+  v.need_pass = load_optional(p[size_t(ServerField::NEED_PASS)], this->need_pass_flags, r);
+  v.secure = load_optional(p[size_t(ServerField::SECURE)], this->secure_flags, r);
+  v.player_count = load_optional(p[size_t(ServerField::PLAYER_COUNT)], this->player_counts, r);
+  v.player_limit = load_optional(p[size_t(ServerField::PLAYER_LIMIT)], this->player_limits, r);
+  v.spectator_count = load_optional(p[size_t(ServerField::SPECTATOR_COUNT)], this->spectator_counts, r);
+  v.spectator_limit = load_optional(p[size_t(ServerField::SPECTATOR_LIMIT)], this->spectator_limits, r);
+  v.terrain = load_optional(p[size_t(ServerField::TERRAIN)], this->terrains, r);
+  v.ping = load_optional(p[size_t(ServerField::PING)], this->pings, r);
+  v.version = load_optional(p[size_t(ServerField::VERSION)], this->versions, r);
+  v.rules = this->rule_sets[r];
+  v.players = this->player_lists[r];
+
+  return v;
+}
+
+bool
+ServerStore::equals(Row r, const Server& v) const
+{
+  const auto& p = this->presence;
+
+  return optional_equals(p[size_t(ServerField::PING)], this->pings, r, v.ping) && optional_equals(p[size_t(ServerField::PLAYER_COUNT)], this->player_counts, r, v.player_count) &&
+         optional_equals(p[size_t(ServerField::PLAYER_LIMIT)], this->player_limits, r, v.player_limit) &&
+         optional_equals(p[size_t(ServerField::SPECTATOR_COUNT)], this->spectator_counts, r, v.spectator_count) &&
+         optional_equals(p[size_t(ServerField::SPECTATOR_LIMIT)], this->spectator_limits, r, v.spectator_limit) &&
+         optional_equals(p[size_t(ServerField::NEED_PASS)], this->need_pass_flags, r, v.need_pass) && optional_equals(p[size_t(ServerField::SECURE)], this->secure_flags, r, v.secure) &&
+         optional_equals(p[size_t(ServerField::NAME)], this->names, r, v.name) && optional_equals(p[size_t(ServerField::COUNTRY)], this->countries, r, v.country) &&
+         optional_equals(p[size_t(ServerField::GAME_MOD)], this->game_mods, r, v.game_mod) && optional_equals(p[size_t(ServerField::GAME_TYPE)], this->game_types, r, v.game_type) &&
+         optional_equals(p[size_t(ServerField::TERRAIN)], this->terrains, r, v.terrain) && optional_equals(p[size_t(ServerField::VERSION)], this->versions, r, v.version) &&
+         this->rule_sets[r] == v.rules && this->player_lists[r] == v.players;
+}
+
+ServerData
+ServerStore::to_server_data() const
+{
+  ServerData v;
+  for (Row r = 0; r < this->size(); r++)
+  {
+    v.emplace(this->hosts[r], this->get(r));
+  }
+  return v;
+}
+
+bool
+ServerStore::set(const Glib::ustring& host, const Server& v)
+{
+  auto r = this->find(host);
+  if (r == npos)
+  {
+    this->append(host, v);
+    return true;
+  }
+
+  this->unindex_row(r);
+  this->assign(r, v);
+  this->index_row(r);
+  return false;
+}
+
+bool
+ServerStore::erase(const Glib::ustring& host)
+{
+  auto r = this->find(host);
+  if (r == npos)
+  {
+    return false;
+  }
+
+  this->remove_row(r);
+  return true;
+}
+
+void
+ServerStore::clear()
+{
+  auto indexed = this->is_indexed;
+  *this = ServerStore();
+  this->set_indexed(indexed);
+}
+}
@@ -0,0 +1,208 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SERVER_STORE_HPP_
+#define _SERVER_STORE_HPP_
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glibmm.h>
+
+#include "common_models.hpp"
+
+namespace Obozrenie
+{
+// Packed bit vector used for presence flags and boolean columns.
+class Bitmap
+{
+private:
+  std::vector<uint64_t> words;
+  size_t bits = 0;
+
+public:
+  size_t size() const { return this->bits; }
+  bool test(size_t i) const { return (this->words[i / 64] >> (i % 64)) & 1; }
+  void set(size_t i, bool v)
+  {
+    if (v)
+    {
+      this->words[i / 64] |= (uint64_t(1) << (i % 64));
+    }
+    else
+    {
+      this->words[i / 64] &= ~(uint64_t(1) << (i % 64));
+    }
+  }
+  void push_back(bool v)
+  {
+    if (this->bits % 64 == 0)
+    {
+      this->words.push_back(0);
+    }
+    this->set(this->bits++, v);
+  }
+  void pop_back()
+  {
+    this->set(--this->bits, false);
+    if (this->bits % 64 == 0)
+    {
+      this->words.pop_back();
+    }
+  }
+  void clear()
+  {
+    this->words.clear();
+    this->bits = 0;
+  }
+};
+
+enum class ServerField
+{
+  NAME,
+  COUNTRY,
+  GAME_MOD,
+  GAME_TYPE,
+  NEED_PASS,
+  SECURE,
+  PLAYER_COUNT,
+  PLAYER_LIMIT,
+  SPECTATOR_COUNT,
+  SPECTATOR_LIMIT,
+  TERRAIN,
+  PING,
+  VERSION,
+  COUNT
+};
+
+// Optional secondary indexes of a ServerStore.
+// Ordered indexes hold (value, row) pairs; hashed indexes map an atom to the rows holding it, sorted by row.
+struct ServerIndexes
+{
+  std::vector<std::pair<int, uint32_t>> ping;
+  std::vector<std::pair<int, uint32_t>> player_count;
+  std::unordered_map<Atom, std::vector<uint32_t>> country;
+  std::unordered_map<Atom, std::vector<uint32_t>> terrain;
+  std::unordered_map<Atom, std::vector<uint32_t>> game_type;
+};
+
+// Column-oriented storage for the servers of one game.
+// Every field lives in its own contiguous array indexed by row, with a presence bit replacing the optional.
+// Rows are not ordered; erasing a row moves the last one into its place.
+class ServerStore
+{
+public:
+  typedef uint32_t Row;
+  static const Row npos = Row(-1);
+
+private:
+  std::vector<Glib::ustring> hosts;
+  std::unordered_map<std::string, Row> host_rows;
+
+  std::vector<Bitmap> presence;
+
+  std::vector<Glib::ustring> names;
+  std::vector<Atom> countries;
+  std::vector<Atom> game_mods;
+  std::vector<Atom> game_types;
+  std::vector<Atom> terrains;
+  std::vector<Atom> versions;
+  Bitmap need_pass_flags;
+  Bitmap secure_flags;
+  std::vector<int> player_counts;
+  std::vector<int> player_limits;
+  std::vector<int> spectator_counts;
+  std::vector<int> spectator_limits;
+  std::vector<int> pings;
+  std::vector<std::map<Atom, Glib::ustring>> rule_sets;
+  std::vector<std::list<Player>> player_lists;
+
+  bool is_indexed;
+  bool bulk;
+  ServerIndexes indexes;
+
+  void append(const Glib::ustring&, const Server&);
+  void assign(Row, const Server&);
+  void remove_row(Row);
+
+  void build_indexes();
+  void index_row(Row);
+  void unindex_row(Row);
+
+public:
+  size_t size() const { return this->hosts.size(); }
+  bool empty() const { return this->hosts.empty(); }
+
+  Row find(const Glib::ustring&) const;
+  bool has(ServerField f, Row r) const { return this->presence[size_t(f)].test(r); }
+
+  const Glib::ustring& host(Row r) const { return this->hosts[r]; }
+  const Glib::ustring& name(Row r) const { return this->names[r]; }
+  Atom country(Row r) const { return this->countries[r]; }
+  Atom game_mod(Row r) const { return this->game_mods[r]; }
+  Atom game_type(Row r) const { return this->game_types[r]; }
+  Atom terrain(Row r) const { return this->terrains[r]; }
+  Atom version(Row r) const { return this->versions[r]; }
+  bool need_pass(Row r) const { return this->need_pass_flags.test(r); }
+  bool secure(Row r) const { return this->secure_flags.test(r); }
+  const std::map<Atom, Glib::ustring>& rules(Row r) const { return this->rule_sets[r]; }
+  const std::list<Player>& players(Row r) const { return this->player_lists[r]; }
+
+  const std::vector<Atom>& country_column() const { return this->countries; }
+  const std::vector<Atom>& game_mod_column() const { return this->game_mods; }
+  const std::vector<Atom>& game_type_column() const { return this->game_types; }
+  const std::vector<Atom>& terrain_column() const { return this->terrains; }
+  const std::vector<int>& player_count_column() const { return this->player_counts; }
+  const std::vector<int>& player_limit_column() const { return this->player_limits; }
+  const std::vector<int>& spectator_count_column() const { return this->spectator_counts; }
+  const std::vector<int>& spectator_limit_column() const { return this->spectator_limits; }
+  const std::vector<int>& ping_column() const { return this->pings; }
+
+  bool indexed() const { return this->is_indexed; }
+  void set_indexed(bool);
+  // Brackets a batch of set and erase calls touching about the given number of rows. Keeping a sorted index current costs O(n)
+  // per row, so past a few dozen rows the indexes are dropped instead and end_bulk rebuilds them with one sort.
+  // Index queries must not run in between.
+  void begin_bulk(size_t);
+  void end_bulk();
+  // Rows whose ping or player count lies in [min, max], ordered by that value.
+  std::vector<Row> rows_in_range(ServerField, int, int) const;
+  size_t count_in_range(ServerField, int, int) const;
+  // The ordered index of ping or player count itself: (value, row) pairs in ascending order.
+  const std::vector<std::pair<int, Row>>& sorted_by(ServerField) const;
+  // Rows whose country, terrain or game type equals the atom, ordered by row.
+  const std::vector<Row>& rows_with(ServerField, Atom) const;
+
+  Server get(Row) const;
+  bool equals(Row, const Server&) const;
+  ServerData to_server_data() const;
+
+  bool set(const Glib::ustring&, const Server&);
+  bool erase(const Glib::ustring&);
+  void clear();
+
+  ServerStore();
+  explicit ServerStore(const ServerData&, bool = false);
+};
+}
+
+#endif
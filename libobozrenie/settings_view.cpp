@@ -0,0 +1,77 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "settings_view.hpp"
+
+namespace Obozrenie
+{
+namespace
+{
+template <typename T>
+T
+variant_value(const Glib::VariantBase& v)
+{
+  return Glib::VariantBase::cast_dynamic<Glib::Variant<T>>(v).get();
+}
+}
+
+bool
+SettingsView::set(const Glib::ustring& k, const Glib::VariantBase& v)
+{
+  if (!v.gobj())
+  {
+    this->values.erase(k.raw());
+    return true;
+  }
+
+  SettingValue value;
+  auto t = v.get_type_string();
+  if (t == "b")
+  {
+    value = variant_value<bool>(v);
+  }
+  else if (t == "i")
+  {
+    value = variant_value<int32_t>(v);
+  }
+  else if (t == "x")
+  {
+    value = variant_value<int64_t>(v);
+  }
+  else if (t == "d")
+  {
+    value = variant_value<double>(v);
+  }
+  else if (t == "s")
+  {
+    value = variant_value<std::string>(v);
+  }
+  else if (t == "as")
+  {
+    value = variant_value<std::vector<std::string>>(v);
+  }
+  else
+  {
+    this->values.erase(k.raw());
+    return false;
+  }
+
+  this->values[k.raw()] = std::move(value);
+  return true;
+}
+}
@@ -0,0 +1,90 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _SETTINGS_VIEW_HPP_
+#define _SETTINGS_VIEW_HPP_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/variant.hpp>
+#include <glibmm.h>
+
+#include "exceptions.hpp"
+
+namespace Obozrenie
+{
+// Name of a setting together with the C++ type its value decodes to.
+template <typename T>
+struct SettingKey
+{
+  const char* name;
+
+  constexpr SettingKey(const char* v) : name(v) {}
+};
+
+typedef boost::variant<bool, int32_t, int64_t, double, std::string, std::vector<std::string>> SettingValue;
+
+// Settings of one group decoded from their variants into native values.
+// Views are rebuilt whenever a setting changes, so readers only pay for a map lookup without allocating.
+class SettingsView
+{
+private:
+  std::map<std::string, SettingValue, std::less<>> values;
+
+public:
+  size_t size() const { return this->values.size(); }
+
+  // Returns nullptr if the setting is unset or holds another type.
+  template <typename T>
+  const T* find(SettingKey<T> k) const
+  {
+    auto it = this->values.find(k.name);
+    if (it == this->values.end())
+    {
+      return nullptr;
+    }
+    return boost::get<T>(&it->second);
+  }
+
+  template <typename T>
+  const T& get(SettingKey<T> k) const
+  {
+    auto it = this->values.find(k.name);
+    if (it == this->values.end())
+    {
+      throw BackendError(std::string("Missing setting in the provided SettingsView : ") + k.name);
+    }
+    auto v = boost::get<T>(&it->second);
+    if (!v)
+    {
+      throw BackendError(std::string("Invalid type of setting in SettingsView : ") + k.name);
+    }
+    return *v;
+  }
+
+  // Decodes and stores the variant. Returns false if its type has no native counterpart.
+  bool set(const Glib::ustring&, const Glib::VariantBase&);
+  void erase(const Glib::ustring& k) { this->values.erase(k.raw()); }
+};
+}
+
+#endif
@@ -0,0 +1,150 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "string_pool.hpp"
+
+namespace Obozrenie
+{
+StringPool::StringPool()
+{
+  for (auto& c : this->chunks)
+  {
+    c.store(nullptr, std::memory_order_relaxed);
+  }
+  this->count = 0;
+  this->unreferenced.store(0, std::memory_order_relaxed);
+
+  // ID 0 is reserved for the empty string so that a default constructed Atom is valid.
+  this->intern(std::string());
+}
+
+StringPool::~StringPool()
+{
+  for (auto& c : this->chunks)
+  {
+    delete[] c.load(std::memory_order_relaxed);
+  }
+}
+
+StringPool&
+StringPool::global()
+{
+  // Leaked so that atoms destroyed late during exit can still release their strings.
+  static StringPool* v = new StringPool;
+  return *v;
+}
+
+uint32_t
+StringPool::intern(const std::string& v)
+{
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(this->m);
+    auto it = this->ids.find(v);
+    if (it != this->ids.end())
+    {
+      this->acquire(it->second);
+      return it->second;
+    }
+  }
+
+  std::unique_lock<std::shared_timed_mutex> lock(this->m);
+  auto it = this->ids.find(v);
+  if (it != this->ids.end())
+  {
+    this->acquire(it->second);
+    return it->second;
+  }
+
+  auto garbage = this->unreferenced.load(std::memory_order_relaxed);
+  if (garbage >= COLLECT_THRESHOLD && garbage * 4 >= this->ids.size())
+  {
+    this->collect_locked();
+  }
+
+  if (this->free_ids.empty() && (this->count >> CHUNK_BITS) >= MAX_CHUNKS)
+  {
+    // Out of fresh IDs, so only a sweep can make room.
+    this->collect_locked();
+    if (this->free_ids.empty())
+    {
+      throw StringPoolFullError();
+    }
+  }
+
+  uint32_t id;
+  if (!this->free_ids.empty())
+  {
+    id = this->free_ids.back();
+    this->free_ids.pop_back();
+  }
+  else
+  {
+    id = this->count++;
+    auto& chunk = this->chunks[id >> CHUNK_BITS];
+    if (!chunk.load(std::memory_order_relaxed))
+    {
+      chunk.store(new Entry[CHUNK_SIZE], std::memory_order_release);
+    }
+  }
+
+  auto& e = this->entry(id);
+  e.value = v;
+  e.refs.store(1, std::memory_order_relaxed);
+  this->ids.emplace(v, id);
+
+  return id;
+}
+
+size_t
+StringPool::collect_locked()
+{
+  // Nothing can revive an unreferenced string behind the lock: interning is blocked and no atom holds its ID to copy from.
+  size_t freed = 0;
+  for (auto it = this->ids.begin(); it != this->ids.end();)
+  {
+    auto& e = this->entry(it->second);
+    if (it->second != 0 && e.refs.load(std::memory_order_acquire) == 0)
+    {
+      Glib::ustring().swap(e.value);
+      this->free_ids.push_back(it->second);
+      it = this->ids.erase(it);
+      freed++;
+    }
+    else
+    {
+      ++it;
+    }
+  }
+  this->unreferenced.store(0, std::memory_order_relaxed);
+  return freed;
+}
+
+size_t
+StringPool::collect()
+{
+  std::unique_lock<std::shared_timed_mutex> lock(this->m);
+  return this->collect_locked();
+}
+
+size_t
+StringPool::size() const
+{
+  std::shared_lock<std::shared_timed_mutex> lock(this->m);
+  return this->ids.size();
+}
+}
@@ -0,0 +1,191 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _STRING_POOL_HPP_
+#define _STRING_POOL_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <glibmm.h>
+
+#include "exceptions.hpp"
+
+namespace Obozrenie
+{
+DEFINE_EXCEPTION(StringPoolFullError, "String pool capacity exhausted");
+
+// Process-wide pool of interned strings.
+// Map names and rule keys come from the network, so strings are reference counted by the atoms holding them. Strings nobody refers
+// to any more are swept once enough of them have piled up, or when the pool runs out of IDs, and their IDs are handed out again.
+// Lookups by ID are lock-free; interning takes a lock only when the string has not been seen before.
+class StringPool
+{
+private:
+  static const size_t CHUNK_BITS = 12;
+  static const size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+  static const size_t MAX_CHUNKS = 1024;
+  // Unreferenced strings tolerated before a sweep, unless they make up less than a quarter of the pool.
+  static const size_t COLLECT_THRESHOLD = 4096;
+
+  struct Entry
+  {
+    Glib::ustring value;
+    std::atomic<uint32_t> refs{ 0 };
+  };
+
+  mutable std::shared_timed_mutex m;
+  std::unordered_map<std::string, uint32_t> ids;
+  std::atomic<Entry*> chunks[MAX_CHUNKS];
+  std::vector<uint32_t> free_ids;
+  uint32_t count;
+  std::atomic<size_t> unreferenced;
+
+  Entry& entry(uint32_t id) const { return this->chunks[id >> CHUNK_BITS].load(std::memory_order_acquire)[id & (CHUNK_SIZE - 1)]; }
+  size_t collect_locked();
+
+public:
+  // Returns the ID with a reference taken, which the caller hands back through release.
+  uint32_t intern(const std::string&);
+  const Glib::ustring& get(uint32_t id) const { return this->entry(id).value; }
+
+  // ID 0 is the empty string, which is never freed and therefore not counted.
+  void acquire(uint32_t id)
+  {
+    if (id != 0)
+    {
+      this->entry(id).refs.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  void release(uint32_t id)
+  {
+    if (id != 0 && this->entry(id).refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+      this->unreferenced.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  // Frees every string no atom refers to and returns how many were freed.
+  size_t collect();
+  // Strings currently interned, including unreferenced ones not yet swept.
+  size_t size() const;
+
+  static StringPool& global();
+
+  StringPool();
+  StringPool(const StringPool&) = delete;
+  ~StringPool();
+};
+
+// Handle to a string in the global pool. Testing two atoms for equality is an integer compare.
+// operator< orders atoms by their strings, so that maps keyed by atoms iterate the same way in every run; sets and maps only used
+// for lookups can take AtomIdLess instead.
+// An ID is only meaningful while some atom holding it is alive; afterwards it may be reused for another string.
+class Atom
+{
+private:
+  uint32_t id;
+
+public:
+  uint32_t value() const { return this->id; }
+  const Glib::ustring& str() const { return StringPool::global().get(this->id); }
+  operator const Glib::ustring&() const { return this->str(); }
+  bool empty() const { return this->id == 0; }
+
+  // The ID has to be kept alive by another atom for the duration of the call.
+  static Atom from_value(uint32_t v)
+  {
+    Atom a;
+    a.id = v;
+    StringPool::global().acquire(v);
+    return a;
+  }
+
+  Atom() : id(0) {}
+  Atom(const char* v) : id(StringPool::global().intern(v)) {}
+  Atom(const std::string& v) : id(StringPool::global().intern(v)) {}
+  Atom(const Glib::ustring& v) : id(StringPool::global().intern(v.raw())) {}
+  Atom(const Atom& v) : id(v.id) { StringPool::global().acquire(this->id); }
+  Atom(Atom&& v) noexcept : id(v.id) { v.id = 0; }
+  Atom& operator=(const Atom& v)
+  {
+    if (this->id != v.id)
+    {
+      StringPool::global().acquire(v.id);
+      StringPool::global().release(this->id);
+      this->id = v.id;
+    }
+    return *this;
+  }
+  Atom& operator=(Atom&& v) noexcept
+  {
+    std::swap(this->id, v.id);
+    return *this;
+  }
+  ~Atom() { StringPool::global().release(this->id); }
+};
+
+inline bool
+operator==(const Atom& a, const Atom& b)
+{
+  return a.value() == b.value();
+}
+
+inline bool
+operator!=(const Atom& a, const Atom& b)
+{
+  return a.value() != b.value();
+}
+
+inline bool
+operator<(const Atom& a, const Atom& b)
+{
+  return a.value() != b.value() && a.str().raw() < b.str().raw();
+}
+
+// Orders atoms by ID, which is cheaper but follows interning order and changes from run to run.
+struct AtomIdLess
+{
+  bool operator()(const Atom& a, const Atom& b) const { return a.value() < b.value(); }
+};
+
+inline std::ostream&
+operator<<(std::ostream& os, const Atom& v)
+{
+  return os << v.str();
+}
+}
+
+namespace std
+{
+template <>
+struct hash<Obozrenie::Atom>
+{
+  size_t operator()(const Obozrenie::Atom& v) const { return std::hash<uint32_t>()(v.value()); }
+};
+}
+
+#endif
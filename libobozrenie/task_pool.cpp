@@ -0,0 +1,336 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "task_pool.hpp"
+
+#include <algorithm>
+
+namespace Obozrenie
+{
+namespace
+{
+// Lets post() recognise calls made from one of the pool's own workers.
+thread_local const void* current_pool = nullptr;
+thread_local size_t current_worker = 0;
+thread_local TaskPriority current_priority = TaskPriority::USER;
+}
+
+TaskPriority
+current_task_priority()
+{
+  return current_priority;
+}
+
+bool
+TaskPool::State::take(size_t self, Task& task, TaskPriority& priority)
+{
+  auto n = this->workers.size();
+  for (size_t p = 0; p < TASK_PRIORITY_COUNT; p++)
+  {
+    {
+      auto& w = *this->workers[self];
+      std::lock_guard<std::mutex> lock(w.m);
+      auto& q = w.queues[p];
+      if (!q.empty())
+      {
+        task = std::move(q.front());
+        q.pop_front();
+        priority = TaskPriority(p);
+        return true;
+      }
+    }
+    for (size_t k = 1; k < n; k++)
+    {
+      auto& w = *this->workers[(self + k) % n];
+      std::lock_guard<std::mutex> lock(w.m);
+      auto& q = w.queues[p];
+      if (!q.empty())
+      {
+        task = std::move(q.back());
+        q.pop_back();
+        priority = TaskPriority(p);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void
+TaskPool::State::run(size_t self)
+{
+  current_pool = this;
+  current_worker = self;
+
+  for (;;)
+  {
+    Task task;
+    if (this->take(self, task, current_priority))
+    {
+      this->pending.fetch_sub(1);
+      try
+      {
+        task();
+      }
+      catch (...)
+      {
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(this->idle_mutex);
+    this->idle.wait(lock, [this]() { return this->pending.load() > 0 || this->stopping; });
+    if (this->stopping && this->pending.load() == 0)
+    {
+      return;
+    }
+  }
+}
+
+void
+TaskPool::State::post(Task task, TaskPriority p)
+{
+  // Workers may keep posting while the pool drains. Their tasks land on their own deque, which they empty before exiting.
+  auto own = current_pool == this;
+  if (!own && !this->accepting.load())
+  {
+    throw TaskPoolStoppedError();
+  }
+
+  // Counted before it is queued, so that a worker taking it at once cannot bring the counter below zero.
+  this->pending.fetch_add(1);
+  auto target = own ? current_worker : this->next_worker.fetch_add(1) % this->workers.size();
+  {
+    auto& w = *this->workers[target];
+    std::lock_guard<std::mutex> lock(w.m);
+    w.queues[size_t(p)].push_back(std::move(task));
+  }
+
+  // Taking the lock orders the increment before any worker's check of the counter, so the wakeup cannot be lost.
+  {
+    std::lock_guard<std::mutex> lock(this->idle_mutex);
+  }
+  this->idle.notify_one();
+}
+
+void
+TaskPool::post(Task task, TaskPriority p)
+{
+  if (task)
+  {
+    this->state->post(std::move(task), p);
+  }
+}
+
+void
+TaskPool::shutdown()
+{
+  this->state->accepting.store(false);
+  {
+    std::lock_guard<std::mutex> lock(this->state->idle_mutex);
+    this->state->stopping = true;
+  }
+  this->state->idle.notify_all();
+
+  for (auto& t : this->threads)
+  {
+    if (t.joinable() && t.get_id() != std::this_thread::get_id())
+    {
+      t.join();
+    }
+  }
+}
+
+TaskPool::TaskPool(size_t thread_count) : state(std::make_shared<State>())
+{
+  thread_count = std::max<size_t>(1, thread_count);
+  for (size_t i = 0; i < thread_count; i++)
+  {
+    this->state->workers.emplace_back(new Worker);
+  }
+  for (size_t i = 0; i < thread_count; i++)
+  {
+    this->threads.emplace_back([state = this->state, i]() { state->run(i); });
+  }
+}
+
+// Only the calling worker can still be joinable here. It holds the state, not the pool, so it may outlive the pool.
+TaskPool::~TaskPool()
+{
+  this->shutdown();
+  for (auto& t : this->threads)
+  {
+    if (t.joinable())
+    {
+      t.detach();
+    }
+  }
+}
+
+std::shared_ptr<TaskPool>
+default_task_pool()
+{
+  static auto pool = new std::shared_ptr<TaskPool>(std::make_shared<TaskPool>(std::max(DEFAULT_TASK_POOL_MIN_SIZE, default_parallelism())));
+  return *pool;
+}
+
+void
+TaskLimiter::start(Task task, TaskPriority p)
+{
+  auto self = this->shared_from_this();
+  try
+  {
+    this->dispatch(
+      [self, task = std::move(task)]() mutable {
+        try
+        {
+          task();
+        }
+        catch (...)
+        {
+          self->release();
+          throw;
+        }
+        self->release();
+      },
+      p);
+  }
+  catch (...)
+  {
+    this->release();
+    throw;
+  }
+}
+
+bool
+TaskLimiter::hand_over(std::vector<std::pair<Task, TaskPriority>>& ready)
+{
+  for (size_t i = 0; i < TASK_PRIORITY_COUNT; i++)
+  {
+    auto& q = this->queues[i];
+    if (!q.empty())
+    {
+      auto entry = std::move(q.front());
+      q.pop_front();
+      this->running++;
+      if (entry.granted)
+      {
+        *entry.granted = true;
+      }
+      else
+      {
+        ready.emplace_back(std::move(entry.task), TaskPriority(i));
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+TaskLimiter::release()
+{
+  std::vector<std::pair<Task, TaskPriority>> ready;
+  bool granted = false;
+  {
+    std::lock_guard<std::mutex> lock(this->m);
+    this->running--;
+    granted = this->has_slot() && this->hand_over(ready) && ready.empty();
+  }
+  if (granted)
+  {
+    this->released.notify_all();
+  }
+  for (auto& t : ready)
+  {
+    this->start(std::move(t.first), t.second);
+  }
+}
+
+size_t
+TaskLimiter::get_limit()
+{
+  std::lock_guard<std::mutex> lock(this->m);
+  return this->limit;
+}
+
+void
+TaskLimiter::set_limit(size_t v)
+{
+  std::vector<std::pair<Task, TaskPriority>> ready;
+  {
+    std::lock_guard<std::mutex> lock(this->m);
+    this->limit = v;
+    while (this->has_slot() && this->hand_over(ready))
+    {
+    }
+  }
+  this->released.notify_all();
+  for (auto& t : ready)
+  {
+    this->start(std::move(t.first), t.second);
+  }
+}
+
+void
+TaskLimiter::post(Task task, TaskPriority p)
+{
+  {
+    std::lock_guard<std::mutex> lock(this->m);
+    if (!this->has_slot())
+    {
+      this->queues[size_t(p)].push_back(Entry{ std::move(task), nullptr });
+      return;
+    }
+    this->running++;
+  }
+  this->start(std::move(task), p);
+}
+
+void
+TaskLimiter::run(const std::function<void()>& f, TaskPriority p)
+{
+  {
+    std::unique_lock<std::mutex> lock(this->m);
+    if (this->has_slot())
+    {
+      this->running++;
+    }
+    else
+    {
+      // The slot is counted as taken by whoever grants it.
+      bool granted = false;
+      this->queues[size_t(p)].push_back(Entry{ Task(), &granted });
+      this->released.wait(lock, [&granted]() { return granted; });
+    }
+  }
+  try
+  {
+    f();
+  }
+  catch (...)
+  {
+    this->release();
+    throw;
+  }
+  this->release();
+}
+
+TaskLimiter::TaskLimiter(TaskDispatchFunc f, size_t v) : dispatch(std::move(f)), limit(v) {}
+}
@@ -0,0 +1,283 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef _TASK_POOL_HPP_
+#define _TASK_POOL_HPP_
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "exceptions.hpp"
+#include "parallel.hpp"
+
+namespace Obozrenie
+{
+// Scheduling classes, most urgent first. A worker only picks up a task once no queue holds one of a more urgent class.
+enum class TaskPriority : uint8_t
+{
+  // Work the user is waiting for, e.g. refreshing the game they just selected.
+  USER,
+  // Routine refreshes nobody is looking at yet.
+  BACKGROUND,
+  // Speculative work that only runs when the pool would otherwise be idle.
+  PREFETCH
+};
+
+const size_t TASK_PRIORITY_COUNT = 3;
+
+// Priority of the pool task running on this thread. Threads outside any pool get USER, since whoever called is waiting.
+// Work a task fans out inherits it, so that a background refresh does not jump ahead of what the user asked for.
+TaskPriority current_task_priority();
+
+DEFINE_EXCEPTION(TaskPoolStoppedError, "Task pool has been shut down");
+
+// Move-only nullary callable. Closures of up to six pointers are stored inline, so posting them does not allocate.
+class Task
+{
+private:
+  static const size_t INLINE_SIZE = 6 * sizeof(void*);
+  typedef std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type Storage;
+
+  struct Ops
+  {
+    void (*call)(Storage&);
+    void (*move)(Storage&, Storage&);
+    void (*destroy)(Storage&);
+  };
+
+  template <typename F>
+  struct InlineOps
+  {
+    static F& get(Storage& s) { return *reinterpret_cast<F*>(&s); }
+    static void call(Storage& s) { get(s)(); }
+    static void move(Storage& dst, Storage& src)
+    {
+      new (&dst) F(std::move(get(src)));
+      get(src).~F();
+    }
+    static void destroy(Storage& s) { get(s).~F(); }
+    static const Ops* ops()
+    {
+      static const Ops v{ &call, &move, &destroy };
+      return &v;
+    }
+  };
+
+  template <typename F>
+  struct HeapOps
+  {
+    static F*& get(Storage& s) { return *reinterpret_cast<F**>(&s); }
+    static void call(Storage& s) { (*get(s))(); }
+    static void move(Storage& dst, Storage& src) { new (&dst) F*(get(src)); }
+    static void destroy(Storage& s) { delete get(s); }
+    static const Ops* ops()
+    {
+      static const Ops v{ &call, &move, &destroy };
+      return &v;
+    }
+  };
+
+  Storage storage;
+  const Ops* ops = nullptr;
+
+  template <typename F, typename Arg>
+  void init(Arg&& f, std::true_type)
+  {
+    new (&this->storage) F(std::forward<Arg>(f));
+    this->ops = InlineOps<F>::ops();
+  }
+
+  template <typename F, typename Arg>
+  void init(Arg&& f, std::false_type)
+  {
+    new (&this->storage) F*(new F(std::forward<Arg>(f)));
+    this->ops = HeapOps<F>::ops();
+  }
+
+  void reset()
+  {
+    if (this->ops)
+    {
+      this->ops->destroy(this->storage);
+      this->ops = nullptr;
+    }
+  }
+
+public:
+  explicit operator bool() const { return this->ops != nullptr; }
+  void operator()() { this->ops->call(this->storage); }
+
+  Task() {}
+  template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+  Task(F&& f)
+  {
+    typedef typename std::decay<F>::type Fn;
+    typedef std::integral_constant<bool, (sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(Storage) && std::is_nothrow_move_constructible<Fn>::value)> Fits;
+    this->init<Fn>(std::forward<F>(f), Fits());
+  }
+  Task(Task&& o) noexcept : ops(o.ops)
+  {
+    if (this->ops)
+    {
+      this->ops->move(this->storage, o.storage);
+      o.ops = nullptr;
+    }
+  }
+  Task& operator=(Task&& o) noexcept
+  {
+    if (this != &o)
+    {
+      this->reset();
+      this->ops = o.ops;
+      if (this->ops)
+      {
+        this->ops->move(this->storage, o.storage);
+        o.ops = nullptr;
+      }
+    }
+    return *this;
+  }
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+  ~Task() { this->reset(); }
+};
+
+// Fixed set of worker threads, each with its own deque per priority.
+// Tasks posted from outside are spread round-robin; tasks posted by a worker land on its own deque.
+// A worker takes the oldest task from its own deque and, when that is empty, steals the newest one from another worker.
+class TaskPool
+{
+private:
+  struct Worker
+  {
+    std::mutex m;
+    std::array<std::deque<Task>, TASK_PRIORITY_COUNT> queues;
+  };
+
+  // Everything the workers touch. Each worker thread shares ownership of it, so a pool whose last reference is dropped by one
+  // of its own tasks stays usable by that worker until it has drained its queues and exited.
+  struct State
+  {
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> next_worker{ 0 };
+    // Tasks queued or about to be queued, but not yet taken. Idle workers sleep until it becomes non-zero.
+    std::atomic<size_t> pending{ 0 };
+    std::atomic<bool> accepting{ true };
+    std::mutex idle_mutex;
+    std::condition_variable idle;
+    bool stopping = false;
+
+    bool take(size_t, Task&, TaskPriority&);
+    void run(size_t);
+    void post(Task, TaskPriority);
+  };
+
+  std::shared_ptr<State> state;
+  std::vector<std::thread> threads;
+
+public:
+  size_t size() const { return this->state->workers.size(); }
+
+  // Queues the task. Exceptions escaping it are discarded; use submit to observe them.
+  // Throws TaskPoolStoppedError if shutdown has begun, unless called from one of the pool's workers.
+  void post(Task, TaskPriority = TaskPriority::BACKGROUND);
+
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> submit(F&& f, TaskPriority p = TaskPriority::BACKGROUND)
+  {
+    std::packaged_task<typename std::result_of<F()>::type()> task(std::forward<F>(f));
+    auto result = task.get_future();
+    this->post([task = std::move(task)]() mutable { task(); }, p);
+    return result;
+  }
+
+  // Stops accepting tasks from outside, runs everything already queued, including what those tasks post, and joins the workers.
+  // Called by the destructor. Called from one of the pool's own tasks, it joins all other workers; the calling worker drains
+  // what is left once its task returns and then exits on its own.
+  void shutdown();
+
+  explicit TaskPool(size_t = default_parallelism());
+  TaskPool(const TaskPool&) = delete;
+  ~TaskPool();
+};
+
+// Pool shared by everything that was not handed one of its own. It is created on first use and never destroyed,
+// so exiting does not wait for running refreshes. Refreshes mostly wait on the network, so it keeps at least
+// DEFAULT_TASK_POOL_MIN_SIZE workers even on small machines.
+const size_t DEFAULT_TASK_POOL_MIN_SIZE = 4;
+std::shared_ptr<TaskPool> default_task_pool();
+
+typedef std::function<void(Task, TaskPriority)> TaskDispatchFunc;
+
+// Caps how many tasks of one kind run at once. Tasks over the limit wait here, most urgent first, without occupying a worker,
+// and are handed to the dispatch function as running ones finish. A limit of 0 means no limit.
+class TaskLimiter : public std::enable_shared_from_this<TaskLimiter>
+{
+private:
+  // A queued task, or a run() caller waiting for its turn, which is granted the slot in place.
+  struct Entry
+  {
+    Task task;
+    bool* granted;
+  };
+
+  std::mutex m;
+  std::condition_variable released;
+  TaskDispatchFunc dispatch;
+  size_t limit;
+  size_t running = 0;
+  std::array<std::deque<Entry>, TASK_PRIORITY_COUNT> queues;
+
+  bool has_slot() const { return this->limit == 0 || this->running < this->limit; }
+  // Takes the next entry for a free slot. Waiters are granted it right away; tasks are added to the list to be started.
+  // Must be called with m held. Returns false if nothing is queued.
+  bool hand_over(std::vector<std::pair<Task, TaskPriority>>&);
+  void start(Task, TaskPriority);
+  void release();
+
+public:
+  size_t get_limit();
+  void set_limit(size_t);
+
+  // Dispatches the task now if a slot is free, queues it otherwise.
+  void post(Task, TaskPriority = TaskPriority::BACKGROUND);
+  // Waits for a free slot and runs the function on the calling thread. The caller waits in line with posted tasks of the same
+  // priority, so a stream of posts cannot starve it. Do not call this from a worker of the pool the limiter dispatches to:
+  // queued tasks may need that worker to finish.
+  void run(const std::function<void()>&, TaskPriority = TaskPriority::USER);
+
+  TaskLimiter(TaskDispatchFunc, size_t);
+  TaskLimiter(const TaskLimiter&) = delete;
+};
+}
+
+#endif
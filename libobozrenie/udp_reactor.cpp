@@ -0,0 +1,220 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "udp_reactor.hpp"
+
+#include "exceptions.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace Obozrenie
+{
+namespace
+{
+const int RECEIVE_BUFFER_SIZE = 1 << 20;
+const size_t MAX_DATAGRAM_SIZE = 65536;
+
+int
+open_socket(int family)
+{
+  auto fd = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  // Replies to a burst of queries arrive at once; a larger buffer keeps the kernel from dropping them.
+  auto size = RECEIVE_BUFFER_SIZE;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  if (family == AF_INET6)
+  {
+    int v6only = 1;
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+  }
+  return fd;
+}
+}
+
+UdpReactor::UdpReactor() : epoll_fd(-1), socket_v4(-1), socket_v6(-1), wakeup_fd(-1), buffer(MAX_DATAGRAM_SIZE)
+{
+  this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (this->epoll_fd < 0)
+  {
+    throw SocketError(std::string("epoll_create1: ") + std::strerror(errno));
+  }
+
+  this->socket_v4 = open_socket(AF_INET);
+  // IPv6 is optional: hosts without it simply cannot reach IPv6 servers.
+  this->socket_v6 = open_socket(AF_INET6);
+  if (this->socket_v4 < 0 && this->socket_v6 < 0)
+  {
+    close(this->epoll_fd);
+    throw SocketError(std::string("socket: ") + std::strerror(errno));
+  }
+
+  for (auto fd : { this->socket_v4, this->socket_v6 })
+  {
+    if (fd >= 0)
+    {
+      epoll_event ev;
+      std::memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.fd = fd;
+      epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+  }
+}
+
+UdpReactor::~UdpReactor()
+{
+  for (auto fd : { this->socket_v4, this->socket_v6, this->epoll_fd })
+  {
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+  }
+}
+
+bool
+UdpReactor::send(const Endpoint& to, const std::string& data)
+{
+  auto fd = to.family == Endpoint::Family::V6 ? this->socket_v6 : this->socket_v4;
+  if (fd < 0)
+  {
+    throw SocketError("no socket for the address family of " + to.str());
+  }
+
+  sockaddr_storage addr;
+  auto len = to.to_sockaddr(addr);
+  for (;;)
+  {
+    auto rc = sendto(fd, data.data(), data.size(), 0, reinterpret_cast<const sockaddr*>(&addr), len);
+    if (rc >= 0)
+    {
+      return true;
+    }
+    if (errno == EINTR)
+    {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+    {
+      return false;
+    }
+    // Unreachable networks and the like only concern this server; treat the datagram as lost.
+    return true;
+  }
+}
+
+void
+UdpReactor::drain(int fd, const ReceiveFunc& cb)
+{
+  for (;;)
+  {
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    auto n = recvfrom(fd, this->buffer.data(), this->buffer.size(), 0, reinterpret_cast<sockaddr*>(&addr), &len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      // ICMP errors for earlier datagrams are reported here; they only concern that server.
+      if (errno == ECONNREFUSED || errno == EHOSTUNREACH || errno == ENETUNREACH)
+      {
+        continue;
+      }
+      return;
+    }
+
+    Endpoint from;
+    try
+    {
+      from = Endpoint::from_sockaddr(reinterpret_cast<const sockaddr*>(&addr), len);
+    }
+    catch (const InvalidEndpointError&)
+    {
+      continue;
+    }
+    cb(from, this->buffer.data(), size_t(n));
+  }
+}
+
+void
+UdpReactor::poll(std::chrono::steady_clock::time_point deadline, const ReceiveFunc& cb)
+{
+  // Rounded up, since a wait truncated to 0 ms would spin until the deadline.
+  auto now = std::chrono::steady_clock::now();
+  auto timeout = 0;
+  if (deadline > now)
+  {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+    timeout = int(std::min<decltype(remaining)>(remaining, std::numeric_limits<int>::max()));
+  }
+
+  epoll_event events[3];
+  auto n = epoll_wait(this->epoll_fd, events, 3, timeout);
+  if (n < 0)
+  {
+    if (errno == EINTR)
+    {
+      return;
+    }
+    throw SocketError(std::string("epoll_wait: ") + std::strerror(errno));
+  }
+
+  for (int i = 0; i < n; i++)
+  {
+    if (events[i].data.fd != this->wakeup_fd)
+    {
+      this->drain(events[i].data.fd, cb);
+    }
+  }
+}
+
+void
+UdpReactor::set_wakeup(int fd)
+{
+  if (this->wakeup_fd >= 0)
+  {
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, this->wakeup_fd, nullptr);
+  }
+  this->wakeup_fd = fd;
+  if (fd >= 0)
+  {
+    epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+      throw SocketError(std::string("epoll_ctl: ") + std::strerror(errno));
+    }
+  }
+}
+}
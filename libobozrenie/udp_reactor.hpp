@@ -0,0 +1,61 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _UDP_REACTOR_HPP_
+#define _UDP_REACTOR_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "endpoint.hpp"
+
+namespace Obozrenie
+{
+// One non-blocking UDP socket per address family, multiplexed with epoll.
+// Replies are told apart by their source address, so thousands of servers can be queried without a socket each.
+class UdpReactor
+{
+private:
+  int epoll_fd;
+  int socket_v4;
+  int socket_v6;
+  int wakeup_fd;
+  std::vector<uint8_t> buffer;
+
+  void drain(int, const std::function<void(const Endpoint&, const uint8_t*, size_t)>&);
+
+public:
+  typedef std::function<void(const Endpoint&, const uint8_t*, size_t)> ReceiveFunc;
+
+  // Returns false if the socket buffer is full and the datagram has to be sent again later.
+  bool send(const Endpoint&, const std::string&);
+  // Waits until datagrams arrive or the deadline passes and hands every queued datagram to the callback.
+  void poll(std::chrono::steady_clock::time_point, const ReceiveFunc&);
+  // Also returns from poll as soon as the descriptor is readable, e.g. a CancellationFd. The descriptor itself is never read.
+  void set_wakeup(int);
+
+  UdpReactor();
+  UdpReactor(const UdpReactor&) = delete;
+  ~UdpReactor();
+};
+}
+
+#endif
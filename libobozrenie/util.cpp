@@ -19,10 +19,10 @@
 #include "util.hpp"
 
 #include "exceptions.hpp"
+#include "process.hpp"
 
 #include <cstdio>
 #include <ctime>
-#include <experimental/filesystem>
 #include <fstream>
 #include <functional>
 #include <iomanip>
@@ -30,7 +30,6 @@
 #include <memory>
 #include <string>
 #include <map>
-#include <future>
 
 #include <boost/algorithm/string/join.hpp>
 #include <giomm.h>
@@ -86,35 +85,27 @@ get_string_from_resource(Glib::RefPtr<Gio::Resource> r, std::string path)
 std::string
 exec(std::vector<std::string> argv, std::chrono::milliseconds wait_timeout)
 {
-  auto fut = std::async([argv]() {
-    std::string data;
-    int exit_status = 0;
-    try
-    {
-      Glib::spawn_sync(std::experimental::filesystem::current_path().string(), argv, Glib::SpawnFlags::SPAWN_DEFAULT, Glib::SlotSpawnChildSetup(), &data, nullptr, &exit_status);
-    }
-    catch (const Glib::SpawnError& e)
-    {
-      throw PopenError(Glib::ustring::compose("%1 - %2", e.what(), boost::join(argv, " ")).c_str());
-    }
-
-    if (exit_status)
-    {
-      throw PopenError(Glib::ustring::compose("(%1) %2 - %3", exit_status, strerror(exit_status), boost::join(argv, " ")).c_str());
-    }
-
-    return data;
-  });
+  std::string data;
+  exec_stream(argv, [&data](const char* chunk, size_t len) { data.append(chunk, len); }, wait_timeout);
+  return data;
+}
 
-  if (wait_timeout != std::chrono::milliseconds(0))
+std::string
+strip_port(const Glib::ustring& host)
+{
+  const auto& v = host.raw();
+  if (!v.empty() && v[0] == '[')
   {
-    if (fut.wait_for(wait_timeout) == std::future_status::timeout)
-    {
-      throw PopenError(Glib::ustring::compose("Timed out - %1", boost::join(argv, " ")).c_str());
-    }
+    auto end = v.find(']');
+    return end == std::string::npos ? v : v.substr(1, end - 1);
   }
 
-  return fut.get();
+  auto sep = v.find(':');
+  if (sep == std::string::npos || v.find(':', sep + 1) != std::string::npos)
+  {
+    return v;
+  }
+  return v.substr(0, sep);
 }
 
 void
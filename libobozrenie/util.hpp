@@ -36,6 +36,10 @@ Glib::VariantBase json_to_variant(Glib::VariantType t, Json::Value v);
 typedef std::function<void(std::string, Json::Value)> JSONCallback;
 typedef std::map<std::string, JSONCallback> JSONCallbackMap;
 
+// Drops the ":port" suffix from a host key, keeping bracketed IPv6 addresses intact.
+std::string strip_port(const Glib::ustring&);
+
+// Runs a program and returns its whole standard output. See exec_stream for consuming it while the program runs.
 std::string exec(std::vector<std::string>, std::chrono::milliseconds = std::chrono::milliseconds(0));
 
 void map_json_object(Json::Value, JSONCallbackMap, std::function<void(std::string)> = nullptr);
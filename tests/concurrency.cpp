@@ -0,0 +1,544 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#define BOOST_TEST_MODULE concurrency
+#include <boost/test/included/unit_test.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <libobozrenie/cancellation.hpp>
+#include <libobozrenie/event_bus.hpp>
+#include <libobozrenie/future.hpp>
+#include <libobozrenie/process.hpp>
+#include <libobozrenie/task_pool.hpp>
+
+using namespace Obozrenie;
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+// Blocks the tasks waiting on it until opened.
+class Gate
+{
+private:
+  std::mutex m;
+  std::condition_variable cv;
+  bool open = false;
+
+public:
+  void wait()
+  {
+    std::unique_lock<std::mutex> lock(this->m);
+    this->cv.wait(lock, [this]() { return this->open; });
+  }
+
+  void release()
+  {
+    {
+      std::lock_guard<std::mutex> lock(this->m);
+      this->open = true;
+    }
+    this->cv.notify_all();
+  }
+};
+
+long
+elapsed_ms(Clock::time_point start)
+{
+  return long(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count());
+}
+
+// True once the process is gone or only left as a zombie nobody reaped yet. SIGKILL is delivered asynchronously,
+// so the process gets a moment to die.
+bool
+process_dead(pid_t pid)
+{
+  for (auto start = Clock::now(); elapsed_ms(start) < 2000; std::this_thread::sleep_for(std::chrono::milliseconds(5)))
+  {
+    if (kill(pid, 0) != 0)
+    {
+      return true;
+    }
+    std::ifstream f("/proc/" + std::to_string(pid) + "/stat");
+    std::string pid_field, name, state;
+    f >> pid_field >> name >> state;
+    if (state == "Z")
+    {
+      return true;
+    }
+  }
+  return false;
+}
+}
+
+BOOST_AUTO_TEST_SUITE(task_pool)
+
+BOOST_AUTO_TEST_CASE(shutdown_drains_queued_tasks)
+{
+  std::atomic<int> ran(0);
+  TaskPool pool(2);
+  for (int i = 0; i < 1000; i++)
+  {
+    pool.post([&ran, &pool]() {
+      ran++;
+      // Workers may still post while the pool drains.
+      pool.post([&ran]() { ran++; });
+    });
+  }
+  pool.shutdown();
+  BOOST_CHECK_EQUAL(ran.load(), 2000);
+  BOOST_CHECK_THROW(pool.post([]() {}), TaskPoolStoppedError);
+}
+
+BOOST_AUTO_TEST_CASE(urgent_tasks_run_first)
+{
+  Gate gate;
+  std::mutex m;
+  std::vector<TaskPriority> order;
+  {
+    TaskPool pool(1);
+    pool.post([&gate]() { gate.wait(); });
+    for (auto p : { TaskPriority::PREFETCH, TaskPriority::BACKGROUND, TaskPriority::USER, TaskPriority::PREFETCH, TaskPriority::USER })
+    {
+      pool.post(
+        [&m, &order, p]() {
+          std::lock_guard<std::mutex> lock(m);
+          order.push_back(p);
+        },
+        p);
+    }
+    gate.release();
+  }
+  std::vector<TaskPriority> expected{ TaskPriority::USER, TaskPriority::USER, TaskPriority::BACKGROUND, TaskPriority::PREFETCH, TaskPriority::PREFETCH };
+  BOOST_CHECK(order == expected);
+}
+
+BOOST_AUTO_TEST_CASE(submit_reports_exceptions)
+{
+  TaskPool pool(2);
+  auto ok = pool.submit([]() { return 42; });
+  auto failed = pool.submit([]() -> int { throw std::runtime_error("boom"); });
+  BOOST_CHECK_EQUAL(ok.get(), 42);
+  BOOST_CHECK_THROW(failed.get(), std::runtime_error);
+}
+
+// The task holds the last reference, so the pool is destroyed on its own worker.
+BOOST_AUTO_TEST_CASE(pool_can_be_destroyed_by_its_own_task)
+{
+  Gate released;
+  Gate done;
+  std::atomic<int> ran(0);
+
+  auto pool = std::make_shared<TaskPool>(2);
+  pool->post([&, pool]() mutable {
+    released.wait();
+    pool.reset();
+    ran++;
+    done.release();
+  });
+  pool.reset();
+  released.release();
+
+  done.wait();
+  BOOST_CHECK_EQUAL(ran.load(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(parallel_for_visits_every_index)
+{
+  std::vector<std::atomic<int>> visits(1000);
+  parallel_for(visits.size(), [&visits](size_t i) { visits[i]++; }, 4);
+  for (auto& v : visits)
+  {
+    BOOST_REQUIRE_EQUAL(v.load(), 1);
+  }
+  BOOST_CHECK_THROW(parallel_for(10, [](size_t i) {
+    if (i == 3)
+    {
+      throw std::runtime_error("boom");
+    }
+  }),
+                    std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(parallel_for_keeps_the_callers_priority)
+{
+  BOOST_CHECK(current_task_priority() == TaskPriority::USER);
+
+  TaskPool pool(1);
+  std::vector<TaskPriority> seen(64, TaskPriority::USER);
+  pool.submit(
+          [&seen]() {
+            parallel_for(seen.size(), [&seen](size_t i) {
+              std::this_thread::sleep_for(std::chrono::milliseconds(1));
+              seen[i] = current_task_priority();
+            }, 4);
+          },
+          TaskPriority::PREFETCH)
+      .get();
+  for (auto p : seen)
+  {
+    BOOST_REQUIRE(p == TaskPriority::PREFETCH);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(task_limiter)
+
+BOOST_AUTO_TEST_CASE(limit_caps_running_tasks)
+{
+  std::atomic<int> running(0);
+  std::atomic<int> peak(0);
+  std::atomic<int> ran(0);
+  {
+    TaskPool pool(4);
+    auto limiter = std::make_shared<TaskLimiter>([&pool](Task t, TaskPriority p) { pool.post(std::move(t), p); }, 2);
+    for (int i = 0; i < 20; i++)
+    {
+      limiter->post([&]() {
+        auto now = ++running;
+        for (auto v = peak.load(); v < now && !peak.compare_exchange_weak(v, now);)
+        {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        running--;
+        ran++;
+      });
+    }
+    while (ran.load() < 20)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  BOOST_CHECK_LE(peak.load(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(throwing_task_releases_its_slot)
+{
+  TaskPool pool(2);
+  auto limiter = std::make_shared<TaskLimiter>([&pool](Task t, TaskPriority p) { pool.post(std::move(t), p); }, 1);
+  limiter->post([]() { throw std::runtime_error("boom"); });
+
+  Promise<void> after_post;
+  limiter->post([after_post]() { after_post.set_value(); });
+  BOOST_REQUIRE(after_post.get_future().wait_for(std::chrono::seconds(5)));
+
+  BOOST_CHECK_THROW(limiter->run([]() { throw std::runtime_error("boom"); }), std::runtime_error);
+  bool ran = false;
+  limiter->run([&ran]() { ran = true; });
+  BOOST_CHECK(ran);
+}
+
+BOOST_AUTO_TEST_CASE(run_waits_in_line_with_posted_tasks)
+{
+  std::mutex m;
+  std::vector<int> order;
+  auto record = [&m, &order](int v) {
+    std::lock_guard<std::mutex> lock(m);
+    order.push_back(v);
+  };
+
+  TaskPool pool(2);
+  auto limiter = std::make_shared<TaskLimiter>([&pool](Task t, TaskPriority p) { pool.post(std::move(t), p); }, 1);
+  Promise<void> gate;
+  auto opened = gate.get_future();
+  limiter->post([opened]() { opened.wait_for(std::chrono::seconds(5)); });
+
+  std::thread caller([&]() { limiter->run([&]() { record(0); }); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  Promise<void> done;
+  for (int i = 1; i <= 5; i++)
+  {
+    limiter->post([&record, i]() { record(i); });
+  }
+  limiter->post([done]() { done.set_value(); });
+  gate.set_value();
+
+  caller.join();
+  BOOST_REQUIRE(done.get_future().wait_for(std::chrono::seconds(5)));
+  std::lock_guard<std::mutex> lock(m);
+  BOOST_CHECK((order == std::vector<int>{ 0, 1, 2, 3, 4, 5 }));
+}
+
+BOOST_AUTO_TEST_CASE(failed_dispatch_releases_its_slot)
+{
+  auto limiter = std::make_shared<TaskLimiter>([](Task, TaskPriority) { throw TaskPoolStoppedError(); }, 1);
+  BOOST_CHECK_THROW(limiter->post([]() {}), TaskPoolStoppedError);
+  bool ran = false;
+  limiter->run([&ran]() { ran = true; });
+  BOOST_CHECK(ran);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(future)
+
+BOOST_AUTO_TEST_CASE(dropped_promise_breaks_its_future)
+{
+  Future<int> f;
+  {
+    Promise<int> p;
+    f = p.get_future();
+  }
+  BOOST_REQUIRE(f.is_ready());
+  try
+  {
+    f.get();
+    BOOST_ERROR("no broken promise");
+  }
+  catch (const std::future_error& e)
+  {
+    BOOST_CHECK(e.code() == std::future_errc::broken_promise);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(then_chains_results_and_errors)
+{
+  Promise<int> p;
+  auto doubled = p.get_future().then([](Future<int> v) { return v.get() * 2; });
+  p.set_value(21);
+  BOOST_CHECK_EQUAL(doubled.get(), 42);
+
+  auto failed = make_exceptional_future<int>(std::make_exception_ptr(std::runtime_error("boom"))).then([](Future<int> v) { return v.get() + 1; });
+  BOOST_CHECK_THROW(failed.get(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(when_all_keeps_every_result)
+{
+  std::vector<Promise<int>> ps(3);
+  std::vector<Future<int>> fs;
+  for (const auto& p : ps)
+  {
+    fs.push_back(p.get_future());
+  }
+  auto all = when_all(fs);
+
+  ps[2].set_value(3);
+  ps[0].set_value(1);
+  BOOST_CHECK(!all.is_ready());
+  ps[1].set_exception(std::make_exception_ptr(std::runtime_error("boom")));
+
+  auto results = all.get();
+  BOOST_REQUIRE_EQUAL(results.size(), 3u);
+  BOOST_CHECK_EQUAL(results[0].get(), 1);
+  BOOST_CHECK_THROW(results[1].get(), std::runtime_error);
+  BOOST_CHECK_EQUAL(results[2].get(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(cancelling_when_all_cancels_every_future)
+{
+  std::vector<Promise<int>> ps(2);
+  std::vector<Future<int>> fs;
+  for (const auto& p : ps)
+  {
+    fs.push_back(p.get_future());
+  }
+  when_all(fs).cancel();
+  for (const auto& p : ps)
+  {
+    BOOST_CHECK(p.token().is_cancelled());
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(event_bus)
+
+BOOST_AUTO_TEST_CASE(subscriber_can_dispatch_another_bus)
+{
+  EventBus<int> a, b;
+  std::vector<int> from_b;
+  b.subscribe([&from_b](int v) { from_b.push_back(v); });
+  a.subscribe([&b, &from_b](int v) {
+    b.publish(v * 10);
+    b.dispatch();
+    // Delivered by the nested call, not left queued until the next writer.
+    BOOST_CHECK_EQUAL(from_b.size(), 1u);
+  });
+
+  a.publish(1);
+  a.dispatch();
+  BOOST_CHECK(from_b == std::vector<int>{ 10 });
+}
+
+BOOST_AUTO_TEST_CASE(republished_events_are_delivered_in_order)
+{
+  EventBus<int> bus;
+  std::vector<int> seen;
+  bus.subscribe([&bus, &seen](int v) {
+    seen.push_back(v);
+    if (v < 3)
+    {
+      bus.publish(v + 1);
+      bus.dispatch();
+    }
+  });
+
+  bus.publish(1);
+  bus.dispatch();
+  BOOST_CHECK((seen == std::vector<int>{ 1, 2, 3 }));
+}
+
+BOOST_AUTO_TEST_CASE(subscriber_errors_go_to_their_own_handler)
+{
+  EventBus<int> bus;
+  std::vector<int> failed;
+  std::vector<int> seen;
+  auto throw_on_two = [](int v) {
+    if (v == 2)
+    {
+      throw std::runtime_error("listener");
+    }
+  };
+  bus.subscribe(throw_on_two, nullptr, [&failed](int v, std::exception_ptr) { failed.push_back(v); });
+  bus.subscribe([](int) { throw std::runtime_error("unhandled"); });
+  bus.subscribe([&seen](int v) { seen.push_back(v); });
+
+  for (int v : { 1, 2, 3 })
+  {
+    bus.publish(v);
+  }
+  BOOST_CHECK_NO_THROW(bus.dispatch());
+  BOOST_CHECK(failed == std::vector<int>{ 2 });
+  BOOST_CHECK((seen == std::vector<int>{ 1, 2, 3 }));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(cancellation)
+
+BOOST_AUTO_TEST_CASE(token_reports_cancellation_and_deadline)
+{
+  CancellationToken token;
+  BOOST_CHECK_NO_THROW(token.throw_if_cancelled());
+
+  auto overdue = token.with_deadline(Clock::now() - std::chrono::milliseconds(1));
+  BOOST_CHECK_THROW(overdue.throw_if_cancelled(), DeadlineExceededError);
+  BOOST_CHECK_NO_THROW(token.throw_if_cancelled());
+
+  overdue.cancel();
+  BOOST_CHECK(token.is_cancelled());
+  BOOST_CHECK_THROW(token.throw_if_cancelled(), CancelledError);
+}
+
+BOOST_AUTO_TEST_CASE(callback_runs_once_and_not_after_destruction)
+{
+  CancellationToken token;
+  int calls = 0;
+  {
+    CancellationCallback gone(token, [&calls]() { calls += 100; });
+  }
+  CancellationCallback callback(token, [&calls]() { calls++; });
+  token.cancel();
+  token.cancel();
+  BOOST_CHECK_EQUAL(calls, 1);
+
+  CancellationCallback late(token, [&calls]() { calls++; });
+  BOOST_CHECK_EQUAL(calls, 2);
+}
+
+BOOST_AUTO_TEST_CASE(fd_becomes_readable_on_cancel)
+{
+  CancellationToken token;
+  CancellationFd fd(token);
+  pollfd p{ fd.get(), POLLIN, 0 };
+  BOOST_CHECK_EQUAL(poll(&p, 1, 0), 0);
+
+  std::thread canceller([token]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    token.cancel();
+  });
+  auto start = Clock::now();
+  BOOST_CHECK_EQUAL(poll(&p, 1, 5000), 1);
+  BOOST_CHECK_LT(elapsed_ms(start), 2000);
+  canceller.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(exec_stream_process)
+
+BOOST_AUTO_TEST_CASE(output_is_streamed)
+{
+  std::string output;
+  exec_stream({ "sh", "-c", "echo one; echo two" }, [&output](const char* data, size_t len) { output.append(data, len); });
+  BOOST_CHECK_EQUAL(output, "one\ntwo\n");
+  BOOST_CHECK_THROW(exec_stream({ "sh", "-c", "exit 3" }, [](const char*, size_t) {}), PopenError);
+}
+
+// The shell starts a child that would outlive it and keeps its output open; the whole group has to go.
+BOOST_AUTO_TEST_CASE(deadline_kills_the_process_group)
+{
+  std::string output;
+  auto start = Clock::now();
+  BOOST_CHECK_THROW(exec_stream({ "sh", "-c", "sleep 30 & echo $!; wait" }, [&output](const char* data, size_t len) { output.append(data, len); },
+                                std::chrono::milliseconds(200)),
+                    PopenError);
+  BOOST_CHECK_LT(elapsed_ms(start), 5000);
+
+  auto child = pid_t(std::stoi(output));
+  BOOST_CHECK(process_dead(child));
+}
+
+BOOST_AUTO_TEST_CASE(cancel_kills_the_process_group_at_once)
+{
+  CancellationToken token;
+  std::thread canceller([token]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    token.cancel();
+  });
+
+  std::string output;
+  auto start = Clock::now();
+  BOOST_CHECK_THROW(exec_stream({ "sh", "-c", "sleep 30 & echo $!; wait" }, [&output](const char* data, size_t len) { output.append(data, len); },
+                                std::chrono::milliseconds(0), token),
+                    CancelledError);
+  BOOST_CHECK_LT(elapsed_ms(start), 5000);
+  canceller.join();
+
+  auto child = pid_t(std::stoi(output));
+  BOOST_CHECK(process_dead(child));
+}
+
+BOOST_AUTO_TEST_CASE(throwing_callback_kills_the_process_group)
+{
+  pid_t child = 0;
+  BOOST_CHECK_THROW(exec_stream({ "sh", "-c", "sleep 30 & echo $!; wait" },
+                                [&child](const char* data, size_t len) {
+                                  child = pid_t(std::stoi(std::string(data, len)));
+                                  throw std::runtime_error("stop");
+                                }),
+                    std::runtime_error);
+  BOOST_REQUIRE(child > 0);
+  BOOST_CHECK(process_dead(child));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,252 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#define BOOST_TEST_MODULE master_client
+#include <boost/test/included/unit_test.hpp>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libobozrenie/exceptions.hpp>
+#include <libobozrenie/master_client.hpp>
+
+#include "udp_stand_in.hpp"
+
+using namespace Obozrenie;
+
+namespace
+{
+const std::string HEADER("\xFF\xFF\xFF\xFF", 4);
+const auto TIMEOUT = std::chrono::milliseconds(150);
+const auto TTL = std::chrono::seconds(60);
+
+// Servers 10.0.0.first:27960 up to 10.0.0.last:27960.
+std::vector<Endpoint>
+servers(int first, int last)
+{
+  std::vector<Endpoint> v;
+  for (int i = first; i <= last; i++)
+  {
+    v.push_back(Endpoint::parse("10.0.0." + std::to_string(i), 27960));
+  }
+  return v;
+}
+
+std::string
+entry(const Endpoint& e)
+{
+  std::string v(reinterpret_cast<const char*>(e.address.data()), 4);
+  v.push_back(char(e.port >> 8));
+  v.push_back(char(e.port & 0xFF));
+  return v;
+}
+
+std::string
+q3_reply(const std::vector<Endpoint>& list, bool last)
+{
+  auto v = HEADER + "getserversResponse";
+  for (const auto& e : list)
+  {
+    v += "\\" + entry(e);
+  }
+  if (last)
+  {
+    v += std::string("\\EOT\0\0\0", 7);
+  }
+  return v;
+}
+
+std::string
+valve_reply(const std::vector<Endpoint>& list, bool last)
+{
+  auto v = HEADER + "\x66\x0A";
+  for (const auto& e : list)
+  {
+    v += entry(e);
+  }
+  if (last)
+  {
+    v += std::string(6, '\0');
+  }
+  return v;
+}
+
+// A Quake 3 master sending its list in one datagram per page. Without the end marker the list looks cut short.
+UdpStandIn::Handler
+q3_master(std::vector<std::vector<Endpoint>> pages, bool with_eot = true)
+{
+  return [pages, with_eot](const std::string& request) {
+    std::vector<std::string> replies;
+    if (request.compare(0, HEADER.size() + 10, HEADER + "getservers") != 0)
+    {
+      return replies;
+    }
+    for (size_t i = 0; i < pages.size(); i++)
+    {
+      replies.push_back(q3_reply(pages[i], with_eot && i + 1 == pages.size()));
+    }
+    return replies;
+  };
+}
+
+std::vector<std::string>
+str(const std::vector<Endpoint>& list)
+{
+  std::vector<std::string> v;
+  for (const auto& e : list)
+  {
+    v.push_back(e.str());
+  }
+  return v;
+}
+
+std::vector<Endpoint>
+fetch(const std::vector<MasterQuery>& queries, std::chrono::seconds ttl = TTL)
+{
+  return fetch_master_lists(queries, ttl, TIMEOUT);
+}
+
+const uint8_t*
+bytes(const std::string& v)
+{
+  return reinterpret_cast<const uint8_t*>(v.data());
+}
+}
+
+BOOST_AUTO_TEST_SUITE(decoders)
+
+BOOST_AUTO_TEST_CASE(q3_reply_ends_at_eot)
+{
+  std::vector<Endpoint> out;
+  auto page = q3_reply(servers(1, 3), false).substr(HEADER.size());
+  BOOST_CHECK(!parse_q3_master_reply(bytes(page), page.size(), out));
+  auto last = q3_reply(servers(4, 4), true).substr(HEADER.size());
+  BOOST_CHECK(parse_q3_master_reply(bytes(last), last.size(), out));
+  BOOST_CHECK(str(out) == str(servers(1, 4)));
+
+  std::string other = "statusResponse\n";
+  BOOST_CHECK_THROW(parse_q3_master_reply(bytes(other), other.size(), out), DataParseError);
+}
+
+BOOST_AUTO_TEST_CASE(valve_reply_ends_at_null_address)
+{
+  std::vector<Endpoint> out;
+  auto page = valve_reply(servers(1, 2), false).substr(HEADER.size());
+  BOOST_CHECK(!parse_valve_master_reply(bytes(page), page.size(), out));
+  auto last = valve_reply(servers(3, 3), true).substr(HEADER.size());
+  BOOST_CHECK(parse_valve_master_reply(bytes(last), last.size(), out));
+  BOOST_CHECK(str(out) == str(servers(1, 3)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(loopback)
+
+BOOST_AUTO_TEST_CASE(q3_list_spans_datagrams_and_is_cached)
+{
+  UdpStandIn master(q3_master({ servers(1, 3), servers(4, 6), servers(7, 7) }));
+  std::vector<MasterQuery> queries{ { MasterProtocol::Q3, master.host(), "68 empty full" } };
+
+  BOOST_CHECK(str(fetch(queries)) == str(servers(1, 7)));
+  BOOST_CHECK(str(fetch(queries)) == str(servers(1, 7)));
+  BOOST_CHECK_EQUAL(master.requests, 1);
+}
+
+BOOST_AUTO_TEST_CASE(q3_list_without_eot_is_not_cached)
+{
+  UdpStandIn master(q3_master({ servers(1, 2), servers(3, 4) }, false));
+  std::vector<MasterQuery> queries{ { MasterProtocol::Q3, master.host(), "68 empty full" } };
+
+  BOOST_CHECK(str(fetch(queries)) == str(servers(1, 4)));
+  BOOST_CHECK(str(fetch(queries)) == str(servers(1, 4)));
+  BOOST_CHECK_EQUAL(master.requests, 2);
+}
+
+BOOST_AUTO_TEST_CASE(valve_list_is_paged_by_seed)
+{
+  std::mutex m;
+  std::vector<std::string> seeds;
+  UdpStandIn master([&m, &seeds](const std::string& request) {
+    std::vector<std::string> replies;
+    if (request.size() < 3 || request.compare(0, 2, "\x31\xFF") != 0)
+    {
+      return replies;
+    }
+    auto seed = request.substr(2, request.find('\0', 2) - 2);
+    {
+      std::lock_guard<std::mutex> lock(m);
+      seeds.push_back(seed);
+    }
+    if (seed == "0.0.0.0:0")
+    {
+      replies.push_back(valve_reply(servers(1, 3), false));
+    }
+    else if (seed == "10.0.0.3:27960")
+    {
+      replies.push_back(valve_reply(servers(4, 5), true));
+    }
+    return replies;
+  });
+  std::vector<MasterQuery> queries{ { MasterProtocol::VALVE, master.host(), "\\gamedir\\cstrike" } };
+
+  BOOST_CHECK(str(fetch(queries)) == str(servers(1, 5)));
+  {
+    std::lock_guard<std::mutex> lock(m);
+    BOOST_CHECK((seeds == std::vector<std::string>{ "0.0.0.0:0", "10.0.0.3:27960" }));
+  }
+
+  // Complete, so the second fetch is served from the cache.
+  BOOST_CHECK(str(fetch(queries)) == str(servers(1, 5)));
+  BOOST_CHECK_EQUAL(master.requests, 2);
+}
+
+BOOST_AUTO_TEST_CASE(masters_are_merged_without_duplicates)
+{
+  UdpStandIn first(q3_master({ servers(1, 4) }));
+  UdpStandIn second(q3_master({ servers(3, 6) }));
+  UdpStandIn silent([](const std::string&) { return std::vector<std::string>(); });
+  std::vector<MasterQuery> queries{ { MasterProtocol::Q3, first.host(), "68" },
+                                    { MasterProtocol::Q3, silent.host(), "68" },
+                                    { MasterProtocol::Q3, second.host(), "68" } };
+
+  BOOST_CHECK(str(fetch(queries)) == str(servers(1, 6)));
+}
+
+BOOST_AUTO_TEST_CASE(cache_expires_after_ttl)
+{
+  UdpStandIn master(q3_master({ servers(1, 2) }));
+  std::vector<MasterQuery> queries{ { MasterProtocol::Q3, master.host(), "68" } };
+
+  fetch(queries, std::chrono::seconds(1));
+  fetch(queries, std::chrono::seconds(1));
+  BOOST_CHECK_EQUAL(master.requests, 1);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  BOOST_CHECK(str(fetch(queries, std::chrono::seconds(1))) == str(servers(1, 2)));
+  BOOST_CHECK_EQUAL(master.requests, 2);
+
+  // A TTL of zero neither reads nor fills the cache.
+  fetch(queries, std::chrono::seconds(0));
+  fetch(queries, std::chrono::seconds(0));
+  BOOST_CHECK_EQUAL(master.requests, 4);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,354 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#define BOOST_TEST_MODULE minetest_list
+#include <boost/test/included/unit_test.hpp>
+
+#include <arpa/inet.h>
+#include <clocale>
+#include <fstream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <sstream>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include <libobozrenie/backend_minetest.hpp>
+#include <libobozrenie/json_sax.hpp>
+#include <libobozrenie/util.hpp>
+
+using namespace Obozrenie;
+
+namespace
+{
+const size_t LARGE_LIST_SIZE = 20000;
+
+std::string
+read_file(const std::string& path)
+{
+  std::ifstream f(path, std::ios::binary);
+  std::ostringstream s;
+  s << f.rdbuf();
+  return s.str();
+}
+
+std::string
+recorded_list()
+{
+  return read_file(TEST_DATA_DIR "/minetest_list.json");
+}
+
+// The recorded list repeated until it holds the given number of servers, each with an address of its own.
+// Entry i is copied from recorded entry i % 3 and listed as 10.x.y.z or 2001:db8::i for the IPv6 one.
+std::string
+large_list(size_t n)
+{
+  auto recorded = string_to_json(recorded_list())["list"];
+
+  Json::Value doc;
+  auto& list = doc["list"] = Json::Value(Json::arrayValue);
+  for (size_t i = 0; i < n; i++)
+  {
+    auto entry = recorded[Json::ArrayIndex(i % recorded.size())];
+    std::ostringstream address;
+    if (entry["address"].asString().find(':') != std::string::npos)
+    {
+      address << "2001:db8::" << std::hex << i;
+    }
+    else
+    {
+      address << "10." << (i >> 16) << "." << ((i >> 8) & 0xff) << "." << (i & 0xff);
+    }
+    entry["address"] = address.str();
+    list.append(entry);
+  }
+  doc["total"]["servers"] = Json::UInt64(n);
+  return json_to_string(doc, true);
+}
+
+// Records parser events as text so that two parses can be compared.
+class EventLog : public JsonHandler
+{
+public:
+  std::string events;
+
+  void start_object() override { this->events += "{\n"; }
+  void end_object() override { this->events += "}\n"; }
+  void start_array() override { this->events += "[\n"; }
+  void end_array() override { this->events += "]\n"; }
+  void key(const std::string& k) override { this->events += "k " + k + "\n"; }
+  void string_value(const std::string& v) override { this->events += "s " + v + "\n"; }
+  void number_value(double v) override
+  {
+    std::ostringstream s;
+    s << v;
+    this->events += "n " + s.str() + "\n";
+  }
+  void bool_value(bool v) override { this->events += v ? "true\n" : "false\n"; }
+  void null_value() override { this->events += "null\n"; }
+};
+
+// Parses the document fed in pieces ending at the given offsets.
+std::string
+parse_split(const std::string& doc, std::vector<size_t> splits)
+{
+  EventLog log;
+  JsonSaxParser parser(log);
+  size_t pos = 0;
+  splits.push_back(doc.size());
+  for (auto split : splits)
+  {
+    parser.feed(doc.data() + pos, split - pos);
+    pos = split;
+  }
+  parser.finish();
+  return log.events;
+}
+
+enum class Framing
+{
+  CONTENT_LENGTH,
+  CHUNKED,
+  CLOSE
+};
+
+// Loopback HTTP server answering one GET with the given body.
+// The response is sent in pieces of random size with Nagle's algorithm off, so that the client sees the body,
+// and the chunk framing around it, split at arbitrary points.
+class HttpStandIn
+{
+private:
+  int listener;
+  uint16_t port;
+  std::thread thread;
+
+  static void send_all(int fd, const std::string& data, std::mt19937& random)
+  {
+    std::uniform_int_distribution<size_t> piece(1, 1500);
+    for (size_t pos = 0; pos < data.size();)
+    {
+      auto n = ::send(fd, data.data() + pos, std::min(piece(random), data.size() - pos), MSG_NOSIGNAL);
+      if (n <= 0)
+      {
+        return;
+      }
+      pos += n;
+      if (piece(random) < 100)
+      {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  static std::string frame(const std::string& body, Framing framing, std::mt19937& random)
+  {
+    std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n";
+    if (framing == Framing::CONTENT_LENGTH)
+    {
+      return response + "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    }
+    if (framing == Framing::CLOSE)
+    {
+      return response + "Connection: close\r\n\r\n" + body;
+    }
+
+    response += "Transfer-Encoding: chunked\r\n\r\n";
+    std::uniform_int_distribution<size_t> chunk(1, 8192);
+    for (size_t pos = 0; pos < body.size();)
+    {
+      auto n = std::min(chunk(random), body.size() - pos);
+      std::ostringstream size;
+      size << std::hex << n;
+      response += size.str() + "\r\n" + body.substr(pos, n) + "\r\n";
+      pos += n;
+    }
+    return response + "0\r\n\r\n";
+  }
+
+  void serve(std::string body, Framing framing, unsigned seed)
+  {
+    int fd = ::accept(this->listener, nullptr, nullptr);
+    if (fd < 0)
+    {
+      return;
+    }
+
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos)
+    {
+      auto n = ::recv(fd, buf, sizeof(buf), 0);
+      if (n <= 0)
+      {
+        break;
+      }
+      request.append(buf, n);
+    }
+
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    std::mt19937 random(seed);
+    send_all(fd, frame(body, framing, random), random);
+    ::shutdown(fd, SHUT_WR);
+    ::close(fd);
+  }
+
+public:
+  std::string url() const { return "http://127.0.0.1:" + std::to_string(this->port) + "/list"; }
+
+  HttpStandIn(const std::string& body, Framing framing, unsigned seed)
+  {
+    this->listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (this->listener < 0 || ::bind(this->listener, reinterpret_cast<sockaddr*>(&addr), len) != 0 || ::listen(this->listener, 1) != 0 ||
+        ::getsockname(this->listener, reinterpret_cast<sockaddr*>(&addr), &len) != 0)
+    {
+      throw std::runtime_error("cannot listen on the loopback interface");
+    }
+    this->port = ntohs(addr.sin_port);
+    this->thread = std::thread(&HttpStandIn::serve, this, body, framing, seed);
+  }
+
+  ~HttpStandIn()
+  {
+    ::shutdown(this->listener, SHUT_RDWR);
+    this->thread.join();
+    ::close(this->listener);
+  }
+};
+
+void
+check_query(Framing framing)
+{
+  HttpStandIn stand_in(large_list(LARGE_LIST_SIZE), framing, unsigned(framing) + 1);
+
+  SettingsView settings;
+  settings.set(Backends::Minetest::MASTER_SERVER_URI_SETTING.name, Glib::Variant<std::vector<std::string>>::create({ stand_in.url() }));
+
+  ServerData servers;
+  size_t batches = 0;
+  size_t expected = 0;
+  QuerySink sink;
+  sink.push = [&](ServerData batch) {
+    batches++;
+    for (auto& entry : batch)
+    {
+      BOOST_CHECK(servers.insert(std::move(entry)).second);
+    }
+  };
+  sink.progress = [&](size_t, size_t total) { expected = total; };
+
+  Backends::Minetest::query("minetest", settings, QueryScope{ true, {} }, sink, CancellationToken());
+
+  BOOST_REQUIRE_EQUAL(servers.size(), LARGE_LIST_SIZE);
+  BOOST_CHECK_EQUAL(expected, LARGE_LIST_SIZE);
+  BOOST_CHECK_GT(batches, 1u);
+
+  const auto& survival = servers.at("10.0.0.0:30000");
+  BOOST_CHECK(*survival.name == "Example Survival");
+  BOOST_CHECK(survival.game_mod->str() == "minetest");
+  BOOST_CHECK_EQUAL(*survival.player_count, 12);
+  BOOST_CHECK_EQUAL(*survival.player_limit, 40);
+  BOOST_CHECK_EQUAL(*survival.ping, 46);
+  BOOST_CHECK(!*survival.need_pass);
+  BOOST_CHECK_EQUAL(survival.players.size(), 3u);
+  BOOST_CHECK(survival.rules.at(Atom("version")) == "0.4.16-dev");
+  BOOST_CHECK(survival.rules.at(Atom("description")) == "Survival server with\nmany mods");
+
+  const auto& creative = servers.at("[2001:db8::1]:30001");
+  BOOST_CHECK(*creative.name == "Creative été 🌲");
+  BOOST_CHECK(*creative.need_pass);
+  BOOST_CHECK_EQUAL(*creative.ping, 200);
+  BOOST_CHECK(creative.players.empty());
+
+  const auto& ctf = servers.at("10.0.0.2:30002");
+  BOOST_CHECK(ctf.game_mod->str() == "capturetheflag");
+  BOOST_CHECK_EQUAL(*ctf.ping, 13);
+}
+}
+
+BOOST_AUTO_TEST_CASE(parser_accepts_every_split_point)
+{
+  auto doc = recorded_list();
+  auto whole = parse_split(doc, {});
+  for (size_t i = 0; i <= doc.size(); i++)
+  {
+    BOOST_REQUIRE_EQUAL(parse_split(doc, { i }), whole);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(parser_accepts_random_split_points)
+{
+  auto doc = large_list(2000);
+  auto whole = parse_split(doc, {});
+
+  std::mt19937 random(42);
+  std::uniform_int_distribution<size_t> step(1, 64);
+  for (int round = 0; round < 4; round++)
+  {
+    std::vector<size_t> splits;
+    for (size_t pos = step(random); pos < doc.size(); pos += step(random))
+    {
+      splits.push_back(pos);
+    }
+    BOOST_REQUIRE_EQUAL(parse_split(doc, splits), whole);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(parser_ignores_the_numeric_locale)
+{
+  const char* comma_locales[] = { "de_DE.UTF-8", "ru_RU.UTF-8", "fr_FR.UTF-8", "de_DE", "ru_RU" };
+  const char* used = nullptr;
+  for (auto name : comma_locales)
+  {
+    if (std::setlocale(LC_NUMERIC, name))
+    {
+      used = name;
+      break;
+    }
+  }
+  if (!used)
+  {
+    BOOST_TEST_MESSAGE("no locale with a decimal comma is installed, parsing under the C locale only");
+  }
+
+  std::string doc = "[0.0456, 1.25E-2, -3.5e1]";
+  auto events = parse_split(doc, {});
+  std::setlocale(LC_NUMERIC, "C");
+  BOOST_CHECK_EQUAL(events, "[\nn 0.0456\nn 0.0125\nn -35\n]\n");
+}
+
+BOOST_AUTO_TEST_CASE(query_reads_content_length_body)
+{
+  check_query(Framing::CONTENT_LENGTH);
+}
+
+BOOST_AUTO_TEST_CASE(query_reads_chunked_body)
+{
+  check_query(Framing::CHUNKED);
+}
+
+BOOST_AUTO_TEST_CASE(query_reads_close_delimited_body)
+{
+  check_query(Framing::CLOSE);
+}
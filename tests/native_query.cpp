@@ -0,0 +1,439 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#define BOOST_TEST_MODULE native_query
+#include <boost/test/included/unit_test.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libobozrenie/backend_native.hpp>
+
+#include "udp_stand_in.hpp"
+
+using namespace Obozrenie;
+using namespace Obozrenie::Backends;
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+const std::string HEADER("\xFF\xFF\xFF\xFF", 4);
+const std::string SPLIT_HEADER("\xFE\xFF\xFF\xFF", 4);
+const int32_t CHALLENGE = 0x12345678;
+
+long
+elapsed_ms(Clock::time_point start)
+{
+  return long(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count());
+}
+
+void
+append_i16(std::string& v, int16_t n)
+{
+  v.push_back(char(uint16_t(n) & 0xFF));
+  v.push_back(char(uint16_t(n) >> 8));
+}
+
+void
+append_i32(std::string& v, int32_t n)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    v.push_back(char((uint32_t(n) >> (8 * i)) & 0xFF));
+  }
+}
+
+void
+append_str(std::string& v, const std::string& s)
+{
+  v += s;
+  v.push_back('\0');
+}
+
+int32_t
+read_i32(const std::string& v, size_t pos)
+{
+  return int32_t(uint32_t(uint8_t(v[pos])) | (uint32_t(uint8_t(v[pos + 1])) << 8) | (uint32_t(uint8_t(v[pos + 2])) << 16) |
+                 (uint32_t(uint8_t(v[pos + 3])) << 24));
+}
+
+const uint8_t*
+bytes(const std::string& v)
+{
+  return reinterpret_cast<const uint8_t*>(v.data());
+}
+
+std::string
+q3_status()
+{
+  return "statusResponse\n\\sv_hostname\\^1Red ^7Arena\\mapname\\q3dm17\\g_gametype\\4\\sv_maxclients\\16\n"
+         "10 50 \"^2Sarge\"\n"
+         "3 80 \"Doom\"\n";
+}
+
+// A2S_INFO with the version, the Steam ID and the keywords in the extra data.
+std::string
+a2s_info()
+{
+  std::string v = "I";
+  v.push_back(17);
+  append_str(v, "Source Server");
+  append_str(v, "de_dust2");
+  append_str(v, "cstrike");
+  append_str(v, "Counter-Strike: Source");
+  append_i16(v, 240);
+  v.push_back(5);
+  v.push_back(24);
+  v.push_back(0);
+  v.push_back('d');
+  v.push_back('l');
+  v.push_back(0);
+  v.push_back(1);
+  append_str(v, "1.0.0.34");
+  v.push_back(char(0x10 | 0x20));
+  append_i32(v, 1);
+  append_i32(v, 0);
+  append_str(v, "alltalk,increased_maxplayers");
+  return v;
+}
+
+std::string
+a2s_players()
+{
+  std::string v = "D";
+  v.push_back(2);
+  for (auto name : { "Alice", "" })
+  {
+    v.push_back(0);
+    append_str(v, name);
+    append_i32(v, 7);
+    float time = 61.5f;
+    uint32_t bits;
+    std::memcpy(&bits, &time, sizeof(bits));
+    append_i32(v, int32_t(bits));
+  }
+  return v;
+}
+
+std::string
+a2s_rules()
+{
+  std::string v = "E";
+  append_i16(v, 2);
+  append_str(v, "mp_friendlyfire");
+  append_str(v, "1");
+  append_str(v, "sv_gravity");
+  append_str(v, "800");
+  return v;
+}
+
+// The payload, header included, cut into Source engine split packets of at most the given fragment size.
+std::vector<std::string>
+split(const std::string& payload, size_t fragment)
+{
+  auto total = (payload.size() + fragment - 1) / fragment;
+  std::vector<std::string> packets;
+  for (size_t i = 0; i < total; i++)
+  {
+    auto packet = SPLIT_HEADER;
+    append_i32(packet, 42);
+    packet.push_back(char(total));
+    packet.push_back(char(i));
+    append_i16(packet, 1248);
+    packet += payload.substr(i * fragment, fragment);
+    packets.push_back(packet);
+  }
+  return packets;
+}
+
+UdpStandIn::Handler
+q3_server()
+{
+  return [](const std::string& request) {
+    if (request != HEADER + "getstatus\n")
+    {
+      return std::vector<std::string>();
+    }
+    return std::vector<std::string>{ HEADER + q3_status() };
+  };
+}
+
+UdpStandIn::Handler
+silent_server()
+{
+  return [](const std::string&) { return std::vector<std::string>(); };
+}
+
+// Demands a challenge for every request and sends the rules in two split packets.
+UdpStandIn::Handler
+a2s_server()
+{
+  return [](const std::string& request) {
+    std::string challenge_reply = HEADER + "A";
+    append_i32(challenge_reply, CHALLENGE);
+    if (request.size() < 5 || request.compare(0, 4, HEADER) != 0)
+    {
+      return std::vector<std::string>();
+    }
+
+    auto info_query = HEADER + "TSource Engine Query";
+    info_query.push_back('\0');
+    if (request.compare(0, info_query.size(), info_query) == 0)
+    {
+      if (request.size() != info_query.size() + 4 || read_i32(request, info_query.size()) != CHALLENGE)
+      {
+        return std::vector<std::string>{ challenge_reply };
+      }
+      return std::vector<std::string>{ HEADER + a2s_info() };
+    }
+
+    if (request.size() != 9 || read_i32(request, 5) != CHALLENGE)
+    {
+      return std::vector<std::string>{ challenge_reply };
+    }
+    switch (request[4])
+    {
+    case 'U':
+      return std::vector<std::string>{ HEADER + a2s_players() };
+    case 'V':
+      return split(HEADER + a2s_rules(), 20);
+    default:
+      return std::vector<std::string>();
+    }
+  };
+}
+
+SettingsView
+native_settings(const std::string& protocol, int timeout, int retries, int window)
+{
+  SettingsView settings;
+  settings.set(Native::NATIVE_PROTOCOL_SETTING.name, Glib::Variant<std::string>::create(protocol));
+  settings.set(Native::NATIVE_TIMEOUT_SETTING.name, Glib::Variant<int32_t>::create(timeout));
+  settings.set(Native::NATIVE_RETRIES_SETTING.name, Glib::Variant<int32_t>::create(retries));
+  settings.set(Native::NATIVE_WINDOW_SETTING.name, Glib::Variant<int32_t>::create(window));
+  return settings;
+}
+
+ServerData
+run_query(const SettingsView& settings, const std::vector<std::string>& hosts, size_t* total = nullptr)
+{
+  ServerData servers;
+  QuerySink sink;
+  sink.push = [&servers](ServerData batch) {
+    for (auto& entry : batch)
+    {
+      BOOST_CHECK(servers.insert(std::move(entry)).second);
+    }
+  };
+  sink.progress = [total](size_t, size_t n) {
+    if (total)
+    {
+      *total = n;
+    }
+  };
+  Native::query("test", settings, QueryScope{ false, hosts }, sink, CancellationToken());
+  return servers;
+}
+}
+
+BOOST_AUTO_TEST_SUITE(decoders)
+
+BOOST_AUTO_TEST_CASE(q3_status_fields_and_players)
+{
+  auto v = q3_status();
+  Server server;
+  Native::parse_q3_status(bytes(v), v.size(), server);
+
+  BOOST_CHECK(*server.name == "Red Arena");
+  BOOST_CHECK(server.terrain->str() == "q3dm17");
+  BOOST_CHECK(server.game_type->str() == "4");
+  BOOST_CHECK_EQUAL(*server.player_limit, 16);
+  BOOST_CHECK_EQUAL(*server.player_count, 2);
+  BOOST_REQUIRE_EQUAL(server.players.size(), 2u);
+  BOOST_CHECK(server.players.front().name == "Sarge");
+  BOOST_CHECK(server.players.front().info.at("score") == "10");
+  BOOST_CHECK(server.players.front().info.at("ping") == "50");
+  BOOST_CHECK(server.rules.at(Atom("sv_hostname")) == "^1Red ^7Arena");
+
+  std::string other = "infoResponse\n\\a\\b\n";
+  BOOST_CHECK_THROW(Native::parse_q3_status(bytes(other), other.size(), server), DataParseError);
+}
+
+BOOST_AUTO_TEST_CASE(a2s_info_fields)
+{
+  auto v = a2s_info();
+  Server server;
+  Native::parse_a2s_info(bytes(v), v.size(), server);
+
+  BOOST_CHECK(*server.name == "Source Server");
+  BOOST_CHECK(server.terrain->str() == "de_dust2");
+  BOOST_CHECK(server.game_mod->str() == "cstrike");
+  BOOST_CHECK(server.game_type->str() == "Counter-Strike: Source");
+  BOOST_CHECK_EQUAL(*server.player_count, 5);
+  BOOST_CHECK_EQUAL(*server.player_limit, 24);
+  BOOST_CHECK(!*server.need_pass);
+  BOOST_CHECK(*server.secure);
+  BOOST_CHECK(server.rules.at(Atom("version")) == "1.0.0.34");
+  BOOST_CHECK(server.rules.at(Atom("keywords")) == "alltalk,increased_maxplayers");
+
+  for (size_t len = 0; len < 20; len++)
+  {
+    Server truncated;
+    BOOST_CHECK_THROW(Native::parse_a2s_info(bytes(v), len, truncated), DataParseError);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(a2s_players_skip_unnamed)
+{
+  auto v = a2s_players();
+  Server server;
+  Native::parse_a2s_players(bytes(v), v.size(), server);
+
+  BOOST_REQUIRE_EQUAL(server.players.size(), 1u);
+  BOOST_CHECK(server.players.front().name == "Alice");
+  BOOST_CHECK(server.players.front().info.at("score") == "7");
+  BOOST_CHECK(server.players.front().info.at("time") == "61");
+}
+
+BOOST_AUTO_TEST_CASE(a2s_rules_pairs)
+{
+  auto v = a2s_rules();
+  Server server;
+  Native::parse_a2s_rules(bytes(v), v.size(), server);
+
+  BOOST_CHECK_EQUAL(server.rules.size(), 2u);
+  BOOST_CHECK(server.rules.at(Atom("mp_friendlyfire")) == "1");
+  BOOST_CHECK(server.rules.at(Atom("sv_gravity")) == "800");
+
+  BOOST_CHECK_THROW(Native::parse_a2s_rules(bytes(v), v.size() - 1, server), DataParseError);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(loopback)
+
+BOOST_AUTO_TEST_CASE(q3_query_and_timeout)
+{
+  UdpStandIn answering(q3_server());
+  UdpStandIn silent(silent_server());
+
+  auto start = Clock::now();
+  size_t total = 0;
+  auto servers = run_query(native_settings("q3", 200, 1, 16), { answering.host(), silent.host() }, &total);
+  auto ms = elapsed_ms(start);
+
+  BOOST_CHECK_EQUAL(total, 2u);
+  BOOST_REQUIRE_EQUAL(servers.size(), 1u);
+  const auto& server = servers.at(answering.host());
+  BOOST_CHECK(*server.name == "Red Arena");
+  BOOST_CHECK_EQUAL(*server.player_count, 2);
+  BOOST_CHECK(server.ping);
+  BOOST_CHECK_EQUAL(answering.requests, 1);
+
+  // One request and one retry, each given the full timeout, and then the server is dropped.
+  BOOST_CHECK_EQUAL(silent.requests, 2);
+  BOOST_CHECK_GE(ms, 400);
+  BOOST_CHECK_LT(ms, 2000);
+}
+
+BOOST_AUTO_TEST_CASE(a2s_query_with_challenge_and_split_rules)
+{
+  UdpStandIn server_stand_in(a2s_server());
+
+  auto servers = run_query(native_settings("a2s", 500, 1, 16), { server_stand_in.host() });
+
+  BOOST_REQUIRE_EQUAL(servers.size(), 1u);
+  const auto& server = servers.at(server_stand_in.host());
+  BOOST_CHECK(*server.name == "Source Server");
+  BOOST_CHECK(server.game_mod->str() == "cstrike");
+  BOOST_CHECK_EQUAL(*server.player_limit, 24);
+  BOOST_REQUIRE_EQUAL(server.players.size(), 1u);
+  BOOST_CHECK(server.players.front().name == "Alice");
+  BOOST_CHECK(server.rules.at(Atom("sv_gravity")) == "800");
+  BOOST_CHECK(server.rules.at(Atom("mp_friendlyfire")) == "1");
+  BOOST_CHECK(server.rules.at(Atom("version")) == "1.0.0.34");
+
+  // Three unchallenged requests, then at least the three again with the challenge.
+  BOOST_CHECK_GE(server_stand_in.requests, 6);
+}
+
+BOOST_AUTO_TEST_CASE(unanswered_info_drops_the_server)
+{
+  // Players and rules alone do not describe a server.
+  UdpStandIn partial([](const std::string& request) {
+    if (request.size() == 9 && request[4] == 'U')
+    {
+      return std::vector<std::string>{ HEADER + a2s_players() };
+    }
+    return std::vector<std::string>();
+  });
+
+  auto servers = run_query(native_settings("a2s", 100, 0, 16), { partial.host() });
+  BOOST_CHECK(servers.empty());
+}
+
+BOOST_AUTO_TEST_CASE(window_bounds_servers_in_flight)
+{
+  std::atomic<int> outstanding(0);
+  std::atomic<int> most(0);
+  auto slow = [&outstanding, &most](const std::string& request) {
+    auto now = ++outstanding;
+    auto seen = most.load();
+    while (now > seen && !most.compare_exchange_weak(seen, now))
+    {
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    --outstanding;
+    return q3_server()(request);
+  };
+
+  std::vector<std::unique_ptr<UdpStandIn>> stand_ins;
+  std::vector<std::string> hosts;
+  for (int i = 0; i < 4; i++)
+  {
+    stand_ins.emplace_back(new UdpStandIn(slow));
+    hosts.push_back(stand_ins.back()->host());
+  }
+
+  auto servers = run_query(native_settings("q3", 1000, 0, 1), hosts);
+  BOOST_CHECK_EQUAL(servers.size(), 4u);
+  BOOST_CHECK_EQUAL(most, 1);
+  for (const auto& s : stand_ins)
+  {
+    BOOST_CHECK_EQUAL(s->requests, 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(duplicate_hosts_are_queried_once)
+{
+  UdpStandIn answering(q3_server());
+
+  size_t total = 0;
+  auto servers = run_query(native_settings("q3", 200, 0, 16), { answering.host(), answering.host() }, &total);
+  BOOST_CHECK_EQUAL(servers.size(), 1u);
+  BOOST_CHECK_EQUAL(total, 1u);
+  BOOST_CHECK_EQUAL(answering.requests, 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
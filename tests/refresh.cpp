@@ -0,0 +1,180 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#define BOOST_TEST_MODULE refresh
+#include <boost/test/included/unit_test.hpp>
+
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <libobozrenie/core.hpp>
+
+using namespace Obozrenie;
+
+namespace
+{
+const GameID GAME = "game";
+
+// Backend that keeps answering with batches of new servers until its token stops it, or until it has sent the given number.
+Backend
+endless_backend(size_t batches = size_t(-1))
+{
+  auto f = [batches](GameID, const SettingsView&, const QueryScope&, const QuerySink& sink, const CancellationToken& token) {
+    for (size_t b = 0; b < batches; b++)
+    {
+      ServerData batch;
+      for (size_t i = 0; i < 10; i++)
+      {
+        Server s;
+        s.ping = 999;
+        batch["10.0." + std::to_string(b) + "." + std::to_string(i) + ":27960"] = s;
+      }
+      // One of the servers already known changes as well.
+      Server changed;
+      changed.ping = int(b);
+      batch["known:1"] = changed;
+
+      sink.push(std::move(batch));
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      token.throw_if_cancelled();
+    }
+  };
+  return Backend{ .name = "Endless", .description = "", .version = "1", .f = f, .concurrency = 0 };
+}
+
+// Backend that publishes one batch and then fails by calling raise.
+Backend
+failing_backend(std::function<void()> raise)
+{
+  auto f = [raise](GameID, const SettingsView&, const QueryScope&, const QuerySink& sink, const CancellationToken&) {
+    ServerData batch;
+    Server s;
+    s.ping = 999;
+    batch["10.1.0.1:27960"] = s;
+    sink.push(std::move(batch));
+    raise();
+  };
+  return Backend{ .name = "Failing", .description = "", .version = "1", .f = f, .concurrency = 0 };
+}
+
+ServerData
+known_servers()
+{
+  ServerData v;
+  for (int i = 0; i < 5; i++)
+  {
+    Server s;
+    s.ping = i;
+    v["known:" + std::to_string(i)] = s;
+  }
+  return v;
+}
+
+struct Fixture
+{
+  Core core;
+
+  explicit Fixture(Backend b)
+  {
+    this->core.game_table = std::make_shared<GameTable>();
+    this->core.logger = [](std::vector<std::string>, std::string) {};
+    this->core.game_table->create_game_entry(GAME);
+    this->core.game_table->set_backend(GAME, [b]() { return b; });
+    this->core.game_table->create_setting(GAME, Glib::VARIANT_TYPE_INT32, SettingGroup::USER, REFRESH_DEADLINE_SETTING.name);
+    this->set_deadline(DEFAULT_REFRESH_DEADLINE);
+    this->core.game_table->insert_servers(GAME, known_servers(), true);
+  }
+
+  void set_deadline(int32_t seconds)
+  {
+    this->core.game_table->set_setting<int32_t>(GAME, SettingGroup::USER, REFRESH_DEADLINE_SETTING.name, seconds);
+  }
+
+  // Waits until the refresh has published some of its answers.
+  void wait_for_publish()
+  {
+    for (int i = 0; i < 1000 && this->core.game_table->get_server_snapshot(GAME).data->size() <= known_servers().size(); i++)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    BOOST_REQUIRE_GT(this->core.game_table->get_server_snapshot(GAME).data->size(), known_servers().size());
+  }
+};
+}
+
+BOOST_AUTO_TEST_CASE(cancelled_refresh_restores_the_servers)
+{
+  Fixture f(endless_backend());
+  auto refresh = f.core.refresh(GAME, RefreshMode::FULL);
+  f.wait_for_publish();
+
+  refresh.cancel();
+  BOOST_CHECK_THROW(refresh.get(), CancelledError);
+  BOOST_CHECK(f.core.game_table->get_query_status(GAME) == QueryStatus::ERROR);
+  BOOST_CHECK(f.core.game_table->get_servers(GAME) == known_servers());
+}
+
+BOOST_AUTO_TEST_CASE(overdue_refresh_restores_the_servers)
+{
+  Fixture f(endless_backend());
+  f.set_deadline(1);
+
+  auto refresh = f.core.refresh(GAME, RefreshMode::FULL);
+  f.wait_for_publish();
+
+  BOOST_CHECK_THROW(refresh.get(), DeadlineExceededError);
+  BOOST_CHECK(f.core.game_table->get_query_status(GAME) == QueryStatus::ERROR);
+  BOOST_CHECK(f.core.game_table->get_servers(GAME) == known_servers());
+}
+
+BOOST_AUTO_TEST_CASE(finished_refresh_replaces_the_servers)
+{
+  Fixture f(endless_backend(3));
+  auto result = f.core.refresh(GAME, RefreshMode::FULL).get();
+
+  auto servers = f.core.game_table->get_servers(GAME);
+  BOOST_CHECK_EQUAL(result.servers, 31u);
+  BOOST_CHECK_EQUAL(servers.size(), 31u);
+  BOOST_CHECK_EQUAL(*servers.at("known:1").ping, 2);
+  BOOST_CHECK(!servers.count("known:0"));
+}
+
+BOOST_AUTO_TEST_CASE(failed_refresh_restores_the_servers)
+{
+  Fixture f(failing_backend([]() { throw std::runtime_error("connection lost"); }));
+
+  BOOST_CHECK_THROW(f.core.refresh(GAME, RefreshMode::FULL).get(), std::runtime_error);
+  BOOST_CHECK(f.core.game_table->get_query_status(GAME) == QueryStatus::ERROR);
+  BOOST_CHECK(f.core.game_table->get_servers(GAME) == known_servers());
+}
+
+BOOST_AUTO_TEST_CASE(unknown_exception_settles_the_refresh)
+{
+  Fixture f(failing_backend([]() { throw 42; }));
+
+  BOOST_CHECK_THROW(f.core.refresh(GAME, RefreshMode::FULL).get(), int);
+  BOOST_CHECK(f.core.game_table->get_query_status(GAME) == QueryStatus::ERROR);
+  BOOST_CHECK(f.core.game_table->get_servers(GAME) == known_servers());
+
+  // The refresh is no longer registered as running, so the next one starts afresh.
+  auto next = f.core.refresh(GAME, RefreshMode::FULL);
+  BOOST_CHECK_THROW(next.get(), int);
+}
@@ -0,0 +1,86 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#define BOOST_TEST_MODULE rule_classifier
+#include <boost/test/included/unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+#include <libobozrenie/rule_classifier.hpp>
+
+using namespace Obozrenie;
+
+BOOST_AUTO_TEST_CASE(rules_iterate_in_lexical_order)
+{
+  // Interned in reverse, so that ID order and lexical order disagree.
+  Server server;
+  for (auto k : { "zz_order_c", "zz_order_b", "zz_order_a" })
+  {
+    server.rules[Atom(k)] = "1";
+  }
+
+  std::vector<std::string> keys;
+  for (const auto& kv : server.rules)
+  {
+    keys.push_back(kv.first.str().raw());
+  }
+  BOOST_CHECK((keys == std::vector<std::string>{ "zz_order_a", "zz_order_b", "zz_order_c" }));
+}
+
+BOOST_AUTO_TEST_CASE(precedence_does_not_depend_on_rule_names)
+{
+  Server server;
+  server.rules[Atom("gamename")] = "baseq3";
+  server.rules[Atom("fs_game")] = "osp";
+  server.rules[Atom("punkbuster")] = "0";
+  server.rules[Atom("sv_punkbuster")] = "1";
+
+  RuleClassifier().apply(server);
+  BOOST_CHECK(server.game_mod->str() == "osp");
+  BOOST_CHECK(*server.secure);
+}
+
+BOOST_AUTO_TEST_CASE(game_names_win_over_builtin_ones)
+{
+  Server server;
+  server.rules[Atom("fs_game")] = "osp";
+  server.rules[Atom("mod")] = "cpma";
+  server.rules[Atom("g_needpass")] = "1";
+
+  RuleClassifier({ "mod:game_mod" }).apply(server);
+  BOOST_CHECK(server.game_mod->str() == "cpma");
+  BOOST_CHECK(*server.need_pass);
+
+  // Values the protocol already provided are kept.
+  Server described;
+  described.game_mod = Atom("cstrike");
+  described.rules[Atom("gamedir")] = "tf";
+  RuleClassifier().apply(described);
+  BOOST_CHECK(described.game_mod->str() == "cstrike");
+}
+
+BOOST_AUTO_TEST_CASE(version_rules_fill_the_version)
+{
+  Server server;
+  server.rules[Atom("version")] = "ioq3 1.36_GIT linux-x86_64";
+  server.rules[Atom("shortversion")] = "0.8.2";
+
+  RuleClassifier().apply(server);
+  BOOST_CHECK(server.version->str() == "0.8.2");
+}
@@ -0,0 +1,100 @@
+// This file is part of Obozrenie.
+
+// https://github.com/skybon/obozrenie
+// Copyright (C) 2016 Artem Vorotnikov
+//
+// Obozrenie is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License
+// as published by the Free Software Foundation,
+// either version 3 of the License, or (at your option) any later version.
+//
+// Obozrenie is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Obozrenie.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef _UDP_STAND_IN_HPP_
+#define _UDP_STAND_IN_HPP_
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <functional>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Loopback UDP server. The handler gets each request and returns the datagrams to answer it with; none for silence.
+class UdpStandIn
+{
+public:
+  typedef std::function<std::vector<std::string>(const std::string&)> Handler;
+
+private:
+  int fd;
+  uint16_t port;
+  Handler handler;
+  std::atomic<bool> stopping;
+  std::thread thread;
+
+  void serve()
+  {
+    char buf[2048];
+    while (!this->stopping)
+    {
+      pollfd p{ this->fd, POLLIN, 0 };
+      if (::poll(&p, 1, 20) <= 0)
+      {
+        continue;
+      }
+      sockaddr_in from{};
+      socklen_t len = sizeof(from);
+      auto n = ::recvfrom(this->fd, buf, sizeof(buf), 0, reinterpret_cast<sockaddr*>(&from), &len);
+      if (n <= 0)
+      {
+        continue;
+      }
+      this->requests++;
+      for (const auto& reply : this->handler(std::string(buf, n)))
+      {
+        ::sendto(this->fd, reply.data(), reply.size(), 0, reinterpret_cast<sockaddr*>(&from), len);
+      }
+    }
+  }
+
+public:
+  std::atomic<int> requests;
+
+  std::string host() const { return "127.0.0.1:" + std::to_string(this->port); }
+
+  explicit UdpStandIn(Handler h) : handler(std::move(h)), stopping(false), requests(0)
+  {
+    this->fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (this->fd < 0 || ::bind(this->fd, reinterpret_cast<sockaddr*>(&addr), len) != 0 || ::getsockname(this->fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0)
+    {
+      throw std::runtime_error("cannot bind on the loopback interface");
+    }
+    this->port = ntohs(addr.sin_port);
+    this->thread = std::thread(&UdpStandIn::serve, this);
+  }
+
+  ~UdpStandIn()
+  {
+    this->stopping = true;
+    this->thread.join();
+    ::close(this->fd);
+  }
+};
+
+#endif